@@ -11,10 +11,113 @@
 #include <cstdio>
 #include <cstring>
 #include <string>
+#include <filesystem>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <io.h>      // _commit
+#include <windows.h> // MoveFileEx
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>  // mkstemp, fsync
+#endif
 
 #include "DBPF.h"
 #include "DBPF_types.h"
 #include "DBPF_resource.h"
+#include "DBPF_byteStreamFunctions.h"
+#include "DBPF_byteCursor.h"
+#include "DBPF_arena.h"
+
+
+/**
+<pre>
+ * Layout of index table and DIR entries, one instantiation per index version,
+ * so the loops below pick a layout once per package, and then go through the entries
+ * at a fixed stride, without testing the version for every field.
+ *   bInstance2 - index version 7.1, entries have a 2nd instance ID (instance high)
+ *   bLocation  - index table entries have a location, DIR entries don't
+ * Fields that aren't in the layout are left as they are.
+</pre>
+**/
+template< bool bInstance2, bool bLocation >
+class DBPF_indexLayoutType
+{
+public:
+  static const unsigned int ENTRY_SIZE = 4 * ( 4 + ( bInstance2 ? 1 : 0 ) + ( bLocation ? 1 : 0 ) );
+
+  static void decode( const unsigned char * p, DBPFindexType & entry )
+  {
+    entry.muTypeID     = DBPF_byteLoadType< 4, false >::load( p );
+    entry.muGroupID    = DBPF_byteLoadType< 4, false >::load( p + 4 );
+    entry.muInstanceID = DBPF_byteLoadType< 4, false >::load( p + 8 );
+    p += 12;
+    if( bInstance2 )
+    { entry.muInstanceID2 = DBPF_byteLoadType< 4, false >::load( p );
+      p += 4;
+    }
+    if( bLocation )
+    { entry.muLocation = DBPF_byteLoadType< 4, false >::load( p );
+      p += 4;
+    }
+    entry.muSize = DBPF_byteLoadType< 4, false >::load( p );
+  }
+
+  // entryCount entries from bytes, replaces the table
+  static void decodeTable( const unsigned char * bytes, const unsigned int entryCount, vector< DBPFindexType > & table )
+  {
+    table.assign( entryCount, DBPFindexType() );
+    for( unsigned int i = 0; i < entryCount; ++i )
+      decode( bytes + (size_t)i * ENTRY_SIZE, table[i] );
+  }
+
+  // writes ENTRY_SIZE bytes, advances bytes
+  static void encode( unsigned char * & bytes, const DBPFindexType & entry )
+  {
+    DBPF_byteLoadType< 4, false >::store( bytes,     entry.muTypeID );
+    DBPF_byteLoadType< 4, false >::store( bytes + 4, entry.muGroupID );
+    DBPF_byteLoadType< 4, false >::store( bytes + 8, entry.muInstanceID );
+    bytes += 12;
+    if( bInstance2 )
+    { DBPF_byteLoadType< 4, false >::store( bytes, entry.muInstanceID2 );
+      bytes += 4;
+    }
+    if( bLocation )
+    { DBPF_byteLoadType< 4, false >::store( bytes, entry.muLocation );
+      bytes += 4;
+    }
+    DBPF_byteLoadType< 4, false >::store( bytes, entry.muSize );
+    bytes += 4;
+  }
+};
+
+typedef DBPF_indexLayoutType< false, true >  DBPF_index70Type;    // index table, version 7.0
+typedef DBPF_indexLayoutType< true,  true >  DBPF_index71Type;    // index table, version 7.1
+typedef DBPF_indexLayoutType< false, false > DBPF_DIRentry70Type; // DIR, version 7.0
+typedef DBPF_indexLayoutType< true,  false > DBPF_DIRentry71Type; // DIR, version 7.1
+
+
+/**
+<pre>
+ * input:   f - file, at the first entry
+ *          entryCount - number of entries to read
+ * output:  table - the entries
+ * returns: success / failure, failure if the file ends first
+ *
+ * purpose: read a whole index table or DIR in one read, and decode it with Layout
+</pre>
+**/
+template< class Layout >
+static bool readIndexEntries( FILE * f, const unsigned int entryCount, vector< DBPFindexType > & table )
+{
+  vector< unsigned char > bytes( (size_t)entryCount * Layout::ENTRY_SIZE );
+  if( bytes.size() > 0 && 1 != fread( &bytes[0], bytes.size(), 1, f ) )
+    return false;
+
+  Layout::decodeTable( bytes.empty() ? NULL : &bytes[0], entryCount, table );
+  return true;
+}
 
 
 // -------------------------------------------------------------------------
@@ -60,14 +163,24 @@ void DBPFindexType::clear()
 **/
 void DBPFindexType::read( FILE * f , bool bRead2ndInstanceID, bool bReadLocation )
 {
-  fread( &muTypeID, sizeof( unsigned int ), 1, f );
-  fread( &muGroupID, sizeof( unsigned int ), 1, f );
-  fread( &muInstanceID, sizeof( unsigned int ), 1, f );
-  if( bRead2ndInstanceID )
-    fread( &muInstanceID2, sizeof( unsigned int ), 1, f );
-  if( bReadLocation )
-    fread( &muLocation, sizeof( unsigned int ), 1, f );
-  fread( &muSize, sizeof( unsigned int ), 1, f );
+  unsigned char bytes[ DBPF_index71Type::ENTRY_SIZE ];
+
+  if( bRead2ndInstanceID && bReadLocation )
+  { if( 1 == fread( bytes, DBPF_index71Type::ENTRY_SIZE, 1, f ) )
+      DBPF_index71Type::decode( bytes, *this );
+  }
+  else if( bReadLocation )
+  { if( 1 == fread( bytes, DBPF_index70Type::ENTRY_SIZE, 1, f ) )
+      DBPF_index70Type::decode( bytes, *this );
+  }
+  else if( bRead2ndInstanceID )
+  { if( 1 == fread( bytes, DBPF_DIRentry71Type::ENTRY_SIZE, 1, f ) )
+      DBPF_DIRentry71Type::decode( bytes, *this );
+  }
+  else
+  { if( 1 == fread( bytes, DBPF_DIRentry70Type::ENTRY_SIZE, 1, f ) )
+      DBPF_DIRentry70Type::decode( bytes, *this );
+  }
 }
 
 
@@ -138,7 +251,7 @@ bool DBPF_DIRtype::read( FILE * f, DBPFindexType &myIndexEntry, bool bRead2ndIns
   this->mMyIndexEntry = myIndexEntry;
 
   // how many entries are in the table of compressed things?
-  unsigned int entrySize = bRead2ndInstance ? 5 * sizeof( unsigned int ) : 4 * sizeof( unsigned int );
+  unsigned int entrySize = bRead2ndInstance ? DBPF_DIRentry71Type::ENTRY_SIZE : DBPF_DIRentry70Type::ENTRY_SIZE;
   unsigned int entryCount = this->mMyIndexEntry.muSize / entrySize;
 #ifdef _DEBUG
   printf( "\n" );
@@ -148,20 +261,20 @@ bool DBPF_DIRtype::read( FILE * f, DBPFindexType &myIndexEntry, bool bRead2ndIns
   // go to location of DIR in file
   fseek( f, this->mMyIndexEntry.muLocation, SEEK_SET );
 
-  // read index table of compressed stuff (no location data)
-  if( this->mIndexTableCompressed.empty() == false )
+  // read index table of compressed stuff (no location data), layout chosen once
+  bool bOK = bRead2ndInstance
+    ? readIndexEntries< DBPF_DIRentry71Type >( f, entryCount, this->mIndexTableCompressed )
+    : readIndexEntries< DBPF_DIRentry70Type >( f, entryCount, this->mIndexTableCompressed );
+  if( false == bOK )
+  { fprintf( stderr, "ERROR: DBPF_DIRtype.read, file ends before the DIR does, %u entries\n", entryCount );
     this->mIndexTableCompressed.clear();
+    return false;
+  }
 
-  DBPFindexType entry;
-  const bool bReadLocation = false;
-  for( unsigned int i = 0; i < entryCount; ++i )
-  {
-    entry.read( f, bRead2ndInstance, bReadLocation );
-    this->mIndexTableCompressed.push_back( entry );
 #ifdef _DEBUG
-    entry.dump( stdout );
+  for( unsigned int i = 0; i < entryCount; ++i )
+    (this->mIndexTableCompressed)[i].dump( stdout );
 #endif
-  }
 
   return true;
 }
@@ -460,10 +573,6 @@ bool DBPFtype::readIndexTable()
   if( false == this->mIndexTable.empty() )
     this->mIndexTable.clear();
 
-  DBPFindexType indexEntry;
-  bool bRead2ndInstanceID = ( this->muIndexVersionMinor == 1 ) ? true : false;
-  bool bReadLocation = true;
-
   // printf( "index offset: %u\n", this->muIndexOffset );
   int offset = (int)(this->muIndexOffset );
   if( offset < 0 )
@@ -472,19 +581,26 @@ bool DBPFtype::readIndexTable()
   }
   fseek( this->mFile, offset, SEEK_SET );
 
+  // whole table in one read, layout chosen once for the package
+  bool bOK = ( 1 == this->muIndexVersionMinor )
+    ? readIndexEntries< DBPF_index71Type >( this->mFile, this->muIndexEntryCount, this->mIndexTable )
+    : readIndexEntries< DBPF_index70Type >( this->mFile, this->muIndexEntryCount, this->mIndexTable );
+  if( false == bOK )
+  { fprintf( stderr, "ERROR: DBPFtype.readIndexTable, file ends before the index table does, %u entries\n",
+             this->muIndexEntryCount );
+    this->mIndexTable.clear();
+    return false;
+  }
+
 #ifdef _DEBUG
   printf( "\n    " );
   DBPFindexType::dumpTableHeader( stdout );
-#endif
   for( unsigned int i = 0; i < this->muIndexEntryCount; ++i )
   {
-    indexEntry.read( this->mFile, bRead2ndInstanceID, bReadLocation );
-    this->mIndexTable.push_back( indexEntry );
-#ifdef _DEBUG
     printf( "%3u ", i );
     (this->mIndexTable)[i].dump( stdout );
-#endif
   }
+#endif
 
   return true;
 }
@@ -606,6 +722,7 @@ bool DBPFtype::isCompressed( const DBPFindexType entry, unsigned int & decmpSize
  * output:  bytes - byte array, data for that resource, read from the file,
  *                  this gets allocated here with new, pass in an *unallocated* array,
  *                  use delete [] when done with the data
+ *                  (or in pArena, if it's not NULL, then the arena frees it)
  *          byteCount - size of the byte array
  * returns: success / failure
  *
@@ -613,14 +730,15 @@ bool DBPFtype::isCompressed( const DBPFindexType entry, unsigned int & decmpSize
  * opens the file, reads the data, closes the file
 </pre>
 **/
-bool DBPFtype::getData( const DBPFindexType entry, unsigned char * & bytes, unsigned int & byteCount )
+bool DBPFtype::getData( const DBPFindexType entry, unsigned char * & bytes, unsigned int & byteCount,
+                        DBPF_arenaType * pArena )
 {
   // open file
   if( this->openFile() == false )
     return false;
 
   // allocate memory
-  bytes = new unsigned char[ entry.muSize ];
+  bytes = dbpfNewBytes( pArena, entry.muSize );
   if( NULL == bytes )
   { fprintf( stderr, "ERROR: DBPFtype.getData, failed to allocate memory\n" );
     return false;
@@ -644,15 +762,110 @@ bool DBPFtype::getData( const DBPFindexType entry, unsigned char * & bytes, unsi
 }
 
 
+// -------------------------------------------------------------------------
+// atomic replace helpers, for DBPFtype::write with bAtomic
+
+
+/**
+<pre>
+ * input:   fileName - file that will be replaced
+ * output:  strTempName - name of the new temp file, in the same directory as fileName
+ * returns: temp file opened for binary writing, or NULL
+</pre>
+**/
+static FILE * openTempFileNextTo( const char * fileName, string & strTempName )
+{
+#if defined(_WIN32)
+  strTempName = string( fileName ) + ".$new";
+  return fopen( strTempName.c_str(), "wb" );
+#else
+  strTempName = string( fileName ) + ".XXXXXX";
+  int fd = mkstemp( &( strTempName[0] ) );
+  if( fd < 0 )
+    return NULL;
+
+  // mkstemp makes the file private, give it the permissions of the file it replaces
+  struct stat st;
+  if( 0 == stat( fileName, &st ) )
+    fchmod( fd, st.st_mode & 07777 );
+
+  FILE * f = fdopen( fd, "wb" );
+  if( NULL == f )
+  {
+    close( fd );
+    remove( strTempName.c_str() );
+  }
+  return f;
+#endif
+}
+
+
+// flush stdio and get the file's data to disk
+static bool syncFile( FILE * f )
+{
+  if( 0 != fflush( f ) )
+    return false;
+#if defined(_WIN32)
+  return( 0 == _commit( _fileno( f ) ) );
+#else
+  return( 0 == fsync( fileno( f ) ) );
+#endif
+}
+
+
+/**
+<pre>
+ * rename strTempName over fileName, in one step,
+ * either the old file or the whole new file is there, never a partial file
+</pre>
+**/
+static bool replaceFile( const string & strTempName, const char * fileName )
+{
+#if defined(_WIN32)
+  return( 0 != MoveFileExA( strTempName.c_str(), fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) );
+#else
+  if( 0 != rename( strTempName.c_str(), fileName ) )
+    return false;
+
+  // make the rename itself durable
+  filesystem::path dir = filesystem::path( fileName ).parent_path();
+  if( dir.empty() )
+    dir = ".";
+  int fdDir = open( dir.c_str(), O_RDONLY );
+  if( fdDir >= 0 )
+  {
+    fsync( fdDir );
+    close( fdDir );
+  }
+  return true;
+#endif
+}
+
+
+// -------------------------------------------------------------------------
+
+
 /**
 <pre>
  * Write a new package file, given an old package with its old header,
  * and a list of new and likely updated resources.
+ *
+ * The whole layout is worked out first, so the header, DIR and index table
+ * are built in memory, complete, and the file is written front to back
+ * in a few large writes, without seeking back to patch the header.
+ * The file is laid out as: header, resources, DIR, index table.
+ *
+ * bAtomic - write to a temp file in the same directory, sync it to disk,
+ *           then rename it over fileName.  If anything fails, or the program
+ *           is interrupted, the old fileName is left as it was.
+ *           Use this to rewrite the package that was read, in place,
+ *           it also allows pass-through resources when doing that.
 </pre>
 **/
 bool DBPFtype::write( const char * fileName,                      // IN
                       vector< DBPF_resourceType * > & resources,  // IN
-                      size_t & fileSize )                         // OUT
+                      size_t & fileSize,                          // OUT
+                      bool bAtomic )                              // IN
 {
   fileSize = 0;
 
@@ -674,124 +887,308 @@ bool DBPFtype::write( const char * fileName,                      // IN
   }
 
 
-  // open file for binary writing
-  FILE * f = fopen( fileName, "wb" );
+  // where everything goes, and the header, DIR, and index table bytes
+
+  DBPF_writeStateType state;
+  if( false == this->layoutPackage( resources, state ) )
+    return false;
+
+  unsigned char header[ DBPF_HEADER_SIZE ];
+  this->serializeHeader( header, state );
+
+  vector< unsigned char > tables( state.muIndexOffset - state.muOffsetOfNewDIR + state.muIndexSizeInBytes );
+  unsigned char * bytes = &( tables[0] );
+  this->serializeDIR( bytes, resources );
+  this->serializeIndexTable( bytes, resources, state );
+
+
+  // pass-through resources are copied from the file this package was read from,
+  // so that file can't be the one we're about to overwrite
+
+  FILE * fSource = NULL;
+  for( size_t i = 0; i < resources.size(); ++i )
+  {
+    if( NULL == resources[i] || false == resources[i]->isPassThrough() )
+      continue;
+
+    error_code ec;
+    if( false == bAtomic && filesystem::equivalent( fileName, this->mstrFileName, ec ) )
+    { fprintf( stderr, "ERROR: DBPFtype.write, can't write %s over itself, it has pass-through resources, write with bAtomic\n", fileName );
+      return false;
+    }
+
+    fSource = fopen( this->mstrFileName, "rb" );
+    if( NULL == fSource )
+    { fprintf( stderr, "ERROR: DBPFtype.write, failed to open %s for pass-through resources\n", this->mstrFileName );
+      return false;
+    }
+    break;
+  }
+
+
+  // open file for binary writing (a temp file, if atomic)
+  string strTempName;
+  FILE * f = bAtomic ? openTempFileNextTo( fileName, strTempName ) : fopen( fileName, "wb" );
   if( NULL == f )
-  { fprintf( stderr, "ERROR: DBPFtype.write, failed to open %s for writing\n", fileName );
+  { fprintf( stderr, "ERROR: DBPFtype.write, failed to open %s for writing\n",
+             bAtomic ? strTempName.c_str() : fileName );
+    if( NULL != fSource )
+      fclose( fSource );
     return false;
   }
 
+  // big buffer, so lots of small resources become a few large writes
+  setvbuf( f, NULL, _IOFBF, DBPF_WRITE_BUFFER_SIZE );
+
 
   // write the file
 
-  this->writeHeader( f, resources );
-  this->writeResources( f, resources );
-  this->writeDIR( f, resources );
-  this->writeIndexTable( f, resources );
+  bool bOK = ( 1 == fwrite( header, DBPF_HEADER_SIZE, 1, f ) );
+  bOK = bOK && this->writeResources( f, fSource, resources );
+  bOK = bOK && ( 1 == fwrite( &( tables[0] ), tables.size(), 1, f ) );
 
-  // # of bytes written
-  fseek( f, 0, SEEK_END );
-  fileSize = ftell( f );
+  // close files
+  if( bAtomic )
+    bOK = bOK && syncFile( f );
+  if( 0 != fclose( f ) )
+    bOK = false;
+  if( NULL != fSource )
+    fclose( fSource );
 
-  // close file
-  fclose( f );
+  // atomic, put the new file in place of the old one
+  if( bAtomic )
+  {
+    if( bOK && false == replaceFile( strTempName, fileName ) )
+    { fprintf( stderr, "ERROR: DBPFtype.write, failed to rename %s to %s\n", strTempName.c_str(), fileName );
+      bOK = false;
+    }
+    if( false == bOK )
+      remove( strTempName.c_str() );
+  }
 
+  if( false == bOK )
+  { fprintf( stderr, "ERROR: DBPFtype.write, failed writing %s\n", fileName );
+    return false;
+  }
+
+  // # of bytes written
+  fileSize = (size_t)( state.muIndexOffset ) + state.muIndexSizeInBytes;
 
   return true;
 } // write
 
 
-bool DBPFtype::writeHeader( FILE * f, vector< DBPF_resourceType * > & resources )
+/**
+<pre>
+ * input:   resources - resources to write
+ * output:  state - where the DIR and index table go, and how big they are
+ * returns: success / failure
+ *
+ * purpose: lay out a new package file, header, then resources, then DIR,
+ *          then index table.  Sets each resource's location to where it will be written.
+</pre>
+**/
+bool DBPFtype::layoutPackage( vector< DBPF_resourceType * > & resources, DBPF_writeStateType & state )
 {
+  const bool b71 = ( 1 == this->muIndexVersionMinor );
+  const unsigned int entrySize = b71 ? DBPF_index71Type::ENTRY_SIZE : DBPF_index70Type::ENTRY_SIZE;
+  const unsigned int DIRentrySize = b71 ? DBPF_DIRentry71Type::ENTRY_SIZE : DBPF_DIRentry70Type::ENTRY_SIZE;
+
+  size_t offset = DBPF_HEADER_SIZE;
+  unsigned int sizeCmp = 0, sizeUnc = 0;
+
+  state.muEntryCountOfNewDIR = 0;
+  state.muIndexEntryCount = 0;
+
+  DBPF_resourceType * pResource = NULL;
+
+  // resources
+
+  for( size_t i = 0; i < resources.size(); ++i )
+  {
+    pResource = resources[i];
+
+    // deleted resource
+    if( NULL == pResource )
+      continue;
+
+    // DIR, goes after resources, written by us
+    if( DBPF_DIR == pResource->getType() )
+      continue;
+
+    pResource->setLocation( (unsigned int)offset );
+    offset += pResource->getRawByteCount();
+
+    ++state.muIndexEntryCount;
+    if( true == pResource->isCompressed( sizeCmp, sizeUnc ) )
+      ++state.muEntryCountOfNewDIR;
+  }
+
+  // DIR, after resources
+  // (the old DIR resource, if there is one in the list, gets the new DIR offset)
+
+  state.muOffsetOfNewDIR = (unsigned int)offset;
+  for( size_t i = 0; i < resources.size(); ++i )
+  {
+    if( NULL != resources[i] && DBPF_DIR == resources[i]->getType() )
+      resources[i]->setLocation( state.muOffsetOfNewDIR );
+  }
+  offset += (size_t)( state.muEntryCountOfNewDIR ) * DIRentrySize;
+
+  // index table, after DIR, one more entry for the DIR itself
+
+  ++state.muIndexEntryCount;
+  state.muIndexOffset = (unsigned int)offset;
+  state.muIndexSizeInBytes = state.muIndexEntryCount * entrySize;
+  offset += state.muIndexSizeInBytes;
+
+  if( offset > 0xFFFFFFFFu )
+  { fprintf( stderr, "ERROR: DBPFtype.layoutPackage, package would be too large, %lu bytes\n", (unsigned long)offset );
+    return false;
+  }
+
+  return true;
+}
+
+
+/**
+<pre>
+ * output:  bytes - DBPF_HEADER_SIZE bytes, the complete header for the new file
+ *
+ * uses the layout from layoutPackage, so index entry count, offset, and size are already known
+</pre>
+**/
+void DBPFtype::serializeHeader( unsigned char * bytes, const DBPF_writeStateType & state ) const
+{
+  memset( bytes, 0, DBPF_HEADER_SIZE );
+
   // magic, DBPF
 
-  char magic[5];
-  strcpy( magic, "DBPF" );
-  fwrite( magic, 1, 4, f );
+  memcpy( bytes, "DBPF", 4 );
+  bytes += 4;
 
   // major version,
   // minor version
 
-  unsigned int foo = this->muVersionMajor;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
-  foo = this->muVersionMinor + 1;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, this->muVersionMajor );
+  writeByteStream_uint( bytes, this->muVersionMinor + 1 );
 
   // 3 unknowns
 
-  fwrite( this->muUnknowns, sizeof( unsigned int ), 3, f );
+  for( int i = 0; i < 3; ++i )
+    writeByteStream_uint( bytes, this->muUnknowns[i] );
 
   // date created,
   // date modified (should update this)
 
-  fwrite( this->muDates, sizeof( unsigned int ), 2, f );
+  writeByteStream_uint( bytes, this->muDates[0] );
+  writeByteStream_uint( bytes, this->muDates[1] );
 
   // index major version
 
-  foo = this->muIndexVersionMajor;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, this->muIndexVersionMajor );
 
-  // index entry count
-  //   number of resources (currently not including DIR)
-
-  foo = 0;
-  for( unsigned int i = 0; i < resources.size(); ++i )
-  {
-    if( resources[i] != NULL )
-      ++foo;
-  }
+  // index entry count,
+  //   the resources, and one for the DIR we write (an old DIR in resources isn't counted again)
 
-  foo += 1;  // hack, add one for DIR, not a proper resource subclass yet, and should check if we have at least on compressed resource...
-
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, state.muIndexEntryCount );
 
   // offset of first index entry
   // size of index table in bytes
-  //   WRITE THIS IN LATER, WHEN WRITING INDEX TABLE
-  //   put zeros for now
 
-  foo = 0;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, state.muIndexOffset );
+  writeByteStream_uint( bytes, state.muIndexSizeInBytes );
 
   // hole entry count,
   // hole offset,
   // hole size
   //  put zeros for all of these
 
-  foo = 0;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, 0 );
+  writeByteStream_uint( bytes, 0 );
+  writeByteStream_uint( bytes, 0 );
 
   // index minor version
 
-  foo = this->muIndexVersionMinor + 1;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, this->muIndexVersionMinor + 1 );
 
   // this value not used in Sims2, put zero
 
-  foo = 0;
-  fwrite( &foo, sizeof( unsigned int ), 1, f );
+  writeByteStream_uint( bytes, 0 );
 
   // last unknown
 
-  fwrite( &(this->muUnknownLast), sizeof(unsigned int), 1, f );
+  writeByteStream_uint( bytes, this->muUnknownLast );
+
+  // 24 bytes reserved by EA, probably not used, zeros from memset
+}
+
+
+/**
+<pre>
+ * input:   src - file to copy from, at srcOffset
+ *          dst - file to copy to, at dstOffset, which must be where dst's writes are up to
+ *          byteCount - how many bytes to copy
+ * returns: success / failure, on success dst is positioned after the copied bytes
+ *
+ * purpose: copy a byte range from one file to another without bringing it into this process,
+ *          uses copy_file_range on Linux (which can share blocks on btrfs/xfs),
+ *          plain read/write anywhere else, or if the file system can't do it
+</pre>
+**/
+static bool copyByteRange( FILE * dst, FILE * src, unsigned int srcOffset, unsigned int dstOffset, unsigned int byteCount )
+{
+  // anything buffered for dst goes out before the copied range
+  if( 0 != fflush( dst ) )
+    return false;
+
+#if defined(__linux__)
+  off_t offIn = srcOffset, offOut = dstOffset;
+  while( byteCount > 0 )
+  {
+    ssize_t n = copy_file_range( fileno( src ), &offIn, fileno( dst ), &offOut, byteCount, 0 );
+    if( n <= 0 )
+      break; // not supported here, or some error, finish with read/write
+    byteCount -= (unsigned int)n;
+  }
+  srcOffset = (unsigned int)offIn;
+  dstOffset = (unsigned int)offOut;
+#endif
+
+  // copy_file_range doesn't move dst's stdio position, set it here
+  if( 0 != fseek( dst, dstOffset, SEEK_SET ) )
+    return false;
+
+  if( 0 == byteCount )
+    return true;
 
-  // 24 bytes reserved by EA, probably not used, put zeros
+  if( 0 != fseek( src, srcOffset, SEEK_SET ) )
+    return false;
 
-  unsigned char zeros[24];
-  for( int i = 0; i < 24; ++i )
-    zeros[i] = 0;
-  fwrite( zeros, sizeof(unsigned char), 24, f );
+  unsigned char buffer[ 65536 ];
+  while( byteCount > 0 )
+  {
+    size_t n = ( byteCount < sizeof( buffer ) ) ? byteCount : sizeof( buffer );
+    if( n != fread( buffer, 1, n, src ) )
+      return false;
+    if( n != fwrite( buffer, 1, n, dst ) )
+      return false;
+    byteCount -= (unsigned int)n;
+  }
 
   return true;
 }
 
 
-bool DBPFtype::writeResources( FILE * f, vector< DBPF_resourceType * > & resources )
+/**
+<pre>
+ * writes resources in order, locations were set by layoutPackage,
+ * pass-through resources are copied from fSource (the package this was read from)
+</pre>
+**/
+bool DBPFtype::writeResources( FILE * f, FILE * fSource, vector< DBPF_resourceType * > & resources )
 {
-  // resource loop
+  // resource loop, locations were set by layoutPackage
 
   DBPF_resourceType * pResource = NULL;
 
@@ -810,34 +1207,37 @@ bool DBPFtype::writeResources( FILE * f, vector< DBPF_resourceType * > & resourc
     if( pResource->getType() == DBPF_DIR )
       continue;
 
-    // remember this resource's offset
-    size_t offset = ftell( f );
-    pResource->setLocation( (unsigned int)offset );
+    byteCount = pResource->getRawByteCount();
+
+    // pass-through resource, copy from the source file
+    if( pResource->isPassThrough() )
+    {
+      DBPF_passThroughType * pPass = static_cast< DBPF_passThroughType * >( pResource );
+      if( NULL == fSource
+       || false == copyByteRange( f, fSource, pPass->getSourceLocation(), pPass->getLocation(), byteCount ) )
+      { fprintf( stderr, "ERROR: DBPFtype.writeResources, failed to copy pass-through resource from %s\n", this->mstrFileName );
+        return false;
+      }
+      continue;
+    }
 
     // write resource
-    byteCount = pResource->getRawByteCount();
     bytes = pResource->getRawBytes();
-    fwrite( bytes, 1, byteCount, f );
+    if( byteCount > 0 && 1 != fwrite( bytes, byteCount, 1, f ) )
+      return false;
   }
 
   return true;
 }
 
 
-static unsigned int gOffsetOfNewDIR = 0;
-static unsigned int gEntryCountOfNewDIR = 0;
-
-bool DBPFtype::writeDIR( FILE * f, vector< DBPF_resourceType * > & resources )
+// DIR entries of the compressed resources, with Layout's fields
+template< class Layout >
+static void serializeDIRentries( unsigned char * & bytes, vector< DBPF_resourceType * > & resources )
 {
-  // offset of the DIR resource
-  size_t offset = ftell( f );
-
-  gOffsetOfNewDIR = (unsigned int)offset; // temporary hack, until I make DIR a proper resource subclass...
-  gEntryCountOfNewDIR = 0;
-
-
   DBPF_resourceType * pResource = NULL;
-  unsigned int foo = 0, sizeUnc = 0, sizeCmp = 0;
+  unsigned int sizeUnc = 0, sizeCmp = 0;
+  DBPFindexType entry;
 
   for( size_t i = 0; i < resources.size(); ++i )
   {
@@ -847,47 +1247,48 @@ bool DBPFtype::writeDIR( FILE * f, vector< DBPF_resourceType * > & resources )
     if( NULL == pResource )
       continue;
 
-    // old DIR resource, save the new DIR offset
-    // (actually, this won't work right now, since I don't have a DIR resource subclass... so save in gOffset...)
-
+    // old DIR resource, not a compressed resource
     if( DBPF_DIR == pResource->getType() )
-    {
-      pResource->setLocation( (unsigned int)offset );
       continue;
-    }
 
     // non-DIR resource, if compressed, write its DIR entry
 
     if( true == pResource->isCompressed( sizeCmp, sizeUnc ) )
     {
-      foo = pResource->getType();     fwrite( &foo, sizeof(unsigned int), 1, f );
-      foo = pResource->getGroup();    fwrite( &foo, sizeof(unsigned int), 1, f );
-      foo = pResource->getInstance(); fwrite( &foo, sizeof(unsigned int), 1, f );
-      if( 1 == this->muIndexVersionMinor )
-      { foo = pResource->getInstance2(); fwrite( &foo, sizeof(unsigned int), 1, f ); }
-      fwrite( &sizeUnc, sizeof(unsigned int), 1, f );
-
-      // temporary hack until I make DIR a proper subclass of resource
-      ++gEntryCountOfNewDIR;
+      entry.muTypeID = pResource->getType();
+      entry.muGroupID = pResource->getGroup();
+      entry.muInstanceID = pResource->getInstance();
+      entry.muInstanceID2 = pResource->getInstance2();
+      entry.muSize = sizeUnc;
+      Layout::encode( bytes, entry );
     }
   }
-
-  return true;
 }
 
 
-bool DBPFtype::writeIndexTable( FILE * f, vector< DBPF_resourceType * > & resources )
+/**
+<pre>
+ * in/out:  bytes - DIR entries are written here, pointer is advanced past them
+ *
+ * one entry for each compressed resource, in the same order as layoutPackage counted them
+</pre>
+**/
+void DBPFtype::serializeDIR( unsigned char * & bytes, vector< DBPF_resourceType * > & resources ) const
 {
-  // remember index table offset
-
-  unsigned int offset = (unsigned int)ftell( f );
-
+  if( 1 == this->muIndexVersionMinor )
+    serializeDIRentries< DBPF_DIRentry71Type >( bytes, resources );
+  else
+    serializeDIRentries< DBPF_DIRentry70Type >( bytes, resources );
+}
 
-  // write index table
 
+// index table entries, with Layout's fields, and last the entry for the new DIR
+template< class Layout, class DIRLayout >
+static void serializeIndexEntries( unsigned char * & bytes, vector< DBPF_resourceType * > & resources,
+                                   const DBPFindexType & DIRentry, const DBPF_writeStateType & state )
+{
   DBPF_resourceType * pResource = NULL;
-  unsigned int foo = 0;
-  unsigned int indexEntryCount = 0;
+  DBPFindexType entry;
 
   for( size_t i = 0; i < resources.size(); ++i )
   {
@@ -904,61 +1305,37 @@ bool DBPFtype::writeIndexTable( FILE * f, vector< DBPF_resourceType * > & resour
 
     // valid resource
 
-    ++indexEntryCount;
-
-    foo = pResource->getType();     fwrite( &foo, sizeof(unsigned int), 1, f );
-    foo = pResource->getGroup();    fwrite( &foo, sizeof(unsigned int), 1, f );
-    foo = pResource->getInstance(); fwrite( &foo, sizeof(unsigned int), 1, f );
-    if( 1 == this->muIndexVersionMinor )
-    { foo = pResource->getInstance2(); fwrite( &foo, sizeof(unsigned int), 1, f ); }
-    foo = pResource->getLocation(); fwrite( &foo, sizeof(unsigned int), 1, f );
-    foo = pResource->getRawByteCount(); fwrite( &foo, sizeof(unsigned int), 1, f );
-  }
-
-  // hack - last entry, for DIR
-
-  // DIR TGI
-  foo = this->mDIR.mMyIndexEntry.muTypeID;
-  fwrite( &foo, sizeof(unsigned int), 1, f );
-  foo = this->mDIR.mMyIndexEntry.muGroupID;
-  fwrite( &foo, sizeof(unsigned int), 1, f );
-  foo = this->mDIR.mMyIndexEntry.muInstanceID;
-  fwrite( &foo, sizeof(unsigned int), 1, f );
-  if( 1 == this->muIndexVersionMinor )
-  {
-    foo = this->mDIR.mMyIndexEntry.muInstanceID2;
-    fwrite( &foo, sizeof(unsigned int), 1, f );
+    entry.muTypeID = pResource->getType();
+    entry.muGroupID = pResource->getGroup();
+    entry.muInstanceID = pResource->getInstance();
+    entry.muInstanceID2 = pResource->getInstance2();
+    entry.muLocation = pResource->getLocation();
+    entry.muSize = pResource->getRawByteCount();
+    Layout::encode( bytes, entry );
   }
 
-  // DIR location
-  foo = gOffsetOfNewDIR;
-  fwrite( &foo, sizeof(unsigned int), 1, f );
+  // hack - last entry, for DIR, TGI of the old one, new location and size
 
-  // DIR size
-  unsigned int DIRentrySize = 16;
-  if( 1 == this->muIndexVersionMinor )
-    DIRentrySize = 20;
-  foo = gEntryCountOfNewDIR * DIRentrySize;
-  fwrite( &foo, sizeof(unsigned int), 1, f );
-
-  // increment resource count, DIR is a resource
-  ++indexEntryCount;
-
-
-
-  // go back to header, write index table offset
-
-  fseek( f, 40, SEEK_SET );
-  fwrite( &offset, sizeof(unsigned int), 1, f );
+  entry = DIRentry;
+  entry.muLocation = state.muOffsetOfNewDIR;
+  entry.muSize = state.muEntryCountOfNewDIR * DIRLayout::ENTRY_SIZE;
+  Layout::encode( bytes, entry );
+}
 
-  // back in header, write size of index table in bytes
 
-  unsigned int entrySize = 20;
+/**
+<pre>
+ * in/out:  bytes - index table is written here, pointer is advanced past it
+ *
+ * resources must have been given their locations by layoutPackage
+</pre>
+**/
+void DBPFtype::serializeIndexTable( unsigned char * & bytes,
+                                    vector< DBPF_resourceType * > & resources,
+                                    const DBPF_writeStateType & state ) const
+{
   if( 1 == this->muIndexVersionMinor )
-    entrySize = 24;
-  unsigned int indexSize = indexEntryCount * entrySize;
-  fwrite( &indexSize, sizeof(unsigned int), 1, f );
-
-
-  return true;
+    serializeIndexEntries< DBPF_index71Type, DBPF_DIRentry71Type >( bytes, resources, this->mDIR.mMyIndexEntry, state );
+  else
+    serializeIndexEntries< DBPF_index70Type, DBPF_DIRentry70Type >( bytes, resources, this->mDIR.mMyIndexEntry, state );
 }
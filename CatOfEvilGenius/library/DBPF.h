@@ -17,6 +17,7 @@ using namespace std;
 
 // forward declaration
 class DBPF_resourceType;
+class DBPF_arenaType;
 
 /**
 <pre>
@@ -77,6 +78,35 @@ public:
 };
 
 
+// size of the package header, in bytes
+#define DBPF_HEADER_SIZE 96
+
+// stdio buffer size used when writing a package
+#define DBPF_WRITE_BUFFER_SIZE ( 1 << 20 )
+
+
+/**
+<pre>
+ * layout for one call of DBPFtype::write,
+ * where the new DIR and index table go and how big they are,
+ * kept per write (not in globals) so several packages can be written at once
+</pre>
+**/
+class DBPF_writeStateType
+{
+public:
+  unsigned int muOffsetOfNewDIR;
+  unsigned int muEntryCountOfNewDIR;
+  unsigned int muIndexOffset;
+  unsigned int muIndexEntryCount;
+  unsigned int muIndexSizeInBytes;
+
+  DBPF_writeStateType()
+  : muOffsetOfNewDIR( 0 ), muEntryCountOfNewDIR( 0 ),
+    muIndexOffset( 0 ), muIndexEntryCount( 0 ), muIndexSizeInBytes( 0 ) {}
+};
+
+
 /**
 <pre>
  * DBPF package file class
@@ -117,15 +147,20 @@ public:
 
   bool read( const char * fileName, size_t & fileSize );
   bool directoryOfCompressedStuffExists() const { return mbDIRexists; }
+  const char * getFileName() const { return mstrFileName; }
 
   unsigned int getItemCount() const { return muIndexEntryCount; }
   bool contains( const unsigned int type ) const;
   unsigned int howMany( const unsigned int type ) const;
   bool getIndexEntry( const unsigned int k, DBPFindexType & entry ) const;
   bool isCompressed( const DBPFindexType indexEntry, unsigned int & decmpSize ) const;
-  bool getData( const DBPFindexType indexEntry, unsigned char * & bytes, unsigned int & byteCount );
+  // pArena - where bytes are allocated, NULL for new []
+  bool getData( const DBPFindexType indexEntry, unsigned char * & bytes, unsigned int & byteCount,
+                DBPF_arenaType * pArena = NULL );
 
-  bool write( const char * fileName, vector< DBPF_resourceType * > & resources, size_t & fileSize );
+  // bAtomic - write a temp file and rename it over fileName, see DBPF.cpp
+  bool write( const char * fileName, vector< DBPF_resourceType * > & resources, size_t & fileSize,
+              bool bAtomic = false );
 
 private:
   bool readHeader();
@@ -133,10 +168,12 @@ private:
   bool readDIR();
   bool openFile();
   void closeFile();
-  bool writeHeader( FILE * f, vector< DBPF_resourceType * > & resources );
-  bool writeResources( FILE * f, vector< DBPF_resourceType * > & resources );
-  bool writeDIR( FILE * f, vector< DBPF_resourceType * > & resources );
-  bool writeIndexTable( FILE * f, vector< DBPF_resourceType * > & resources );
+  bool layoutPackage( vector< DBPF_resourceType * > & resources, DBPF_writeStateType & state );
+  void serializeHeader( unsigned char * bytes, const DBPF_writeStateType & state ) const;
+  void serializeDIR( unsigned char * & bytes, vector< DBPF_resourceType * > & resources ) const;
+  void serializeIndexTable( unsigned char * & bytes, vector< DBPF_resourceType * > & resources,
+                            const DBPF_writeStateType & state ) const;
+  bool writeResources( FILE * f, FILE * fSource, vector< DBPF_resourceType * > & resources );
 };
 
 
@@ -149,16 +186,37 @@ bool justTheFilename( const char * str, string strOut );
 // output file name is input filename (- .package) + strAppend + .package
 void makeOutputFileName( string & strOut, const char * strIn, const char * strAppend );
 
-// reads package file, gives set of resources, specified types will be uncompressed and initialized
+// all .package files under a directory (and its subdirectories), sorted in game load order
+bool listPackageFiles( const char * dirName, vector< string > & fileNames );
+
+// size and modification time of a file, to tell if a package changed since it was indexed
+bool getPackageFileStamp( const char * fileName, unsigned long long & fileSize, long long & modTime );
+
+// whole file into bytes, false if it can't be read
+bool readIndexFile( const char * fileName, vector< unsigned char > & bytes );
+// writes bytes to fileName.tmp, then renames it over fileName, so a failed write leaves the old file
+bool writeIndexFile( const char * fileName, const vector< unsigned char > & bytes );
+
+// new, uninitialized resource of the class that decodes type, NULL if there is none,
+// made in pArena if that's not NULL (see DBPF_arena.h)
+DBPF_resourceType * newDecodedResource( const unsigned int type, DBPF_arenaType * pArena = NULL );
+
+// reads package file, gives set of resources, specified types will be uncompressed and initialized,
+// with bPassThrough, other types are not read, the writer copies them from this file,
+// with pArena, the resources and their memory are in that arena, release it instead of deleting them
 bool readPackage( const char * filename,                         // IN
                   DBPFtype & package,                            // IN/OUT
                   vector< unsigned int > & typesToInit,          // IN
-                  vector< DBPF_resourceType * > & resources );   // OUT
+                  vector< DBPF_resourceType * > & resources,     // OUT
+                  bool bPassThrough = false,                     // IN
+                  DBPF_arenaType * pArena = NULL );              // IN
 
-// writes package file (first, compresses all resources)
+// writes package file (first, compresses all resources),
+// with bAtomic, writes a temp file and renames it over filename, safe for rewriting the file that was read
 bool writeCompressedPackage( const char * filename,              // IN
                    DBPFtype & package,                           // IN
-                   vector< DBPF_resourceType * > & resources );  // IN
+                   vector< DBPF_resourceType * > & resources,    // IN
+                   bool bAtomic = false );                       // IN
 
 
 
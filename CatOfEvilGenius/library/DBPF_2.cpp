@@ -4,17 +4,18 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <unordered_set>
+#include <filesystem>
+#include <system_error>
 
 #include "DBPF.h"
 #include "DBPFcompress.h"
 #include "DBPF_types.h"
-#include "DBPF_3IDR.h"
-#include "DBPF_BINX.h"
-#include "DBPF_GZPS.h"
-#include "DBPF_XHTN.h"
-#include "DBPF_TXMT.h"
-#include "DBPF_TXTR.h"
-#include "DBPF_STR.h"
+#include "DBPF_typeRegistry.h"
+#include "DBPF_resource.h"
+#include "DBPF_arena.h"
 
 
 /**
@@ -62,18 +63,167 @@ bool justTheFilename( const char * str, string strOut )
 }
 
 
+// case-insensitive path comparison, the order the game loads packages in
+static bool lessInLoadOrder( const string & a, const string & b )
+{
+  size_t n = ( a.size() < b.size() ) ? a.size() : b.size();
+  for( size_t i = 0; i < n; ++i )
+  {
+    int ca = tolower( (unsigned char)a[i] );
+    int cb = tolower( (unsigned char)b[i] );
+    if( ca != cb )
+      return( ca < cb );
+  }
+  return( a.size() < b.size() );
+}
+
+
+/**
+<pre>
+ * input:   dirName - directory to search, such as a Downloads folder
+ * output:  fileNames - paths of all .package files in dirName and its subdirectories,
+ *                      sorted in load order (later files override earlier ones)
+ * returns: success / failure
+</pre>
+**/
+bool listPackageFiles( const char * dirName, vector< string > & fileNames )
+{
+  fileNames.clear();
+
+  if( NULL == dirName )
+  { fprintf( stderr, "ERROR: listPackageFiles, NULL directory name\n" );
+    return false;
+  }
+
+  error_code ec;
+  filesystem::recursive_directory_iterator it( dirName, filesystem::directory_options::skip_permission_denied, ec );
+  if( ec )
+  { fprintf( stderr, "ERROR: listPackageFiles, can't open directory %s\n", dirName );
+    return false;
+  }
+
+  for( ; it != filesystem::recursive_directory_iterator(); it.increment( ec ) )
+  {
+    if( ec )
+    { fprintf( stderr, "ERROR: listPackageFiles, failed while reading directory %s\n", dirName );
+      return false;
+    }
+
+    if( false == it->is_regular_file( ec ) )
+      continue;
+
+    string strExt = it->path().extension().string();
+    for( size_t i = 0; i < strExt.size(); ++i )
+      strExt[i] = (char)tolower( (unsigned char)strExt[i] );
+    if( strExt != ".package" )
+      continue;
+
+    fileNames.push_back( it->path().string() );
+  }
+
+  sort( fileNames.begin(), fileNames.end(), lessInLoadOrder );
+
+  return true;
+}
+
+
+bool getPackageFileStamp( const char * fileName, unsigned long long & fileSize, long long & modTime )
+{
+  error_code ec;
+  fileSize = (unsigned long long)filesystem::file_size( fileName, ec );
+  if( ec )
+    return false;
+
+  filesystem::file_time_type t = filesystem::last_write_time( fileName, ec );
+  if( ec )
+    return false;
+  modTime = (long long)( t.time_since_epoch().count() );
+
+  return true;
+}
+
+
+bool readIndexFile( const char * fileName, vector< unsigned char > & bytes )
+{
+  bytes.clear();
+
+  FILE * f = fopen( fileName, "rb" );
+  if( NULL == f )
+    return false;
+
+  unsigned char buf[65536];
+  size_t n = 0;
+  while( ( n = fread( buf, 1, sizeof( buf ), f ) ) > 0 )
+    bytes.insert( bytes.end(), buf, buf + n );
+  bool bOK = ( 0 == ferror( f ) );
+  fclose( f );
+
+  return bOK;
+}
+
+
+bool writeIndexFile( const char * fileName, const vector< unsigned char > & bytes )
+{
+  string tmpName( fileName );
+  tmpName.append( ".tmp" );
+
+  FILE * f = fopen( tmpName.c_str(), "wb" );
+  if( NULL == f )
+  { fprintf( stderr, "ERROR: writeIndexFile, can't open %s\n", tmpName.c_str() );
+    return false;
+  }
+  bool bOK = bytes.empty() || ( fwrite( &bytes[0], 1, bytes.size(), f ) == bytes.size() );
+  if( 0 != fclose( f ) )
+    bOK = false;
+
+  remove( fileName );
+  if( false == bOK || 0 != rename( tmpName.c_str(), fileName ) )
+  { fprintf( stderr, "ERROR: writeIndexFile, failed to write %s\n", fileName );
+    remove( tmpName.c_str() );
+    return false;
+  }
+
+  return true;
+}
+
+
+/**
+<pre>
+ * input:   type - resource type, such as DBPF_GZPS
+ *          pArena - arena to make it in, NULL for new
+ * returns: a new, uninitialized resource of the class that decodes that type,
+ *          or NULL if the library has no class for it
+ *
+ * purpose: pick the resource class, for readPackage and anything else that decodes resources
+</pre>
+**/
+DBPF_resourceType * newDecodedResource( const unsigned int type, DBPF_arenaType * pArena )
+{
+  const DBPF_typeInfoType * pInfo = dbpfFindTypeInfo( type );
+  if( NULL == pInfo || NULL == pInfo->mpNewResource )
+    return NULL;
+  return pInfo->mpNewResource( pArena );
+}
+
+
 /**
  * reads a package file,
  * gives a list of resources in that package,
  *   of type DBPF_resourceType (and appropriate subtype),
  * resources whose types are give in typesToInit
  *   will be decompressed and initialized,
- * all others will be compressed and of type DBPF_undecodedType
+ * all others will be compressed and of type DBPF_undecodedType,
+ * or, if bPassThrough is true, not read at all and of type DBPF_passThroughType
+ *   (the package file must then still be there, unchanged, when writing),
+ * with pArena, resources are made in that arena, with their bytes, CPFs, and names,
+ *   don't delete them, release the arena when done with the package (see DBPF_arena.h)
 **/
 bool readPackage( const char * filename,                         // IN
                   DBPFtype & package,                            // IN/OUT
                   vector< unsigned int > & typesToInit,          // IN
-                  vector< DBPF_resourceType * > & resources )    // OUT
+                  vector< DBPF_resourceType * > & resources,     // OUT
+                  bool bPassThrough,                             // IN
+                  DBPF_arenaType * pArena )                      // IN
 {
   // open DBPF package
   // ------------------------
@@ -105,6 +255,8 @@ bool readPackage( const char * filename,                         // IN
   bool bInitThis = false;
   DBPF_resourceType * pResource = NULL;
 
+  const unordered_set< unsigned int > initTypes( typesToInit.begin(), typesToInit.end() );
+
   for( unsigned int k = 0; k < itemCount; ++k )
   {
     // package index entry
@@ -116,24 +268,34 @@ bool readPackage( const char * filename,                         // IN
     if( DBPF_DIR == entry.muTypeID )
       continue;
 
-    // get data for a resource
-
-    if( false == package.getData( entry, bytes, byteCount ) )
-      return false;
-
     // is this resource of a type we want?
 
-    bInitThis = false;
+    bInitThis = ( initTypes.end() != initTypes.find( entry.muTypeID ) );
 
-    for( size_t tt = 0; tt < typesToInit.size(); ++tt )
+    // not a type we want, and pass-through asked for?
+    // don't read it at all, the writer copies it from this file
+
+    if( false == bInitThis && true == bPassThrough )
     {
-      if( entry.muTypeID == typesToInit[tt] )
-      {
-        bInitThis = true;
-        tt = typesToInit.size();
-      }
+      bool bCmpr = package.isCompressed( entry, decmpByteCount );
+
+      DBPF_passThroughType * pPass = ( NULL == pArena ) ? new DBPF_passThroughType()
+                                                        : pArena->make< DBPF_passThroughType >( pArena );
+      pPass->initFromSource( entry, bCmpr, bCmpr ? decmpByteCount : 0 );
+      resources.push_back( pPass );
+      continue;
     }
 
+    // get data for a resource,
+    // straight into the arena if the resource keeps these bytes,
+    // on the heap if it gets a decompressed or compressed copy instead
+
+    const bool bSourceCompressed = package.isCompressed( entry, decmpByteCount );
+    const bool bKeepBytes = ( bInitThis != bSourceCompressed );
+
+    if( false == package.getData( entry, bytes, byteCount, bKeepBytes ? pArena : NULL ) )
+      return false;
+
     // if resource is a type we want, uncompress it,
     // otherwise, leave it compressed, we won't be decoding it anyway
 
@@ -141,7 +303,7 @@ bool readPackage( const char * filename,                         // IN
 
     if( true == bInitThis )
     {
-     if( package.isCompressed( entry, decmpByteCount ) )
+     if( bSourceCompressed )
      {
       bCompressed = true;
 
@@ -150,7 +312,7 @@ bool readPackage( const char * filename,                         // IN
       bytes = NULL;
       byteCount = decmpByteCount;
 
-      if( false == dbpfDecompress( cmprBytes, cmprByteCount, bytes, byteCount ) )
+      if( false == dbpfDecompress( cmprBytes, cmprByteCount, bytes, byteCount, pArena ) )
         return false;
 
       bCompressed = false;
@@ -168,13 +330,13 @@ bool readPackage( const char * filename,                         // IN
     {
       bCompressed = true; // assume it is compressed, then check
 
-      if( false == package.isCompressed( entry, decmpByteCount ) )
+      if( false == bSourceCompressed )
       {
         cmprBytes = NULL;
         cmprByteCount = 0;
 
         // attempt compression
-        bool bCompressed = dbpfCompress( bytes, byteCount, cmprBytes, cmprByteCount );
+        bool bCompressed = dbpfCompress( bytes, byteCount, cmprBytes, cmprByteCount, pArena );
 
         // if it worked, move cmprBytes to bytes, delete old uncompressed data
         if( bCompressed )
@@ -184,6 +346,14 @@ bool readPackage( const char * filename,                         // IN
           byteCount = cmprByteCount;
           cmprByteCount = 0;
         }
+        // if not, the resource keeps the uncompressed data, so it goes in the arena
+        else if( NULL != pArena )
+        {
+          unsigned char * arenaBytes = dbpfNewBytes( pArena, byteCount );
+          memcpy( arenaBytes, bytes, byteCount );
+          delete [] bytes;
+          bytes = arenaBytes;
+        }
       }
     }
 
@@ -194,36 +364,17 @@ bool readPackage( const char * filename,                         // IN
 
     if( true == bInitThis )
     {
-      switch(entry.muTypeID) {
-        case DBPF_3IDR:
-          pResource = new DBPF_3IDRtype();
-          break;
-        case DBPF_BINX:
-          pResource = new DBPF_BINXtype();
-          break;
-        case DBPF_GZPS:
-          pResource = new DBPF_GZPStype();
-          break;
-        case DBPF_STR:
-          pResource = new DBPF_STRtype();
-          break;
-        case DBPF_TXMT:
-          pResource = new DBPF_TXMTtype();
-          break;
-        case DBPF_TXTR:
-          pResource = new DBPF_TXTRtype();
-          break;
-        case DBPF_XHTN:
-          pResource = new DBPF_XHTNtype();
-          break;
-        default:
-          fprintf( stderr, "ERROR: readPackage, need to construct resource to init, but type %x is not in switch statement.\n", entry.muTypeID );
-          return false;
+      pResource = newDecodedResource( entry.muTypeID, pArena );
+      if( NULL == pResource )
+      {
+        fprintf( stderr, "ERROR: readPackage, need to construct resource to init, but type %x has no class in the type registry.\n", entry.muTypeID );
+        return false;
       }
     }
     else
     {
-      DBPF_undecodedType * pUndec = new DBPF_undecodedType();
+      DBPF_undecodedType * pUndec = ( NULL == pArena ) ? new DBPF_undecodedType()
+                                                      : pArena->make< DBPF_undecodedType >( pArena );
       pResource = pUndec;
     }
 
@@ -255,19 +406,26 @@ bool readPackage( const char * filename,                         // IN
 /**
  * Write out package file.
  * First, compresses all resources.
+ * With bAtomic, the file is written to a temp file first and renamed over filename,
+ * so filename is never left half written.  Use this when filename is the file that was read.
 **/
 bool writeCompressedPackage( const char * filename,              // IN
                    DBPFtype & package,                           // IN
-                   vector< DBPF_resourceType * > & resources )   // IN
+                   vector< DBPF_resourceType * > & resources,    // IN
+                   bool bAtomic )                                // IN
 {
   unsigned int cmprByteCount = 0, uncByteCount = 0;
   for( size_t k = 0; k < resources.size(); ++k )
   {
+    // pass-through resources are copied as they are
+    if( resources[k]->isPassThrough() )
+      continue;
+
     resources[k]->updateRawBytes();
     if( false == resources[k]->isCompressed( cmprByteCount, uncByteCount ) )
       resources[k]->compressRawBytes();
   }
 
   size_t fileSizeOut = 0;
-  return( package.write( filename, resources, fileSizeOut ) );
+  return( package.write( filename, resources, fileSizeOut, bAtomic ) );
 }
@@ -7,11 +7,13 @@
 #include <cstdio>
 #include "DBPF_3IDR.h"
 #include "DBPF_byteStreamFunctions.h"
+#include "DBPF_byteCursor.h"
 #include "DBPF_types.h"
 
 
 
-DBPF_3IDRtype::DBPF_3IDRtype()
+DBPF_3IDRtype::DBPF_3IDRtype( DBPF_arenaType * pArena )
+: DBPF_resourceType( pArena )
 {
   this->mpRawBytes = NULL;
   clear();
@@ -64,48 +66,46 @@ bool DBPF_3IDRtype::initFromByteStream(
 
   // -------------------------------------------------------------
 
-  unsigned char * bytes = data;
+  DBPF_byteCursorType bytes( data, (size_t)byteCountToRead );
 
   // 3DIR ID, should be 0xDEADBEEF
-  readByteStream_uint( bytes, 4, this->mu3IDR_ID );
+  this->mu3IDR_ID = bytes.readUint32();
   if( 0xDEADBEEF != this->mu3IDR_ID )
   { fprintf( stderr, "ERROR: reading 3IDR, expected 0xDEADBEEF, got %x\n", this->mu3IDR_ID );
     return false;
   }
 
   // index type, should be 1 or 2
-  readByteStream_uint( bytes, 4, this->muIndexType );
+  this->muIndexType = bytes.readUint32();
   if( this->muIndexType < 1 || this->muIndexType > 2 )
   { fprintf( stderr, "ERROR: reading 3IDR, expected index type 1 or 2, got %u\n", this->muIndexType );
     return false;
   }
 
   // number of TGIR entries
-  readByteStream_uint( bytes, 4, this->muTGIRcount );
+  this->muTGIRcount = bytes.readUint32();
 
   // TGIR entries
 
   DBPF_TGIRtype TGIR;
 
-  for( unsigned int i = 0; i < this->muTGIRcount; ++i )
+  for( unsigned int i = 0; i < this->muTGIRcount && bytes.ok(); ++i )
   {
-    // type
-    readByteStream_uint( bytes, 4, TGIR.muTypeID );
-
-    // group
-    readByteStream_uint( bytes, 4, TGIR.muGroupID );
-
-    // instance
-    readByteStream_uint( bytes, 4, TGIR.muInstanceID );
-
+    TGIR.muTypeID = bytes.readUint32();
+    TGIR.muGroupID = bytes.readUint32();
+    TGIR.muInstanceID = bytes.readUint32();
     // resource
-    if( 2 == this->muIndexType )
-      readByteStream_uint( bytes, 4, TGIR.muResourceID );
-    else
-      TGIR.muResourceID = 0;
+    TGIR.muResourceID = ( 2 == this->muIndexType ) ? bytes.readUint32() : 0;
 
     // add to entries
-    this->mTGIRs.push_back( TGIR );
+    if( bytes.ok() )
+      this->mTGIRs.push_back( TGIR );
+  }
+
+  if( false == bytes.ok() )
+  { fprintf( stderr, "ERROR: reading 3IDR, %u entries, the data ends after %u\n",
+             this->muTGIRcount, (unsigned int)( this->mTGIRs.size() ) );
+    return false;
   }
 
   // -------------------------------------------------------------
@@ -244,7 +244,7 @@ bool DBPF_3IDRtype::updateRawBytes()
   // allocate new bytes
 
   unsigned int newByteCount = (unsigned int)((int)(this->muRawBytesCount) + this->miChangeInRawBytesCount);
-  unsigned char * bytes = new unsigned char[ newByteCount ];
+  unsigned char * bytes = dbpfNewBytes( this->mpArena, newByteCount );
   if( NULL == bytes )
     return false;
   unsigned char * bytesStart = bytes;
@@ -284,8 +284,7 @@ bool DBPF_3IDRtype::updateRawBytes()
   // -------------
 
   // new raw bytes
-  if( this->mpRawBytes != NULL )
-    delete [] this->mpRawBytes;
+  dbpfDeleteBytes( this->mpArena, this->mpRawBytes );
   this->mpRawBytes = bytesStart;
   bytes = NULL;
 
@@ -17,7 +17,7 @@ using namespace std;
 class DBPF_3IDRtype : public DBPF_resourceType
 {
 public:
-  DBPF_3IDRtype();
+  explicit DBPF_3IDRtype( DBPF_arenaType * pArena = NULL );
   ~DBPF_3IDRtype();
 
   void clear();
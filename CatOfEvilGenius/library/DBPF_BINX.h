@@ -7,7 +7,7 @@
 class DBPF_BINXtype : public DBPF_CPFresourceType
 {
 public:
-  DBPF_BINXtype() {}
+  explicit DBPF_BINXtype( DBPF_arenaType * pArena = NULL ) : DBPF_CPFresourceType( pArena ) {}
   ~DBPF_BINXtype() {}
 
   bool setSortIndex(int index);
@@ -7,11 +7,16 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
 #include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
 
 #include "DBPF_CPF.h" // DBPF_propertiesType
 #include "DBPF_byteStreamFunctions.h"
+#include "DBPF_arena.h"
 
 using namespace std;
 #ifdef __GNUC__
@@ -20,18 +25,366 @@ using namespace __gnu_cxx;
 using namespace stdext;
 #endif
 
-typedef pair< string, string > strPairType;
-typedef pair< string, DBPF_CPFitemType > CPFpairType;
 
+// interned names, a deque so names never move, the map's string_views point into it
+static shared_mutex & keyTableMutex()
+{ static shared_mutex m;
+  return m;
+}
+
+static deque< string > & keyTableNames()
+{ static deque< string > names;
+  return names;
+}
+
+static unordered_map< string_view, DBPF_keyIDtype > & keyTableIDs()
+{ static unordered_map< string_view, DBPF_keyIDtype > ids;
+  return ids;
+}
+
+
+DBPF_keyIDtype DBPF_keyTableType::find( const char * str, const size_t length )
+{
+  shared_lock< shared_mutex > lock( keyTableMutex() );
+
+  unordered_map< string_view, DBPF_keyIDtype >::const_iterator iter;
+  iter = keyTableIDs().find( string_view( str, length ) );
+  if( iter == keyTableIDs().end() )
+    return DBPF_NO_KEY;
+
+  return iter->second;
+}
+
+
+DBPF_keyIDtype DBPF_keyTableType::intern( const char * str, const size_t length )
+{
+  // usually the name is there already
+  DBPF_keyIDtype id = find( str, length );
+  if( DBPF_NO_KEY != id )
+    return id;
+
+  unique_lock< shared_mutex > lock( keyTableMutex() );
+
+  // another thread may have added it in the meantime
+  unordered_map< string_view, DBPF_keyIDtype >::const_iterator iter;
+  iter = keyTableIDs().find( string_view( str, length ) );
+  if( iter != keyTableIDs().end() )
+    return iter->second;
+
+  id = (DBPF_keyIDtype)( keyTableNames().size() );
+  keyTableNames().push_back( string( str, length ) );
+  keyTableIDs().insert( make_pair( string_view( keyTableNames().back() ), id ) );
+
+  return id;
+}
+
+
+const string & DBPF_keyTableType::name( const DBPF_keyIDtype id )
+{
+  shared_lock< shared_mutex > lock( keyTableMutex() );
+  return keyTableNames().at( id );
+}
+
+
+// -----------------------------------------------
+
+
+const DBPF_propertyType * DBPF_propertyStoreType::find( const DBPF_keyIDtype key ) const
+{
+  for( const DBPF_propertyType & item : this->mItems )
+    if( item.muKey == key )
+      return &item;
+
+  return NULL;
+}
+
+
+const DBPF_propertyType * DBPF_propertyStoreType::find( const string_view key ) const
+{
+  // a name that was never interned can't be in any store
+  DBPF_keyIDtype id = DBPF_keyTableType::find( key.data(), key.size() );
+  if( DBPF_NO_KEY == id )
+    return NULL;
+
+  return find( id );
+}
+
+
+DBPF_propertyType * DBPF_propertyStoreType::find( const DBPF_keyIDtype key )
+{
+  return const_cast< DBPF_propertyType * >( static_cast< const DBPF_propertyStoreType * >( this )->find( key ) );
+}
+
+
+DBPF_propertyType * DBPF_propertyStoreType::find( const string_view key )
+{
+  return const_cast< DBPF_propertyType * >( static_cast< const DBPF_propertyStoreType * >( this )->find( key ) );
+}
+
+
+DBPF_propertyType & DBPF_propertyStoreType::add( const DBPF_keyIDtype key, const unsigned int type )
+{
+  DBPF_propertyType item;
+  item.muKey = key;
+  item.miType = type;
+  item.miValue = 0;
+  item.muStrLength = 0;
+  item.mbView = false;
+  item.mbDirty = false;
+  item.muValueOffset = DBPF_NO_OFFSET;
+
+  this->mItems.push_back( item );
+  return this->mItems.back();
+}
+
+
+DBPF_propertyType & DBPF_propertyStoreType::addString( const DBPF_keyIDtype key, const char * str, const size_t length )
+{
+  DBPF_propertyType & item = this->add( key, CPF_STRING );
+  item.muStrOffset = (unsigned int)( this->mStrings.size() );
+  item.muStrLength = (unsigned int)length;
+  this->mStrings.append( str, length );
+  return item;
+}
+
+
+DBPF_propertyType & DBPF_propertyStoreType::addStringView( const DBPF_keyIDtype key, const unsigned char * str, const size_t length )
+{
+  DBPF_propertyType & item = this->add( key, CPF_STRING );
+  item.muStrOffset = (unsigned int)( str - this->mpView );
+  item.muStrLength = (unsigned int)length;
+  item.mbView = true;
+  return item;
+}
+
+
+void DBPF_propertyStoreType::ownStrings()
+{
+  for( DBPF_propertyType & item : this->mItems )
+    if( item.mbView )
+    { const char * str = (const char *)( this->mpView ) + item.muStrOffset;
+      item.muStrOffset = (unsigned int)( this->mStrings.size() );
+      item.mbView = false;
+      this->mStrings.append( str, item.muStrLength );
+    }
+
+  this->mpView = NULL;
+}
+
+
+void DBPF_propertyStoreType::setString( DBPF_propertyType & item, const char * str, const size_t length )
+{
+  // viewed bytes are read-only, and old space is lost if the new value doesn't fit,
+  // the arena is reset by clear()
+  if( item.mbView || length > item.muStrLength )
+  { item.muStrOffset = (unsigned int)( this->mStrings.size() );
+    item.mbView = false;
+    this->mStrings.append( str, length );
+  }
+  else
+    this->mStrings.replace( item.muStrOffset, length, str, length );
+
+  item.muStrLength = (unsigned int)length;
+  item.mbDirty = true;
+}
+
+
+void DBPF_propertyStoreType::getItem( const DBPF_propertyType & item, DBPF_CPFitemType & val ) const
+{
+  val.miType = item.miType;
+  val.mbValue = false;
+  val.miValue = 0;
+  val.mfValue = 0;
+  val.mstrValue.clear();
+
+  if( CPF_STRING == item.miType )
+  { string_view str = this->stringAt( item );
+    val.mstrValue.assign( str.data(), str.size() );
+  }
+  else if( CPF_INT == item.miType || CPF_INT2 == item.miType )
+    val.miValue = item.miValue;
+  else if( CPF_FLOAT == item.miType )
+    val.mfValue = item.mfValue;
+  else if( CPF_BOOL == item.miType )
+    val.mbValue = item.mbValue;
+}
 
 
-DBPF_propertiesType::DBPF_propertiesType()
+void DBPF_propertyStoreType::setItem( DBPF_propertyType & item, const DBPF_CPFitemType & val )
+{
+  item.miType = val.miType;
+  item.mbDirty = true;
+
+  if( CPF_STRING == val.miType )
+    this->setString( item, val.mstrValue.c_str(), strlen( val.mstrValue.c_str() ) );
+  else if( CPF_INT == val.miType || CPF_INT2 == val.miType )
+    item.miValue = val.miValue;
+  else if( CPF_FLOAT == val.miType )
+    item.mfValue = val.mfValue;
+  else if( CPF_BOOL == val.miType )
+    item.mbValue = val.mbValue;
+}
+
+
+// size of a value as it is in the raw bytes, strings are lengthSize bytes of length + characters
+static unsigned int encodedSize( const unsigned int type, const unsigned int strLength, const unsigned int lengthSize )
+{
+  if( CPF_STRING == type )  return lengthSize + strLength;
+  if( CPF_BOOL == type )    return 1;
+  return 4;
+}
+
+
+/**
+<pre>
+ * in/out:  bytes, byteCount - the uncompressed raw bytes the value offsets refer to,
+ *                             bytes may be replaced by a new array (new[]), the old one is deleted
+ * input:   lengthSize - size of string lengths, 4 for CPF, 1 for TXMT
+ * returns: true - changed values are in the bytes, offsets are updated
+ *          false - can't splice (a property isn't in the bytes, a string is too long),
+ *                  nothing was changed, write the whole thing instead
+ *
+ * purpose: write only the values that changed,
+ *          a value of the same size is written over the old one,
+ *          a shorter one is written in place and the rest of the bytes moved down (one memmove),
+ *          if any value gets longer, the bytes are copied once into a new array, with the new values
+</pre>
+**/
+bool DBPF_propertyStoreType::spliceChanges( unsigned char * & bytes, unsigned int & byteCount, const unsigned int lengthSize,
+                                            DBPF_arenaType * pArena )
+{
+  if( NULL == bytes )
+    return false;
+
+  // can we splice? how big is the result?
+  // items are in file order, so their offsets increase
+
+  bool bGrow = false;
+  bool bAny = false;
+  long long newCount = byteCount;
+  unsigned int end = 0;
+  for( const DBPF_propertyType & item : this->mItems )
+  {
+    if( DBPF_NO_OFFSET == item.muValueOffset || item.muValueOffset < end || item.muValueOffset > byteCount )
+      return false;
+    if( false == item.mbDirty )
+      continue;
+
+    if( CPF_STRING == item.miType && lengthSize < 4 && item.muStrLength >= ( 1u << ( 8 * lengthSize ) ) )
+      return false;
+
+    unsigned int oldLength = 0;
+    if( CPF_STRING == item.miType )
+    { if( byteCount - item.muValueOffset < lengthSize )
+        return false;
+      bytes2uint( bytes + item.muValueOffset, lengthSize, oldLength );
+    }
+    unsigned int oldSize = encodedSize( item.miType, oldLength, lengthSize );
+    unsigned int newSize = encodedSize( item.miType, item.muStrLength, lengthSize );
+    if( byteCount - item.muValueOffset < oldSize )
+      return false;
+
+    end = item.muValueOffset + oldSize;
+    bAny = true;
+    bGrow = bGrow || ( newSize > oldSize );
+    newCount += (long long)newSize - (long long)oldSize;
+  }
+
+  if( false == bAny )
+    return true;
+
+  // write in place, or copy to a new array
+
+  unsigned char * oldBytes = bytes;
+  unsigned char * newBytes = bytes;
+  if( bGrow )
+  { newBytes = dbpfNewBytes( pArena, (size_t)newCount );
+    if( NULL == newBytes )
+      return false;
+  }
+
+  int shift = 0;              // how far values after the last change have moved
+  unsigned int copied = 0;    // new array: old bytes up to here are copied
+  unsigned int count = byteCount;
+  for( DBPF_propertyType & item : this->mItems )
+  {
+    if( false == item.mbDirty )
+    { item.muValueOffset += shift;
+      if( item.mbView && oldBytes == this->mpView )
+        item.muStrOffset += shift;
+      continue;
+    }
+
+    unsigned int oldOffset = item.muValueOffset;
+    unsigned int newOffset = oldOffset + shift;
+
+    // in place, the old value has already moved with the earlier changes
+    unsigned int oldLength = 0;
+    if( CPF_STRING == item.miType )
+      bytes2uint( bGrow ? oldBytes + oldOffset : newBytes + newOffset, lengthSize, oldLength );
+    unsigned int oldSize = encodedSize( item.miType, oldLength, lengthSize );
+    unsigned int newSize = encodedSize( item.miType, item.muStrLength, lengthSize );
+
+    if( bGrow )
+    { // bytes between the last change and this one
+      memcpy( newBytes + copied + shift, oldBytes + copied, oldOffset - copied );
+      copied = oldOffset + oldSize;
+    }
+    else if( newSize != oldSize )
+    { // move the rest down, it's already shifted by earlier changes
+      memmove( newBytes + newOffset + newSize, newBytes + newOffset + oldSize, count - ( newOffset + oldSize ) );
+      count -= oldSize - newSize;
+    }
+
+    // the value
+    unsigned char * ptrWrite = newBytes + newOffset;
+    if( CPF_STRING == item.miType )
+    { unsigned char length[4];
+      uint2bytes( item.muStrLength, length );
+      memcpy( ptrWrite, length, lengthSize );
+      string_view str = this->stringAt( item );
+      memcpy( ptrWrite + lengthSize, str.data(), str.size() );
+    }
+    else if( CPF_BOOL == item.miType )
+      ptrWrite[0] = item.mbValue ? 1 : 0;
+    else if( CPF_FLOAT == item.miType )
+      writeByteStream_floatBigEndian( ptrWrite, item.mfValue );
+    else
+      writeByteStream_uint( ptrWrite, item.miValue );
+
+    item.muValueOffset = newOffset;
+    item.mbDirty = false;
+    shift += (int)newSize - (int)oldSize;
+  }
+
+  if( bGrow )
+  { memcpy( newBytes + copied + shift, oldBytes + copied, byteCount - copied );
+
+    // viewed strings are in the new array now
+    if( oldBytes == this->mpView )
+      this->mpView = newBytes;
+    dbpfDeleteBytes( pArena, oldBytes );
+    bytes = newBytes;
+  }
+
+  byteCount = (unsigned int)newCount;
+  return true;
+}
+
+
+// -----------------------------------------------
+
+
+
+DBPF_propertiesType::DBPF_propertiesType( pmr::memory_resource * pMemory )
+: mProperties( pMemory )
 {
   clear();
 }
 
 
-DBPF_CPFtype::DBPF_CPFtype()
+DBPF_CPFtype::DBPF_CPFtype( pmr::memory_resource * pMemory )
+: mProperties( pMemory )
 {
   clear();
 }
@@ -51,11 +404,7 @@ DBPF_CPFtype::~DBPF_CPFtype()
 
 void DBPF_propertiesType::clear()
 {
-  muPropertyCount = 0;
-  if( this->mPropertyKeys.empty() == false )
-    this->mPropertyKeys.clear();
-  if( this->mProperties.empty() == false )
-    this->mProperties.clear();
+  this->mProperties.clear();
 }
 
 
@@ -64,25 +413,19 @@ void DBPF_CPFtype::clear()
   muTypeID = 0;
   muVersion = 0;
 
-  muPropertyCount = 0;
-  if( this->mPropertyKeys.empty() == false )
-    this->mPropertyKeys.clear();
-  if( this->mProperties.empty() == false )
-    this->mProperties.clear();
+  this->mProperties.clear();
 }
 
 
 #ifdef _DEBUG
 void DBPF_propertiesType::dump( FILE * f ) const
 {
-  char str[256];
-  char str2[256];
-  fprintf( f, "property count: %u\n", this->muPropertyCount );
-  for( unsigned int i = 0; i < this->muPropertyCount; ++i )
+  fprintf( f, "property count: %u\n", this->mProperties.size() );
+  for( unsigned int i = 0; i < this->mProperties.size(); ++i )
   {
-    strcpy( str, (this->mPropertyKeys)[i].c_str() );
-    strcpy( str2, (((this->mProperties).find( str ))->second).c_str() );
-    fprintf( f, "  %s: %s\n", str, str2 );
+    const DBPF_propertyType & item = this->mProperties.at(i);
+    string_view val = this->mProperties.stringAt( item );
+    fprintf( f, "  %s: %.*s\n", DBPF_keyTableType::name( item.muKey ).c_str(), (int)val.size(), val.data() );
   }
 }
 #endif
@@ -91,7 +434,6 @@ void DBPF_propertiesType::dump( FILE * f ) const
 #ifdef _DEBUG
 void DBPF_CPFtype::dump( FILE * f ) const
 {
-  char key[256];
   char str2[256];
   char strType[20];
   DBPF_CPFitemType item;
@@ -99,14 +441,14 @@ void DBPF_CPFtype::dump( FILE * f ) const
   fprintf( f, "CPF typeID: %x\n", this->muTypeID );
   fprintf( f, "CPF version: %i\n", this->muVersion );
 
-  fprintf( f, "CPF property count: %u\n", this->muPropertyCount );
-  for( unsigned int i = 0; i < this->muPropertyCount; ++i )
+  fprintf( f, "CPF property count: %u\n", this->mProperties.size() );
+  for( unsigned int i = 0; i < this->mProperties.size(); ++i )
   {
     // key
-    strcpy( key, this->mPropertyKeys.at(i).c_str() );
+    const char * key = DBPF_keyTableType::name( this->mProperties.at(i).muKey ).c_str();
 
     // value
-    item = (this->mProperties.find( key ))->second;
+    this->mProperties.getItem( this->mProperties.at(i), item );
 
     // convert to strings
     item.typeToString( strType );
@@ -114,6 +456,9 @@ void DBPF_CPFtype::dump( FILE * f ) const
      || 0 == strcmp( "category", key ) )
     { sprintf( str2, "0x%x", item.miValue );
     }
+    else if( CPF_STRING == item.miType )
+    { snprintf( str2, sizeof( str2 ), "%s", item.mstrValue.c_str() );
+    }
     else
     { item.valueToString( str2 );
     }
@@ -126,16 +471,14 @@ void DBPF_CPFtype::dump( FILE * f ) const
 
 
 // add key/value pair, key must be unique
-bool DBPF_propertiesType::addPair(string propName, string propValue )
+bool DBPF_propertiesType::addPair(string propName, string propValue, const unsigned int valueOffset )
 {
-  // if key is not in hash, add key/value pair
-  unordered_map< string, string >::const_iterator iter;
-  iter = this->mProperties.find( propName );
-  if( iter == this->mProperties.end() )
+  // if key is not in the store, add key/value pair
+  DBPF_keyIDtype key = DBPF_keyTableType::intern( propName );
+  if( NULL == this->mProperties.find( key ) )
   {
-    this->mPropertyKeys.push_back( propName );
-    this->mProperties.insert( strPairType( propName, propValue ) );
-    ++muPropertyCount;
+    DBPF_propertyType & item = this->mProperties.addString( key, propValue.c_str(), strlen( propValue.c_str() ) );
+    item.muValueOffset = valueOffset;
     return true;
   }
 
@@ -146,14 +489,12 @@ bool DBPF_propertiesType::addPair(string propName, string propValue )
 // add key/value pair, key must be unique
 bool DBPF_CPFtype::addPair( const string propName, DBPF_CPFitemType & propValue )
 {
-  // if key is not in hash, add key/value pair
-  unordered_map< string, DBPF_CPFitemType >::const_iterator iter;
-  iter = this->mProperties.find( propName );
-  if( iter == this->mProperties.end() )
+  // if key is not in the store, add key/value pair
+  DBPF_keyIDtype key = DBPF_keyTableType::intern( propName );
+  if( NULL == this->mProperties.find( key ) )
   {
-    this->mPropertyKeys.push_back( propName );
-    this->mProperties.insert( CPFpairType( propName, propValue ) );
-    ++muPropertyCount;
+    DBPF_propertyType & item = this->mProperties.add( key, propValue.miType );
+    this->mProperties.setItem( item, propValue );
     return true;
   }
 
@@ -164,10 +505,10 @@ bool DBPF_CPFtype::addPair( const string propName, DBPF_CPFitemType & propValue
 // get i'th key
 bool DBPF_propertiesType::getKeyAt( const unsigned int i, string & key ) const
 {
-  if( i >= this->muPropertyCount )
+  if( i >= this->mProperties.size() )
     return false;
 
-  key = this->mPropertyKeys[i];
+  key = DBPF_keyTableType::name( this->mProperties.at(i).muKey );
   return true;
 }
 
@@ -175,31 +516,48 @@ bool DBPF_propertiesType::getKeyAt( const unsigned int i, string & key ) const
 // get i'th key
 bool DBPF_CPFtype::getKeyAt( const unsigned int i, string & key ) const
 {
-  if( i >= this->muPropertyCount )
+  if( i >= this->mProperties.size() )
     return false;
 
-  key = this->mPropertyKeys[i];
+  key = DBPF_keyTableType::name( this->mProperties.at(i).muKey );
   return true;
 }
 
 
 bool DBPF_propertiesType::getPairAt( const unsigned int i, string & key, string & val ) const
 {
-  if( i >= this->muPropertyCount )
+  if( i >= this->mProperties.size() )
     return false;
 
-  key = this->mPropertyKeys[i];
-  return( getPropertyValue( key, val ) );
+  const DBPF_propertyType & item = this->mProperties.at(i);
+  key = DBPF_keyTableType::name( item.muKey );
+  val = this->mProperties.stringAt( item );
+  return true;
 }
 
 
 bool DBPF_CPFtype::getPairAt( const unsigned int i, string & key, DBPF_CPFitemType & val ) const
 {
-  if( i >= this->muPropertyCount )
+  if( i >= this->mProperties.size() )
+    return false;
+
+  const DBPF_propertyType & item = this->mProperties.at(i);
+  key = DBPF_keyTableType::name( item.muKey );
+  this->mProperties.getItem( item, val );
+  return true;
+}
+
+
+// as getPropertyValue, but the value isn't copied
+bool DBPF_propertiesType::getPropertyView( const string_view propName, string_view & propValue ) const
+{
+  const DBPF_propertyType * item = this->mProperties.find( propName );
+  if( NULL == item )
     return false;
 
-  key = this->mPropertyKeys[i];
-  return( getPropertyValue( key, val ) );
+  propValue = this->mProperties.stringAt( *item );
+
+  return true;
 }
 
 
@@ -209,12 +567,11 @@ bool DBPF_CPFtype::getPairAt( const unsigned int i, string & key, DBPF_CPFitemTy
 **/
 bool DBPF_propertiesType::getPropertyValue( const string propName, string & propValue ) const
 {
-  unordered_map< string, string >::const_iterator iter;
-  iter = this->mProperties.find( propName );
-  if( iter == this->mProperties.end() )
+  const DBPF_propertyType * item = this->mProperties.find( propName );
+  if( NULL == item )
     return false;
 
-  propValue.assign( iter->second.c_str() );
+  propValue = this->mProperties.stringAt( *item );
 
   return true;
 }
@@ -226,13 +583,11 @@ bool DBPF_propertiesType::getPropertyValue( const string propName, string & prop
 **/
 bool DBPF_CPFtype::getPropertyValue( const string propName, DBPF_CPFitemType & propValue ) const
 {
-  unordered_map< string, DBPF_CPFitemType >::const_iterator iter;
-  iter = this->mProperties.find( propName );
-  if( iter == this->mProperties.end() )
+  const DBPF_propertyType * item = this->mProperties.find( propName );
+  if( NULL == item )
     return false;
 
-  propValue = iter->second;
-  propValue.mstrValue.assign( iter->second.mstrValue.c_str() );
+  this->mProperties.getItem( *item, propValue );
 
   return true;
 }
@@ -258,26 +613,31 @@ bool DBPF_propertiesType::setPropertyValue( const string propName, const string
 
   // does this property exist?
 
-  string strOldValue;
-  if( false == this->getPropertyValue( propName, strOldValue ) )
+  DBPF_propertyType * item = this->mProperties.find( propName );
+  if( NULL == item )
     return false;
 
   // is the new value the same as the old value?
 
-  if( 0 == strcmp( strOldValue.c_str(), propValue.c_str() ) )
+  size_t newLength = strlen( propValue.c_str() );
+  string_view oldValue = this->mProperties.stringAt( *item );
+  if( oldValue == string_view( propValue.c_str(), newLength ) )
     return true;
 
   // new value is different,
   //   set property, set changed flag
   //   compute change in raw bytes size
 
-  (this->mProperties)[ propName ] = propValue;
+  iChangeInRawBytesCount = (int)newLength - (int)oldValue.size();
+#ifdef _DEBUG
+  printf( "old value: %.*s\n", (int)oldValue.size(), oldValue.data() );
+#endif
+
+  this->mProperties.setString( *item, propValue.c_str(), newLength );
   bChanged = true;
-  iChangeInRawBytesCount = (unsigned int)(strlen( propValue.c_str() ) - strlen( strOldValue.c_str() ));
 
 #ifdef _DEBUG
-  printf( "old value: %s\n", strOldValue.c_str() );
-  printf( "new value: %s\n", (this->mProperties)[ propName ].c_str() );
+  printf( "new value: %s\n", propValue.c_str() );
   printf( "size change: %i\n", iChangeInRawBytesCount );
 #endif
 
@@ -376,10 +736,13 @@ bool DBPF_CPFtype::setPropertyValue( const string propName, DBPF_CPFitemType & p
 
   // does this property exist?
 
-  DBPF_CPFitemType oldValue;
-  if( false == this->getPropertyValue( propName, oldValue ) )
+  DBPF_propertyType * item = this->mProperties.find( propName );
+  if( NULL == item )
     return false;
 
+  DBPF_CPFitemType oldValue;
+  this->mProperties.getItem( *item, oldValue );
+
   // is new value of the correct type?
 
   if( oldValue.miType != propValue.miType )
@@ -402,10 +765,10 @@ bool DBPF_CPFtype::setPropertyValue( const string propName, DBPF_CPFitemType & p
   //   set property, set changed flag
   //   compute change in raw bytes size
 
-  (this->mProperties)[ propName ] = propValue;
+  this->mProperties.setItem( *item, propValue );
   bChanged = true;
   if( CPF_STRING == propValue.miType )
-    iChangeInRawBytesCount = (unsigned int)(strlen( propValue.mstrValue.c_str() ) - strlen( oldValue.mstrValue.c_str() ));
+    iChangeInRawBytesCount = (int)strlen( propValue.mstrValue.c_str() ) - (int)strlen( oldValue.mstrValue.c_str() );
 
 #ifdef _DEBUG
   printf( "CPF property: %s\n", propName.c_str() );
@@ -413,8 +776,8 @@ bool DBPF_CPFtype::setPropertyValue( const string propName, DBPF_CPFitemType & p
   oldValue.typeToString( foot );
   oldValue.valueToString( foo );
   printf( "old value: (%s) %s\n", foot, foo );
-  (this->mProperties)[ propName ].typeToString( foot );
-  (this->mProperties)[ propName ].valueToString( foo );
+  propValue.typeToString( foot );
+  propValue.valueToString( foo );
   printf( "new value: (%s) %s\n", foot, foo );
   printf( "size change: %i\n", iChangeInRawBytesCount );
 #endif
@@ -424,15 +787,15 @@ bool DBPF_CPFtype::setPropertyValue( const string propName, DBPF_CPFitemType & p
 
 
 /**
- * input:   data - byte stream to read from
- * output:  restOfData - points to first byte after CPF data
- * returns: success/failure
+ * in/out:  bytes - CPF data starts at its position, afterwards it's at the first byte after the CPF
+ * input:   bView - string values are not copied, they are viewed in the bytes,
+ *                  the bytes must stay valid until ownStrings or clear
+ * returns: success/failure, failure if the CPF runs past the end of bytes
 **/
-bool DBPF_CPFtype::initFromByteStream( unsigned char * data,
-                                       unsigned char * & restOfData )
+bool DBPF_CPFtype::initFromByteStream( DBPF_byteCursorType & bytes, const bool bView )
 {
   // sanity check
-  if( NULL == data )
+  if( false == bytes.ok() )
   { fprintf( stderr, "ERROR: DBPF_CPFtype.initFromByteStream, null data\n" );
     return false;
   }
@@ -440,10 +803,12 @@ bool DBPF_CPFtype::initFromByteStream( unsigned char * data,
   // reset / clear all values
   this->clear();
 
+  // value offsets and views are from here
+  const unsigned char * start = bytes.pos();
+
   // read CPF data
   // =============
-  unsigned int u = 0;
-  readByteStream_uint( data, 4, u );
+  unsigned int u = bytes.readUint32();
   this->muTypeID = u;
 
   /*
@@ -471,97 +836,121 @@ bool DBPF_CPFtype::initFromByteStream( unsigned char * data,
   }
 
   // CPF version
-  unsigned short s = 0;
-  readByteStream_ushort( data, s );
-  this->muVersion = s;
-//  printf( "CPF version: %i\n", s ); // DEBUG
+  this->muVersion = bytes.readUint16();
+//  printf( "CPF version: %i\n", this->muVersion ); // DEBUG
 
   // number of items
-  unsigned int itemCount = 0;
-  readByteStream_uint( data, 4, itemCount );
+  unsigned int itemCount = bytes.readUint32();
 //  printf( "number of items: %i\n", itemCount ); // DEBUG
 
   // read items
-  char str[256];
-  unsigned int strLength = 0;
-  string key;
-  DBPF_CPFitemType value;
+  // - keys are interned straight from the byte stream, values go in the store,
+  //   so nothing is allocated once the store and key table have warmed up
+  // - in view mode, string values are left in the bytes
+  if( bView )
+    this->mProperties.setView( start );
+  unsigned int type = 0;
+  string_view str;
+  DBPF_keyIDtype key = DBPF_NO_KEY;
+  DBPF_propertyType * item = NULL;
   unsigned int ind = 0;
 
-  for( ind = 0; ind < itemCount; ++ind )
+  for( ind = 0; ind < itemCount && bytes.ok(); ++ind )
   {
     // value data type
-    readByteStream_uint( data, 4, u );
-    value.miType = u;
-//    printf( "------------\ntype: %x\n", u ); // DEBUG
+    type = bytes.readUint32();
 
     // key: property name
-    readByteStream_str2( data, strLength, str );
-    key.assign( str );
-//    printf( "key str length: %i\n", strLength ); // DEBUG
-//    printf( "key: %s\n", str );                  // DEBUG
+    str = bytes.readStr32();
+    if( false == bytes.ok() )
+      break;
+    key = DBPF_keyTableType::intern( str.data(), str.size() );
 
-    // value data
-    // ----------
-
-    // boolean value
-    if( CPF_BOOL == value.miType )
-    {
-      readByteStream_uint( data, 1, u );
-      if( 0 == u )  value.mbValue = false;
-      else          value.mbValue = true;
-//      printf( "(bool) " ); if( 0 == u ) printf( "false\n" ); else printf( "true\n" ); // DEBUG
+    // unknown type
+    if( CPF_BOOL != type && CPF_INT != type && CPF_INT2 != type
+     && CPF_FLOAT != type && CPF_STRING != type )
+    { fprintf( stderr, "ERROR: DBPF_CPFtype.initFromByteStream, unknown CPF item data type %x\n", type );
+      return false;
     }
 
-    // int value
-    else if( CPF_INT == value.miType || CPF_INT2 == value.miType )
-    {
-      readByteStream_uint( data, 4, u );
-      value.miValue = u;
-//      if( CPF_INT == value.miType ) printf( "(uint) " ); else printf( "(int) " );  // DEBUG
-//      printf( "0x%x, %i\n", u, u );                                                // DEBUG
-    }
+    // keys must be unique, later duplicates are dropped
+    item = this->mProperties.find( key );
+    bool bDuplicate = ( NULL != item );
+    unsigned int valueOffset = (unsigned int)( bytes.pos() - start );
 
-    // float value
-    else if( CPF_FLOAT == value.miType )
-    {
-      float foo = 0;
-      readByteStream_floatBigEndian( data, foo );
-      value.mfValue = foo;
-//      printf( "(float) %g\n", foo );                  // DEBUG
-    }
+    // value data
+    // ----------
 
     // string value
-    else if( CPF_STRING == value.miType )
+    if( CPF_STRING == type )
     {
-      readByteStream_str2( data, strLength, str );
-      value.mstrValue.assign( str );
-//      printf( "(str) %s\n", str );                    // DEBUG
+      str = bytes.readStr32();
+      if( bDuplicate || false == bytes.ok() )
+        continue;
+      if( bView )
+        this->mProperties.addStringView( key, (const unsigned char *)str.data(), str.size() ).muValueOffset = valueOffset;
+      else
+        this->mProperties.addString( key, str.data(), str.size() ).muValueOffset = valueOffset;
+      continue;
     }
 
-    // unknown type
+    // read the value before adding the item, so a cut off CPF doesn't get one
+    float f = 0;
+    if( CPF_BOOL == type )
+      u = bytes.readUint8();
+    else if( CPF_FLOAT == type )
+      f = bytes.readFloat();
     else
-    { fprintf( stderr, "ERROR: DBPF_CPFtype.initFromByteStream, unknown CPF item data type %x\n", value.miType );
-      restOfData = data;
-      return false;
-    }
+      u = bytes.readUint32();
+    if( bDuplicate || false == bytes.ok() )
+      continue;
+
+    item = &( this->mProperties.add( key, type ) );
+    item->muValueOffset = valueOffset;
 
-    // add key to hash table
-    // ---------------------
+    // boolean value
+    if( CPF_BOOL == type )
+      item->mbValue = ( 0 != u );
+
+    // int value
+    else if( CPF_INT == type || CPF_INT2 == type )
+      item->miValue = u;
 
-    this->addPair( key, value );
+    // float value
+    else if( CPF_FLOAT == type )
+      item->mfValue = f;
   }
-  if( ind != itemCount )
-    fprintf( stderr, "ERROR: DBPF_CPFtype.initFromByteStream, read in CPF items, there were non-unique keys\n" );
 
+  if( false == bytes.ok() )
+  { fprintf( stderr, "ERROR: DBPF_CPFtype.initFromByteStream, CPF runs past the end of the data, %u of %u items read\n",
+             this->mProperties.size(), itemCount );
+    return false;
+  }
 
-  // point to first byte after CPF
-  restOfData = data;
+  if( this->mProperties.size() != itemCount )
+    fprintf( stderr, "ERROR: DBPF_CPFtype.initFromByteStream, read in CPF items, there were non-unique keys\n" );
 
   return true;
 }
 
 
+unsigned int DBPF_CPFtype::getByteStreamSize() const
+{
+  // type ID, version, item count
+  unsigned int size = 4 + 2 + 4;
+
+  // item data type, key length, key, value
+  for( unsigned int i = 0; i < this->mProperties.size(); ++i )
+  {
+    const DBPF_propertyType & item = this->mProperties.at(i);
+    size += 4 + 4 + (unsigned int)( DBPF_keyTableType::name( item.muKey ).size() )
+          + encodedSize( item.miType, item.muStrLength, 4 );
+  }
+
+  return size;
+}
+
+
 bool DBPF_CPFtype::writeToByteStream( unsigned char * & bytes )
 {
   // sanity check
@@ -570,6 +959,9 @@ bool DBPF_CPFtype::writeToByteStream( unsigned char * & bytes )
     return false;
   }
 
+  // value offsets are from here, for spliceChanges next time
+  unsigned char * start = bytes;
+
   // write stuff
   // --------------------
 
@@ -584,39 +976,148 @@ bool DBPF_CPFtype::writeToByteStream( unsigned char * & bytes )
 
   // item count
 
-  writeByteStream_uint( bytes, this->muPropertyCount );
+  writeByteStream_uint( bytes, this->mProperties.size() );
 
   // write all items
 
-  string key;
-  DBPF_CPFitemType item;
-  unsigned char b = 0;
-  for( unsigned int i = 0; i < this->muPropertyCount; ++i )
+  for( unsigned int i = 0; i < this->mProperties.size(); ++i )
   {
-    // get i'th item
-    this->getPairAt( i, key, item );
+    const DBPF_propertyType & item = this->mProperties.at(i);
 
     // item data type
     writeByteStream_uint( bytes, item.miType );
 
     // key name
-    writeByteStream_str2( bytes, key.c_str() );
+    const string & key = DBPF_keyTableType::name( item.muKey );
+    writeByteStream_uint( bytes, (unsigned int)( key.size() ) );
+    memcpy( bytes, key.data(), key.size() );
+    bytes += key.size();
 
     // item value
+    this->mProperties.setValueOffset( i, (unsigned int)( bytes - start ) );
     if( CPF_INT == item.miType || CPF_INT2 == item.miType )
       writeByteStream_uint( bytes, item.miValue );
     else if( CPF_FLOAT == item.miType )
       writeByteStream_floatBigEndian( bytes, item.mfValue );
     else if( CPF_STRING == item.miType )
-      writeByteStream_str2( bytes, item.mstrValue.c_str() );
+    {
+      string_view str = this->mProperties.stringAt( item );
+      writeByteStream_uint( bytes, (unsigned int)( str.size() ) );
+      memcpy( bytes, str.data(), str.size() );
+      bytes += str.size();
+    }
     else if( CPF_BOOL == item.miType )
     {
-      if( true == item.mbValue )      b = 1;
-      else                            b = 0;
-      bytes[0] = b; // write one byte
-      ++bytes;      // advance one byte
+      bytes[0] = item.mbValue ? 1 : 0; // write one byte
+      ++bytes;                         // advance one byte
     }
   }
 
   return true;
 }
+
+
+bool DBPF_CPFextract( const unsigned char * data, const unsigned int byteCount,
+                      DBPF_CPFfieldType * fields, const unsigned int fieldCount )
+{
+  // sanity check
+  if( NULL == data || ( NULL == fields && fieldCount > 0 ) )
+  { fprintf( stderr, "ERROR: DBPF_CPFextract, null data or fields\n" );
+    return false;
+  }
+
+  for( unsigned int k = 0; k < fieldCount; ++k )
+    fields[k].mbFound = false;
+
+  DBPF_byteCursorType bytes( data, (size_t)byteCount );
+
+  // header: type ID, version, item count
+
+  if( 0x6D783F3C == bytes.readUint32() ) // XML CPF, see DBPF_CPFtype::initFromByteStream
+    return false;
+  bytes.skip( 2 );
+  unsigned int itemCount = bytes.readUint32();
+
+  // items, stop once everything is found
+
+  unsigned int foundCount = 0;
+  for( unsigned int ind = 0; ind < itemCount && foundCount < fieldCount && bytes.ok(); ++ind )
+  {
+    unsigned int type = bytes.readUint32();
+    string_view key = bytes.readStr32();
+
+    // value size
+    unsigned int valueSize = 0;
+    if( CPF_BOOL == type )
+      valueSize = 1;
+    else if( CPF_INT == type || CPF_INT2 == type || CPF_FLOAT == type || CPF_STRING == type )
+      valueSize = 4;
+    else if( bytes.ok() )
+    { fprintf( stderr, "ERROR: DBPF_CPFextract, unknown CPF item data type %x\n", type );
+      return false;
+    }
+
+    unsigned int pos = (unsigned int)( bytes.offset() );
+    string_view str;
+    if( CPF_STRING == type )
+    { str = bytes.readStr32();
+      valueSize += (unsigned int)( str.size() );
+    }
+    else
+      bytes.skip( valueSize );
+    if( false == bytes.ok() )
+      return false;
+
+    // is this one of the wanted fields? first one wins, as in DBPF_CPFtype
+    for( unsigned int k = 0; k < fieldCount; ++k )
+    {
+      DBPF_CPFfieldType & field = fields[k];
+      if( field.mbFound || field.mstrKey != key )
+        continue;
+
+      field.mbFound = true;
+      field.miType = type;
+      field.muOffset = pos;
+      field.muSize = valueSize;
+      field.mstrValue = str;
+      field.miValue = 0;
+
+      if( CPF_BOOL == type )
+        field.mbValue = ( 0 != data[pos] );
+      else if( CPF_FLOAT == type )
+        bytes2floatBigEndian( data + pos, field.mfValue );
+      else if( CPF_INT == type || CPF_INT2 == type )
+        field.miValue = DBPF_byteLoadType< 4, false >::load( data + pos );
+
+      ++foundCount;
+    }
+  }
+
+  return bytes.ok();
+}
+
+
+bool DBPF_CPFpatch( unsigned char * data, const unsigned int byteCount, const DBPF_CPFfieldType & field )
+{
+  // sanity check
+  if( NULL == data || false == field.mbFound
+   || field.muOffset > byteCount || byteCount - field.muOffset < field.muSize )
+  { fprintf( stderr, "ERROR: DBPF_CPFpatch, field was not found, or is not in these bytes\n" );
+    return false;
+  }
+
+  unsigned char * bytes = data + field.muOffset;
+
+  if( CPF_BOOL == field.miType )
+    bytes[0] = field.mbValue ? 1 : 0;
+  else if( CPF_INT == field.miType || CPF_INT2 == field.miType )
+    writeByteStream_uint( bytes, field.miValue );
+  else if( CPF_FLOAT == field.miType )
+    writeByteStream_floatBigEndian( bytes, field.mfValue );
+  else
+  { fprintf( stderr, "ERROR: DBPF_CPFpatch, only bool, int, and float values can be patched in place\n" );
+    return false;
+  }
+
+  return true;
+}
@@ -12,8 +12,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
+#include <memory_resource>
+#include "DBPF_byteCursor.h"
 
 using namespace std;
 #ifdef __GNUC__
@@ -23,6 +25,9 @@ using namespace stdext;
 #endif
 
 
+class DBPF_arenaType;
+
+
 #define CPF_BOOL   0xCBA908E1
 #define CPF_INT    0xEB61E4F7 // uint
 #define CPF_INT2   0x0C264712 // int
@@ -49,6 +54,197 @@ public:
 bool areSame( DBPF_CPFitemType & a, DBPF_CPFitemType & b );
 
 
+// id of an interned property name, see DBPF_keyTableType
+typedef unsigned int DBPF_keyIDtype;
+
+#define DBPF_NO_KEY 0xFFFFFFFF
+
+// value offset of a property that isn't in the raw bytes (yet)
+#define DBPF_NO_OFFSET 0xFFFFFFFF
+
+
+/**
+<pre>
+ * Interned property names
+ * =======================
+ *
+ * CPF and TXMT resources use a small set of property names over and over
+ * ("age", "family", "sortindex", "stdMatBaseTextureName", ...).
+ * Each name is stored once here, for the whole program,
+ * and properties refer to it by id.
+ *
+ * - intern, gets the id of a name, adding the name if it's new
+ * - find, gets the id of a name, DBPF_NO_KEY if it was never interned
+ * - name, gets the name for an id
+ *
+ * Looking up a name that is already interned doesn't allocate.
+ * Ids and names are never removed, so a name returned by name() stays valid.
+ * Safe to use from several threads.
+</pre>
+**/
+class DBPF_keyTableType
+{
+public:
+  static DBPF_keyIDtype intern( const char * str, const size_t length );
+  static DBPF_keyIDtype intern( const string & str ) { return intern( str.data(), str.size() ); }
+  static DBPF_keyIDtype find( const char * str, const size_t length );
+  static DBPF_keyIDtype find( const string & str ) { return find( str.data(), str.size() ); }
+  static const string & name( const DBPF_keyIDtype id );
+};
+
+
+/**
+<pre>
+ * one property in a DBPF_propertyStoreType
+ * - key is an interned id
+ * - value is one of bool, int, float, or a string,
+ *   the string is in the store's string arena, or in the bytes the store views (mbView)
+ * - muValueOffset is where the value is in the resource's raw bytes,
+ *   mbDirty is set when the value changes, see DBPF_propertyStoreType::spliceChanges
+</pre>
+**/
+class DBPF_propertyType
+{
+public:
+  DBPF_keyIDtype muKey;
+  unsigned int miType;  // CPF_BOOL, CPF_INT, ..., same as DBPF_CPFitemType
+  union
+  {
+    bool mbValue;
+    unsigned int miValue;
+    float mfValue;
+    unsigned int muStrOffset; // string value, offset in arena or viewed bytes
+  };
+  unsigned int muStrLength;   // string value, length
+  bool mbView;                // string value is in the viewed bytes
+  bool mbDirty;               // value changed since it was read or written
+  unsigned int muValueOffset; // offset in raw bytes, string values start with their length
+};
+
+
+/**
+<pre>
+ * Flat property store
+ * ===================
+ *
+ * Properties in file order, in one array, with all string values in one string arena.
+ * Lookup by key id is a linear search, CPF resources have a few dozen properties at most.
+ * clear keeps the memory, so a store that is reused for many resources
+ * stops allocating after the first few.
+ * Both come from the memory resource given to the constructor, a package arena's for example.
+ *
+ * View mode: after setView, addStringView adds strings that stay where they are,
+ * in the viewed bytes, nothing is copied. Those bytes must outlive the store,
+ * or ownStrings must be called before they go away.
+ * Setting a viewed string copies the new value into the arena.
+</pre>
+**/
+class DBPF_propertyStoreType
+{
+public:
+  explicit DBPF_propertyStoreType( pmr::memory_resource * pMemory = pmr::get_default_resource() )
+    : mItems( pMemory ), mStrings( pMemory ), mpView( NULL ) {}
+
+  void clear() { this->mItems.clear(); this->mStrings.clear(); this->mpView = NULL; }
+  unsigned int size() const { return (unsigned int)( this->mItems.size() ); }
+
+  const DBPF_propertyType & at( const unsigned int i ) const { return this->mItems[i]; }
+  const DBPF_propertyType * find( const DBPF_keyIDtype key ) const;
+  const DBPF_propertyType * find( const string_view key ) const;
+  DBPF_propertyType * find( const DBPF_keyIDtype key );
+  DBPF_propertyType * find( const string_view key );
+
+  string_view stringAt( const DBPF_propertyType & item ) const
+  { return string_view( ( item.mbView ? (const char *)( this->mpView ) : this->mStrings.data() ) + item.muStrOffset,
+                        item.muStrLength ); }
+
+  // item must be a CPF_STRING item of this store,
+  // the new value goes over the old one if it fits, otherwise at the end of the arena
+  void setString( DBPF_propertyType & item, const char * str, const size_t length );
+
+  // adds an item without checking that the key is unique, returns it so the caller can fill in the value
+  DBPF_propertyType & add( const DBPF_keyIDtype key, const unsigned int type );
+  DBPF_propertyType & addString( const DBPF_keyIDtype key, const char * str, const size_t length );
+
+  // view mode, str must be in the bytes given to setView
+  void setView( const unsigned char * bytes ) { this->mpView = bytes; }
+  DBPF_propertyType & addStringView( const DBPF_keyIDtype key, const unsigned char * str, const size_t length );
+  // copies viewed strings into the arena, the viewed bytes are not used after this
+  void ownStrings();
+
+  // converts to and from the public item type
+  void getItem( const DBPF_propertyType & item, DBPF_CPFitemType & val ) const;
+  void setItem( DBPF_propertyType & item, const DBPF_CPFitemType & val );
+
+  // after writing all values somewhere else
+  void setValueOffset( const unsigned int i, const unsigned int offset )
+  { this->mItems[i].muValueOffset = offset; this->mItems[i].mbDirty = false; }
+  // after a write that failed part way, so the next update writes everything instead of splicing
+  void dropValueOffsets()
+  { for( DBPF_propertyType & item : this->mItems )
+      item.muValueOffset = DBPF_NO_OFFSET;
+  }
+
+  // writes changed values into the raw bytes the offsets refer to, see DBPF_CPF.cpp
+  // pArena - the bytes' arena (see DBPF_arena.h), NULL if they were allocated with new
+  bool spliceChanges( unsigned char * & bytes, unsigned int & byteCount, const unsigned int lengthSize,
+                      DBPF_arenaType * pArena );
+
+private:
+  pmr::vector< DBPF_propertyType > mItems;
+  pmr::string mStrings;
+  const unsigned char * mpView;
+};
+
+
+/**
+<pre>
+ * one field to look for with DBPF_CPFextract
+ * - set mstrKey, the rest is output
+ * - muOffset is where the value starts in the CPF bytes,
+ *   for strings that's the 4 byte length, the characters follow
+ * - muSize is the value's size in bytes, 1 for bool, 4 for int and float, 4 + length for string
+</pre>
+**/
+class DBPF_CPFfieldType
+{
+public:
+  DBPF_CPFfieldType() : mbFound( false ), miType( 0 ), miValue( 0 ), muOffset( 0 ), muSize( 0 ) {}
+  explicit DBPF_CPFfieldType( const string_view key )
+    : mstrKey( key ), mbFound( false ), miType( 0 ), miValue( 0 ), muOffset( 0 ), muSize( 0 ) {}
+
+  string_view mstrKey;
+  bool mbFound;
+  unsigned int miType;
+  union
+  {
+    bool mbValue;
+    unsigned int miValue;
+    float mfValue;
+  };
+  string_view mstrValue; // string value, view into the CPF bytes
+  unsigned int muOffset;
+  unsigned int muSize;
+};
+
+/**
+<pre>
+ * input:   data, byteCount - uncompressed CPF bytes
+ * in/out:  fields - keys to look for, values and offsets of the ones that were found
+ * returns: true - CPF was scanned until all fields were found or to its end
+ *          false - bad or truncated CPF
+ *
+ * purpose: get a few values from a CPF without decoding it,
+ *          one pass, stops as soon as every field is found, allocates nothing
+</pre>
+**/
+bool DBPF_CPFextract( const unsigned char * data, const unsigned int byteCount,
+                      DBPF_CPFfieldType * fields, const unsigned int fieldCount );
+
+// write a found bool, int, or float field's value over the old one, in place, size doesn't change
+bool DBPF_CPFpatch( unsigned char * data, const unsigned int byteCount, const DBPF_CPFfieldType & field );
+
+
 /**
  * helper class for DBPF_resourceType,
  * for resources that have CPF data (key/value pairs, values can be non-strings)
@@ -56,7 +252,8 @@ bool areSame( DBPF_CPFitemType & a, DBPF_CPFitemType & b );
 class DBPF_CPFtype
 {
 public:
-  DBPF_CPFtype();
+  // pMemory - where the properties and their strings are kept
+  explicit DBPF_CPFtype( pmr::memory_resource * pMemory = pmr::get_default_resource() );
   ~DBPF_CPFtype();
 
   void clear();
@@ -65,13 +262,26 @@ public:
   void dump( FILE * f ) const;
 #endif
 
-  bool initFromByteStream( unsigned char * data, unsigned char * & restOfData );
+  // reads from the cursor's position, false if the CPF runs past its end
+  // bView - string values stay in the bytes, they must outlive this or ownStrings must be called first
+  bool initFromByteStream( DBPF_byteCursorType & bytes, const bool bView = false );
   bool writeToByteStream( unsigned char * & bytes );
+  // how many bytes writeToByteStream writes
+  unsigned int getByteStreamSize() const;
+  void ownStrings() { this->mProperties.ownStrings(); }
+  // bytes must be the uncompressed bytes this was read from or last written to,
+  // from pArena, or from new if that's NULL
+  bool spliceChanges( unsigned char * & bytes, unsigned int & byteCount, DBPF_arenaType * pArena = NULL )
+  { return this->mProperties.spliceChanges( bytes, byteCount, 4, pArena ); }
 
-  unsigned int getPropertyCount() const { return muPropertyCount; }
+  unsigned int getPropertyCount() const { return mProperties.size(); }
   bool getKeyAt( const unsigned int i, string & key ) const;
   bool getPairAt( const unsigned int i, string & key, DBPF_CPFitemType & val ) const;
 
+  // read-only access without copying, the views are valid until the CPF is changed or cleared
+  const DBPF_propertyType * findProperty( const string_view propName ) const { return this->mProperties.find( propName ); }
+  string_view getStringView( const DBPF_propertyType & item ) const { return this->mProperties.stringAt( item ); }
+
   bool getPropertyValue( const string propName, DBPF_CPFitemType & propValue ) const;
   bool setPropertyValue( const string propName, DBPF_CPFitemType & propValue, bool & bChanged,
                                       int & iChangeInRawBytesCount );
@@ -81,12 +291,8 @@ protected:
   unsigned int muTypeID;
   unsigned short muVersion;
 
-  // number of properties
-  unsigned int muPropertyCount;
-  // names of all properties
-  vector< string > mPropertyKeys;
-  // hashmap of property name and property value pairs, get names from mPropertyKeys
-  unordered_map< string, DBPF_CPFitemType > mProperties;
+  // properties in file order
+  DBPF_propertyStoreType mProperties;
 };
 
 
@@ -98,7 +304,8 @@ protected:
 class DBPF_propertiesType
 {
 public:
-  DBPF_propertiesType();
+  // pMemory - where the properties and their strings are kept
+  explicit DBPF_propertiesType( pmr::memory_resource * pMemory = pmr::get_default_resource() );
   ~DBPF_propertiesType();
 
   void clear();
@@ -107,22 +314,28 @@ public:
   void dump( FILE * f ) const;
 #endif
 
-  unsigned int getPropertyCount() const { return muPropertyCount; }
+  unsigned int getPropertyCount() const { return mProperties.size(); }
   bool getKeyAt( const unsigned int i, string & key ) const;
   bool getPairAt( const unsigned int i, string & key, string & val ) const;
 
+  // read-only access without copying, the view is valid until the properties are changed or cleared
+  bool getPropertyView( const string_view propName, string_view & propValue ) const;
+
   bool getPropertyValue( const string propName, string & propValue ) const;
   bool setPropertyValue( const string propName, const string & propValue, bool & bChanged,
                                       int & iChangeInRawBytesCount );
-  bool addPair( string propName, string propValue );
+  // valueOffset - where the value's length byte is in the raw bytes, if it came from there
+  bool addPair( string propName, string propValue, const unsigned int valueOffset = DBPF_NO_OFFSET );
+
+  // for the TXMT writer, and splicing changed values back into the TXMT raw bytes (1 byte lengths)
+  void setValueOffset( const unsigned int i, const unsigned int offset ) { this->mProperties.setValueOffset( i, offset ); }
+  void dropValueOffsets() { this->mProperties.dropValueOffsets(); }
+  bool spliceChanges( unsigned char * & bytes, unsigned int & byteCount, DBPF_arenaType * pArena = NULL )
+  { return this->mProperties.spliceChanges( bytes, byteCount, 1, pArena ); }
 
 protected:
-  // number of properties
-  unsigned int muPropertyCount;
-  // names of all properties
-  vector< string > mPropertyKeys;
-  // hashmap of property name and property value pairs, get names from mPropertyKeys
-  unordered_map< string, string > mProperties;
+  // properties in file order, all CPF_STRING
+  DBPF_propertyStoreType mProperties;
 
 };
 
@@ -5,7 +5,8 @@
 #include "DBPF_CPFresource.h"
 
 
-DBPF_CPFresourceType::DBPF_CPFresourceType()
+DBPF_CPFresourceType::DBPF_CPFresourceType( DBPF_arenaType * pArena )
+: DBPF_resourceType( pArena )
 {
   clear();
 }
@@ -63,7 +64,7 @@ bool DBPF_CPFresourceType::initFromByteStream( const DBPFindexType & entry, unsi
 
   // allocate CPF if needed
   if( NULL == this->mpCPF )
-  { this->mpCPF = new DBPF_CPFtype();
+  { this->mpCPF = dbpfNew< DBPF_CPFtype >( this->mpArena, dbpfMemoryResource( this->mpArena ) );
     if( NULL == this->mpCPF )
     { fprintf( stderr, "ERROR: DBPF_CPFresourceType.initFromByteStream, failed to allocate CPF\n" );
       return false;
@@ -73,13 +74,12 @@ bool DBPF_CPFresourceType::initFromByteStream( const DBPFindexType & entry, unsi
   // clear CPF
   this->mpCPF->clear();
 
-  // init CPF
-  unsigned char * bytes2 = NULL;
-  if( false == this->mpCPF->initFromByteStream( data, bytes2 ) )
+  // init CPF, string values stay in the raw bytes until they are set
+  DBPF_byteCursorType bytes( data, (size_t)byteCountToRead );
+  if( false == this->mpCPF->initFromByteStream( bytes, true ) )
   { fprintf( stderr, "ERROR: DBPF_CPFresourceType.initFromByteStream, failed to init CPF\n" );
     return false;
   }
-  data = bytes2;
 
   // get resource name from CPF
   DBPF_CPFitemType nameVal;
@@ -115,6 +115,21 @@ bool DBPF_CPFresourceType::updateRawBytes()
   // changes needed
   // --------------
 
+  // raw bytes are uncompressed and were read or written by the CPF,
+  // so only the values that changed need writing
+  // (isCompressed is always false while changed, so ask the bytes)
+  unsigned int barUncSize = 0;
+  bool bCompressed = this->areRawBytesCompressed( barUncSize );
+  if( false == bCompressed
+   && true == this->mpCPF->spliceChanges( this->mpRawBytes, this->muRawBytesCount, this->mpArena ) )
+  {
+    this->mbChanged = false;
+    this->miChangeInRawBytesCount = 0;
+    return true;
+  }
+
+  // otherwise write the whole CPF
+
   // new byte array size
   // - - - - - - - - - -
 
@@ -123,16 +138,25 @@ bool DBPF_CPFresourceType::updateRawBytes()
 
   // use this formula if raw bytes are currently compressed,
   // need to get the uncompressed size from them
-  unsigned int fooCmprSize, barUncSize;
-  bool bCompressed = this->isCompressed( fooCmprSize, barUncSize );
   if( bCompressed )
     newSize = (unsigned int)((int)(barUncSize) + this->miChangeInRawBytesCount);
 
 
+  // does the CPF agree?
+  // checked before writing, writing moves the value offsets that splicing depends on
+
+  unsigned int cpfSize = this->mpCPF->getByteStreamSize();
+  if( cpfSize != newSize )
+  { fprintf( stderr, "ERROR: DBPF_CPFresourceType.updateRawBytes, something went wrong, CPF size %u, expected new size %u\n",
+           cpfSize, newSize );
+    return false;
+  }
+
+
   // allocate new byte array
   // - - - - - - - - - - - -
 
-  unsigned char * newBytes = new unsigned char[ newSize ];
+  unsigned char * newBytes = dbpfNewBytes( this->mpArena, newSize );
   if( NULL == newBytes )
   { fprintf( stderr, "ERROR: DBPF_CPFresourceType.updateRawBytes, failed to allocate memory\n" );
     return false;
@@ -147,18 +171,7 @@ bool DBPF_CPFresourceType::updateRawBytes()
 
   if( false == this->mpCPF->writeToByteStream( ptrWrite ) )
   { fprintf( stderr, "ERROR: DBPF_CPFresourceType.updateRawBytes, failed to write CPF to byte stream\n" );
-    return false;
-  }
-
-  // =================================================================
-
-  // did we write the correct amount of bytes?
-
-  unsigned int sizeWritten = (unsigned int)(ptrWrite - newBytes);
-  if( sizeWritten != newSize )
-  { fprintf( stderr, "ERROR: DBPF_CPFresourceType.updateRawBytes, something went wrong, bytes written %u, expected new size %u\n",
-           sizeWritten, newSize );
-    delete [] newBytes;
+    dbpfDeleteBytes( this->mpArena, newBytes );
     return false;
   }
 
@@ -169,14 +182,16 @@ bool DBPF_CPFresourceType::updateRawBytes()
   // byte count is the new size
   this->muRawBytesCount = newSize;
 
-  // byte array is new byte array, delete old bytes
-  if( NULL != this->mpRawBytes )
-    delete [] this->mpRawBytes;
+  // byte array is new byte array, delete old bytes,
+  // CPF strings that still point into them are copied first
+  this->mpCPF->ownStrings();
+  dbpfDeleteBytes( this->mpArena, this->mpRawBytes );
   this->mpRawBytes = newBytes;
   newBytes = NULL;
 
   // set changed flag to false
   this->mbChanged = false;
+  this->miChangeInRawBytesCount = 0;
 
   // report success!
   return true;
@@ -16,7 +16,7 @@
 class DBPF_CPFresourceType : public DBPF_resourceType
 {
 public:
-  DBPF_CPFresourceType();
+  explicit DBPF_CPFresourceType( DBPF_arenaType * pArena = NULL );
   virtual ~DBPF_CPFresourceType();
 
   virtual void clear();
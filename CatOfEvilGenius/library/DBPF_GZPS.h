@@ -7,7 +7,7 @@
 class DBPF_GZPStype : public DBPF_CPFresourceType
 {
 public:
-  DBPF_GZPStype() {}
+  explicit DBPF_GZPStype( DBPF_arenaType * pArena = NULL ) : DBPF_CPFresourceType( pArena ) {}
   ~DBPF_GZPStype() {}
 
   unsigned int getAge() const;
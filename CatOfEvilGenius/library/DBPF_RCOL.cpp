@@ -78,35 +78,33 @@ void DBPF_RCOLtype::dump( FILE * f ) const
 #endif
 
 
-bool DBPF_RCOLtype::initFromByteStream( unsigned char * data,    // IN - data, rcol header at beginning
-                                        unsigned char * & restOfData ) // OUT - points to first byte after header
+bool DBPF_RCOLtype::initFromByteStream( DBPF_byteCursorType & bytes ) // IN/OUT - rcol header at its position, afterwards the first byte after the header
 {
   // set uninitialized, remove any old data
   this->clear();
 
   // sanity check
-  if( NULL == data )
+  if( false == bytes.ok() || bytes.left() < 4 )
   { fprintf( stderr, "ERROR: DBPF_RCOLtype.initFromByteStream, null data\n" );
     return false;
   }
 
+  const unsigned char * start = bytes.pos();
+
   // is first DWORD 0x0100FFFF? (not uint, but raw bytes!)
   // if so, we have resource IDs in links,
   // if not, no resource IDs in links
 
-  unsigned char * bytes = data;
-
   this->mbLinksHaveResourceID = false;
-  if( data[0] == 1  &&  data[1] == 0  &&  data[2] == 0xFF  &&  data[3] == 0xFF )
+  if( start[0] == 1  &&  start[1] == 0  &&  start[2] == 0xFF  &&  start[3] == 0xFF )
   {
     this->mbLinksHaveResourceID = true;
-    bytes += 4;
+    bytes.skip( 4 );
   }
 
   // link count
 
-  bytes2uint( bytes, 4, this->muLinkCount );
-  bytes += 4;
+  this->muLinkCount = bytes.readUint32();
 
 #ifdef _DEBUG
 //  printf( "link count %u\n", this->muLinkCount );
@@ -117,26 +115,14 @@ bool DBPF_RCOLtype::initFromByteStream( unsigned char * data,    // IN - data, r
 
   DBPF_TGIRtype link;
 
-  for( unsigned int i = 0; i < this->muLinkCount; ++i )
+  for( unsigned int i = 0; i < this->muLinkCount && bytes.ok(); ++i )
   {
-    // group
-    bytes2uint( bytes, 4, link.muGroupID );
-    bytes += 4;
-
-    // instance
-    bytes2uint( bytes, 4, link.muInstanceID );
-    bytes += 4;
-
+    link.muGroupID = bytes.readUint32();
+    link.muInstanceID = bytes.readUint32();
     // resource (not always there)
     if( this->mbLinksHaveResourceID )
-    {
-      bytes2uint( bytes, 4, link.muResourceID );
-      bytes += 4;
-    }
-
-    // type
-    bytes2uint( bytes, 4, link.muTypeID );
-    bytes += 4;
+      link.muResourceID = bytes.readUint32();
+    link.muTypeID = bytes.readUint32();
 
 #ifdef _DEBUG
 /*    printf( "link\n" );
@@ -146,14 +132,14 @@ bool DBPF_RCOLtype::initFromByteStream( unsigned char * data,    // IN - data, r
 #endif
 
     // add to list of links
-    this->mLinks.push_back( link );
+    if( bytes.ok() )
+      this->mLinks.push_back( link );
   }
 
 
   // index item count
 
-  bytes2uint( bytes, 4, this->muIndexItemCount );
-  bytes += 4;
+  this->muIndexItemCount = bytes.readUint32();
 
 #ifdef _DEBUG
 //  printf( "index item count %u\n", this->muIndexItemCount );
@@ -163,10 +149,9 @@ bool DBPF_RCOLtype::initFromByteStream( unsigned char * data,    // IN - data, r
   // index(es)
 
   unsigned int rcolID = 0;
-  for( unsigned int i = 0; i < this->muIndexItemCount; ++i )
+  for( unsigned int i = 0; i < this->muIndexItemCount && bytes.ok(); ++i )
   {
-    bytes2uint( bytes, 4, rcolID );
-    bytes += 4;
+    rcolID = bytes.readUint32();
 
 #ifdef _DEBUG
 /*    printf( "rcol ID: " );
@@ -174,18 +159,22 @@ bool DBPF_RCOLtype::initFromByteStream( unsigned char * data,    // IN - data, r
     printf( "\n" );  */
 #endif
 
-    this->mIndex.push_back( rcolID );
+    if( bytes.ok() )
+      this->mIndex.push_back( rcolID );
+  }
+
+  if( false == bytes.ok() )
+  { fprintf( stderr, "ERROR: DBPF_RCOLtype.initFromByteStream, RCOL header runs past the end of the data\n" );
+    this->clear();
+    return false;
   }
 
 
   // finished initializing
   this->mbInitialized = true;
 
-  // rest of the data, after the header, starts here
-  restOfData = bytes;
-
   // how big is the RCOL in bytes?
-  this->muRawBytesCount = (unsigned int)(restOfData - data);
+  this->muRawBytesCount = (unsigned int)( bytes.pos() - start );
 
   return true;
 } // initFromByteStream
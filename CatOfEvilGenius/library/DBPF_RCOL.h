@@ -25,6 +25,7 @@
 #include <cstdlib>
 #include <vector>
 #include "DBPF_types.h" // TGIR type
+#include "DBPF_byteCursor.h"
 using namespace std;
 
 
@@ -41,7 +42,8 @@ public:
   DBPF_RCOLtype();
   ~DBPF_RCOLtype();
 
-  bool initFromByteStream( unsigned char * data, unsigned char * & restOfData );
+  // reads from the cursor's position, false if the header runs past its end
+  bool initFromByteStream( DBPF_byteCursorType & bytes );
   void clear();
 
   bool isInitialized() const { return this->mbInitialized; }
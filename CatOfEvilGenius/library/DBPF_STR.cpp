@@ -9,19 +9,20 @@
 
 #include "DBPF_STR.h"
 #include "DBPF_byteStreamFunctions.h"
+#include "DBPF_byteCursor.h"
 
 
-void readByteStream_DBPFtext( unsigned char * & bytes, DBPF_textType & text )
+// no length limit on the texts, they end at a null, or the read fails at the end of the bytes
+static void readByteStream_DBPFtext( DBPF_byteCursorType & bytes, DBPF_textType & text )
 {
   // language code, 1 byte
-  text.mLanguageCode = bytes[0];
-  bytes += 1;
+  text.mLanguageCode = bytes.readUint8();
 
   // value text
-  readByteStream_strNullTerminated( bytes, text.mstrValueText );
+  text.mstrValueText.assign( bytes.readStrNull() );
 
   // description text
-  readByteStream_strNullTerminated( bytes, text.mstrDescText );
+  text.mstrDescText.assign( bytes.readStrNull() );
 }
 
 
@@ -69,29 +70,33 @@ bool DBPF_STRtype::initFromByteStream( const DBPFindexType & entry, unsigned cha
 
   // -----------------------------------
 
-  char str[256];
-  unsigned char * bytes = data;
+  DBPF_byteCursorType bytes( data, (size_t)byteCountToRead );
 
   // file name, always 64 bytes, null terminated
 
-  memcpy( str, bytes, 64 );
-  str[64] = '\0';
-  this->mstrName.assign( str );
-  bytes += 64;
+  string_view name = bytes.readChars( 64 );
+  this->mstrName.assign( name.substr( 0, name.find( '\0' ) ) );
 
   // format code
-  readByteStream_ushort( bytes, this->msFormatCode );
+  this->msFormatCode = bytes.readUint16();
 
   // number of text items
-  readByteStream_ushort( bytes, this->msTextItemCount );
+  this->msTextItemCount = bytes.readUint16();
 
   // text items
 
   DBPF_textType text;
-  for( unsigned short i = 0; i < this->msTextItemCount; ++i )
+  for( unsigned short i = 0; i < this->msTextItemCount && bytes.ok(); ++i )
   {
     readByteStream_DBPFtext( bytes, text );
-    this->mTextItems.push_back( text );
+    if( bytes.ok() )
+      this->mTextItems.push_back( text );
+  }
+
+  if( false == bytes.ok() )
+  { fprintf( stderr, "ERROR: DBPF_STRtype.initFromByteStream, %u text items, the data ends after %u\n",
+             (unsigned int)( this->msTextItemCount ), (unsigned int)( this->mTextItems.size() ) );
+    return false;
   }
 
   // -----------------------------------
@@ -112,7 +117,7 @@ bool DBPF_STRtype::updateRawBytes()
   // allocate new bytes
 
   unsigned int newByteCount = (unsigned int)((int)(this->muRawBytesCount) + this->miChangeInRawBytesCount);
-  unsigned char * bytes = new unsigned char[ newByteCount ];
+  unsigned char * bytes = dbpfNewBytes( this->mpArena, newByteCount );
   if( NULL == bytes )
     return false;
   unsigned char * bytesStart = bytes;
@@ -125,7 +130,7 @@ bool DBPF_STRtype::updateRawBytes()
   for( int i = 0; i < 64; ++i )
     bytes[i] = 0;
   unsigned char * bytes2 = bytes;
-  writeByteStream_strNullTerminated( bytes2, this->mstrName ); // ptr won't advance 64, only advance length of string
+  writeByteStream_strNullTerminated( bytes2, this->mstrName.c_str() ); // ptr won't advance 64, only advance length of string
   bytes += 64;
 
   // format code
@@ -151,8 +156,7 @@ bool DBPF_STRtype::updateRawBytes()
   // -------------
 
   // new raw bytes
-  if( this->mpRawBytes != NULL )
-    delete [] this->mpRawBytes;
+  dbpfDeleteBytes( this->mpArena, this->mpRawBytes );
   this->mpRawBytes = bytesStart;
   bytes = NULL;
 
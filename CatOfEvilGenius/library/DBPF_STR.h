@@ -32,7 +32,7 @@ typedef struct DBPF_textStruct
 class DBPF_STRtype : public DBPF_resourceType
 {
 public:
-  DBPF_STRtype() { clear(); }
+  explicit DBPF_STRtype( DBPF_arenaType * pArena = NULL ) : DBPF_resourceType( pArena ) { clear(); }
   ~DBPF_STRtype() { clear(); }
 
   void clear();
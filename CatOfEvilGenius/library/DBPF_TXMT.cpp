@@ -12,10 +12,12 @@
 #include "DBPF_types.h"
 #include "DBPF_TXMT.h"
 #include "DBPF_byteStreamFunctions.h"
+#include "DBPF_byteCursor.h"
 
 
 
-DBPF_TXMTtype::DBPF_TXMTtype()
+DBPF_TXMTtype::DBPF_TXMTtype( DBPF_arenaType * pArena )
+: DBPF_resourceType( pArena )
 {
   this->mpRawBytes = NULL;
   clear();
@@ -121,9 +123,9 @@ bool DBPF_TXMTtype::initFromByteStream( const DBPFindexType & entry,
   // ---------------------------------------
 
   // read RCOL header first
-  unsigned char * bytes = data, * bytes2 = NULL;
-  this->mRCOL.initFromByteStream( bytes, bytes2 );
-  bytes = bytes2;
+  DBPF_byteCursorType bytes( data, (size_t)byteCountToRead );
+  if( false == this->mRCOL.initFromByteStream( bytes ) )
+    return false;
 
   // RCOL header should have had one index entry, and the RCOL ID should be TXMT
 
@@ -139,39 +141,34 @@ bool DBPF_TXMTtype::initFromByteStream( const DBPFindexType & entry,
 
 
   // block name
-  char str[256]; str[0] = '\0';
-  unsigned char strLength = 0;
-  readByteStream_str( bytes, strLength, str );
-  this->mstrBlockName.assign( string( str ) );
+  this->mstrBlockName.assign( bytes.readStr8() );
   if( 0 != strcmp( this->mstrBlockName.c_str(), "cMaterialDefinition" ) )
-  { fprintf( stderr, "ERROR: expected cMaterialDefinition, got %s\n", this->mstrBlockName );
+  { fprintf( stderr, "ERROR: expected cMaterialDefinition, got %s\n", this->mstrBlockName.c_str() );
     return false;
   }
-//  printf( "block name: %s\n", str );
+//  printf( "block name: %s\n", this->mstrBlockName.c_str() );
 
   // block ID
-  readByteStream_uint( bytes, 4, this->muBlockID );
+  this->muBlockID = bytes.readUint32();
   if( this->muBlockID != DBPF_TXMT )
   { fprintf( stderr, "ERROR: expected TXMT value, 0x%x, got 0x%x\n", DBPF_TXMT, this->muBlockID );
     return false;
   }
 
   // block version
-  readByteStream_uint( bytes, 4, this->muBlockVersion );
+  this->muBlockVersion = bytes.readUint32();
 
   // material name in cSGResource
-  readByteStream_cSGResource( bytes, strLength, str );
-  this->mstrName.assign( (string)( str ) );
+  bytes.skip( 20 ); // "cSGResource", 0, and 2
+  this->mstrName.assign( bytes.readStr8() );
 //  printf( "name: %s\n", this->mstrName.c_str() );
 
   // material description
-  readByteStream_str( bytes, strLength, str );
-  this->mstrDesc.assign( str );
+  this->mstrDesc.assign( bytes.readStr8() );
 //  printf( "desc: %s\n", this->mstrDesc.c_str() );
 
   // material type
-  readByteStream_str( bytes, strLength, str );
-  this->mstrMaterialType.assign( str );
+  this->mstrMaterialType.assign( bytes.readStr8() );
 //  printf( "mat type: %s\n", this->mstrMaterialType.c_str() );
 
   // properties
@@ -179,7 +176,7 @@ bool DBPF_TXMTtype::initFromByteStream( const DBPFindexType & entry,
 
   if( NULL == this->mpProperties )
   {
-    this->mpProperties = new DBPF_propertiesType();
+    this->mpProperties = dbpfNew< DBPF_propertiesType >( this->mpArena, dbpfMemoryResource( this->mpArena ) );
     if( NULL == this->mpProperties )
     { fprintf( stderr, "ERROR: DBPF_TXMTtype, initFromByteStream, failed to allocate properties\n" );
       return false;
@@ -187,23 +184,24 @@ bool DBPF_TXMTtype::initFromByteStream( const DBPFindexType & entry,
   }
 
   // property count
-  unsigned int val = 0;
-  readByteStream_uint( bytes, 4, val );
+  unsigned int val = bytes.readUint32();
 //  printf( "prop count: %u\n", val );
 
   // properties
 
   this->mpProperties->clear();
 
-  char str2[256]; str2[0] = '\0';
-  for( unsigned int i = 0; i < val; ++i )
+  string_view propName, propValue;
+  for( unsigned int i = 0; i < val && bytes.ok(); ++i )
   {
     // property name, property value
-    readByteStream_str( bytes, strLength, str );
-    readByteStream_str( bytes, strLength, str2 );
-    this->mpProperties->addPair( str, str2 );
+    propName = bytes.readStr8();
+    unsigned int valueOffset = (unsigned int)( bytes.offset() );
+    propValue = bytes.readStr8();
+    if( bytes.ok() )
+      this->mpProperties->addPair( string( propName ), string( propValue ), valueOffset );
 #ifdef _DEBUG
-//    printf( "%s: %s\n", str, str2 );
+//    printf( "%s: %s\n", string( propName ).c_str(), string( propValue ).c_str() );
 #endif
   } // properties loop
 
@@ -213,18 +211,23 @@ bool DBPF_TXMTtype::initFromByteStream( const DBPFindexType & entry,
   if( this->muBlockVersion > 8 )
   {
     // texture name count
-    readByteStream_uint( bytes, 4, this->muTextureNameCount );
+    this->muTextureNameCount = bytes.readUint32();
 //    printf( "texture name count: %u\n", this->muTextureNameCount );
 
     // texture names
-    for( unsigned int i = 0; i < this->muTextureNameCount; ++i )
+    for( unsigned int i = 0; i < this->muTextureNameCount && bytes.ok(); ++i )
     {
-      readByteStream_str( bytes, strLength, str );
-      this->mTextureNames.push_back( string( str ) );
-//      printf( "  %s\n", str );
+      string_view str = bytes.readStr8();
+      if( bytes.ok() )
+        this->mTextureNames.push_back( string( str ) );
     }
   }
 
+  if( false == bytes.ok() )
+  { fprintf( stderr, "ERROR: DBPF_TXMTtype.initFromByteStream, TXMT runs past the end of the data\n" );
+    return false;
+  }
+
   // -------------------------------------
 
   // done initializing
@@ -264,6 +267,21 @@ bool DBPF_TXMTtype::updateRawBytes()
   // changes needed
   // --------------
 
+  // raw bytes are uncompressed and properties were read or written from them,
+  // so only the values that changed need writing
+  // (isCompressed is always false while changed, so ask the bytes)
+  unsigned int barUncSize = 0;
+  bool bCompressed = this->areRawBytesCompressed( barUncSize );
+  if( false == bCompressed
+   && true == this->mpProperties->spliceChanges( this->mpRawBytes, this->muRawBytesCount, this->mpArena ) )
+  {
+    this->mbChanged = false;
+    this->miChangeInRawBytesCount = 0;
+    return true;
+  }
+
+  // otherwise write the whole TXMT
+
   // new byte array size
   // - - - - - - - - - -
 
@@ -272,8 +290,6 @@ bool DBPF_TXMTtype::updateRawBytes()
 
   // use this formula if raw bytes are currently compressed,
   // need to get the uncompressed size from them
-  unsigned int fooCmprSize, barUncSize;
-  bool bCompressed = this->isCompressed( fooCmprSize, barUncSize );
   if( bCompressed )
     newSize = (unsigned int)((int)(barUncSize) + this->miChangeInRawBytesCount);
 
@@ -281,7 +297,7 @@ bool DBPF_TXMTtype::updateRawBytes()
   // allocate new byte array
   // - - - - - - - - - - - -
 
-  unsigned char * newBytes = new unsigned char[ newSize ];
+  unsigned char * newBytes = dbpfNewBytes( this->mpArena, newSize );
   if( NULL == newBytes )
   { fprintf( stderr, "ERROR: DBPF_TXMTtype.updateRawBytes, failed to allocate memory\n" );
     return false;
@@ -307,10 +323,10 @@ bool DBPF_TXMTtype::updateRawBytes()
   writeByteStream_uint( ptrWrite, this->muBlockVersion );
 
   // name, in cSGResource
-  writeByteStream_cSGResource( ptrWrite, this->mstrName );
+  writeByteStream_cSGResource( ptrWrite, (unsigned char)( strlen( this->mstrName.c_str() ) ), this->mstrName.c_str() );
 
   // material description
-  writeByteStream_str( ptrWrite, this->mstrDesc );
+  writeByteStream_str( ptrWrite, (unsigned char)( strlen( this->mstrDesc.c_str() ) ), this->mstrDesc.c_str() );
 
   // material type
   writeByteStream_str( ptrWrite, this->mstrMaterialType );
@@ -330,6 +346,7 @@ bool DBPF_TXMTtype::updateRawBytes()
     // property name
     writeByteStream_str( ptrWrite, key );
     // property value
+    this->mpProperties->setValueOffset( i, (unsigned int)( ptrWrite - newBytes ) );
     writeByteStream_str( ptrWrite, val );
   }
 
@@ -351,7 +368,9 @@ bool DBPF_TXMTtype::updateRawBytes()
   if( sizeWritten != newSize )
   { fprintf( stderr, "ERROR: DBPF_TXMTtype.updateRawBytes, something went wrong, bytes written %u, expected new size %u\n",
            sizeWritten, newSize );
-    delete [] newBytes;
+    dbpfDeleteBytes( this->mpArena, newBytes );
+    // the offsets now point into the bytes just thrown away, don't splice into the old ones next time
+    this->mpProperties->dropValueOffsets();
     return false;
   }
 
@@ -363,13 +382,13 @@ bool DBPF_TXMTtype::updateRawBytes()
   this->muRawBytesCount = newSize;
 
   // byte array is new byte array, delete old bytes
-  if( NULL != this->mpRawBytes )
-    delete [] this->mpRawBytes;
+  dbpfDeleteBytes( this->mpArena, this->mpRawBytes );
   this->mpRawBytes = newBytes;
   newBytes = NULL;
 
   // set changed flag to false
   this->mbChanged = false;
+  this->miChangeInRawBytesCount = 0;
 
   // report success!
   return true;
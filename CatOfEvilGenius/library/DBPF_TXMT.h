@@ -24,7 +24,7 @@ using namespace stdext;
 class DBPF_TXMTtype : public DBPF_resourceType
 {
 public:
-  DBPF_TXMTtype();
+  explicit DBPF_TXMTtype( DBPF_arenaType * pArena = NULL );
   ~DBPF_TXMTtype();
 
   void clear();
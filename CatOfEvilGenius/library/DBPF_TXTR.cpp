@@ -9,10 +9,12 @@
 
 #include "DBPF_types.h"
 #include "DBPF_byteStreamFunctions.h"
+#include "DBPF_byteCursor.h"
 #include "DBPF_TXTR.h"
 
 
-DBPF_TXTRtype::DBPF_TXTRtype()
+DBPF_TXTRtype::DBPF_TXTRtype( DBPF_arenaType * pArena )
+: DBPF_resourceType( pArena )
 {
   this->mpRawBytes = NULL;
   this->mpImageData = NULL;
@@ -46,8 +48,7 @@ void DBPF_TXTRtype::clear()
   muOuterLoopCount = 0;
   muInnerLoopCount = 0;
 
-  if( mpImageData != NULL )
-    delete [] mpImageData;
+  dbpfDeleteBytes( this->mpArena, mpImageData );
   mpImageData = NULL;
   muImageDataSize = 0;
 }
@@ -129,9 +130,9 @@ bool DBPF_TXTRtype::initFromByteStream( const DBPFindexType & entry,
   // ---------------------------------------------------------
 
   // RCOL header
-  unsigned char * bytes = data, * bytes2 = NULL;
-  this->mRCOL.initFromByteStream( bytes, bytes2 );
-  bytes = bytes2;
+  DBPF_byteCursorType bytes( data, (size_t)byteCountToRead );
+  if( false == this->mRCOL.initFromByteStream( bytes ) )
+    return false;
 
   // RCOL header should have had one index entry, and the RCOL ID should be TXTR
 
@@ -147,76 +148,74 @@ bool DBPF_TXTRtype::initFromByteStream( const DBPFindexType & entry,
 
 
   // block name
-  char str[256]; str[0] = '\0';
-  unsigned char strLength = 0;
-  readByteStream_str( bytes, strLength, str );
-  if( 0 != strcmp( str, "cImageData" ) )
-  { fprintf( stderr, "ERROR: DBPF_TXTRtype.initFromByteStream, block name, expected cImageData, got %s\n", str );
+  this->mstrBlockName.assign( bytes.readStr8() );
+  if( 0 != strcmp( this->mstrBlockName.c_str(), "cImageData" ) )
+  { fprintf( stderr, "ERROR: DBPF_TXTRtype.initFromByteStream, block name, expected cImageData, got %s\n", this->mstrBlockName.c_str() );
     return false;
   }
-  this->mstrBlockName.assign( str );
 
   // block ID
-  readByteStream_uint( bytes, 4, this->muBlockID );
+  this->muBlockID = bytes.readUint32();
   if( this->muBlockID != DBPF_TXTR )
   { fprintf( stderr, "ERROR: DBPF_TXTRtype.initFromByteStream, block ID, expected 0x%x, got 0x%x\n", DBPF_TXTR, this->muBlockID );
     return false;
   }
 
   // block version
-  readByteStream_uint( bytes, 4, this->muBlockVersion );
+  this->muBlockVersion = bytes.readUint32();
 
   // texture name (cSGResource)
-  readByteStream_cSGResource( bytes, strLength, str );
-  this->mstrName.assign( str );
+  bytes.skip( 20 ); // "cSGResource", 0, and 2
+  this->mstrName.assign( bytes.readStr8() );
 
   // texture width
   // texture height
-  readByteStream_uint( bytes, 4, this->muWidth );
-  readByteStream_uint( bytes, 4, this->muHeight );
+  this->muWidth = bytes.readUint32();
+  this->muHeight = bytes.readUint32();
 
   // format code
-  readByteStream_uint( bytes, 4, this->muFormatCode );
+  this->muFormatCode = bytes.readUint32();
 
   // mipmap code
-  readByteStream_uint( bytes, 4, this->muMipmapCode );
+  this->muMipmapCode = bytes.readUint32();
 
   // purpose
-  unsigned int foo = 0;
-  readByteStream_uint( bytes, 4, foo );
+  unsigned int foo = bytes.readUint32();
   memcpy( &(this->mfPurpose), &foo, 4 );
 
   // outer loop count
-  readByteStream_uint( bytes, 4, this->muOuterLoopCount );
+  this->muOuterLoopCount = bytes.readUint32();
 
   // skip an int (always 0)
-  bytes += 4;
+  bytes.skip( 4 );
 
 #ifdef _DEBUG
 /*
-  for( unsigned int b = 0; b < 50; ++b )
-    printf( "%c", bytes[b] );
+  for( unsigned int b = 0; b < 50 && b < bytes.left(); ++b )
+    printf( "%c", bytes.pos()[b] );
   printf( "\n" );
 */
 #endif
 
   // file description, like file name w/o _txtr
   if( 9 == this->muBlockVersion )
-  {
-    readByteStream_str( bytes, strLength, str );
-    this->mstrDesc.assign( str );
+    this->mstrDesc.assign( bytes.readStr8() );
+
+  if( false == bytes.ok() )
+  { fprintf( stderr, "ERROR: DBPF_TXTRtype.initFromByteStream, TXTR header runs past the end of the data\n" );
+    return false;
   }
 
 
-  // copy image data, raw bytes
+  // copy image data, raw bytes, the rest of the resource
 
-  this->muImageDataSize = byteCountToRead - ( bytes - data );
-  this->mpImageData = new unsigned char[ this->muImageDataSize ];
+  this->muImageDataSize = (unsigned int)( bytes.left() );
+  this->mpImageData = dbpfNewBytes( this->mpArena, this->muImageDataSize );
   if( NULL == this->mpImageData )
   { fprintf( stderr, "ERROR: TXTR couldn't allocate memory for raw image data\n" );
     return false;
   }
-  memcpy( this->mpImageData, bytes, this->muImageDataSize );
+  memcpy( this->mpImageData, bytes.pos(), this->muImageDataSize );
 
   // --------------------------------------
   // done initializing
@@ -13,7 +13,7 @@
 class DBPF_TXTRtype : public DBPF_resourceType
 {
 public:
-  DBPF_TXTRtype();
+  explicit DBPF_TXTRtype( DBPF_arenaType * pArena = NULL );
   ~DBPF_TXTRtype();
 
   void clear();
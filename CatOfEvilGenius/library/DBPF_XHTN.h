@@ -7,7 +7,7 @@
 class DBPF_XHTNtype : public DBPF_CPFresourceType
 {
 public:
-  DBPF_XHTNtype() {}
+  explicit DBPF_XHTNtype( DBPF_arenaType * pArena = NULL ) : DBPF_CPFresourceType( pArena ) {}
   ~DBPF_XHTNtype() {}
 
   bool setFamily( string family );
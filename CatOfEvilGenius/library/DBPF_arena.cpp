@@ -0,0 +1,19 @@
+/**
+ * file: DBPF_arena.cpp
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_arenaType - memory for one package's resources, given back all at once
+**/
+
+#include "DBPF_arena.h"
+
+
+void DBPF_arenaType::release()
+{
+  // resources delete their CPF and properties, those are in here too, so destroy before freeing
+  for( size_t i = this->mObjects.size(); i > 0; --i )
+    this->mObjects[i-1].second( this->mObjects[i-1].first );
+  this->mObjects.clear();
+
+  this->mMemory.release();
+}
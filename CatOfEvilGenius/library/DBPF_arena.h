@@ -0,0 +1,129 @@
+/**
+ * file: DBPF_arena.h
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_arenaType - memory for one package's resources, given back all at once
+ * dbpfNew, dbpfDelete, dbpfNewBytes, dbpfDeleteBytes - allocate from an arena, or the heap without one
+**/
+
+#ifndef DBPF_ARENA_H_CATOFEVILGENIUS
+#define DBPF_ARENA_H_CATOFEVILGENIUS
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+#include <memory_resource>
+
+using namespace std;
+
+
+// first block of a DBPF_arenaType, later blocks grow from there
+#define DBPF_ARENA_INITIAL_SIZE ( 1 << 20 )
+
+
+/**
+<pre>
+ * Package arena
+ * =============
+ *
+ * readPackage makes several allocations per resource: the resource, its raw bytes,
+ * the decompressed or recompressed copy, its CPF, the CPF's containers, the name strings.
+ * Give readPackage an arena, and all of those come from a few big blocks instead,
+ * and release gives back the whole package in one go:
+ *
+ *   DBPF_arenaType arena;
+ *   readPackage( fileName, package, types, resources, false, &arena );
+ *   ... use and write the resources ...
+ *   arena.release();    // or let the arena go out of scope
+ *   resources.clear();  // the pointers are gone with the arena
+ *
+ * - don't delete resources that were made in an arena, release destroys them
+ * - memory given back inside the arena (a replaced raw byte array, a grown vector)
+ *   is only reused after release, so an arena is for reading a package, changing some of it,
+ *   and writing it, not for a long edit session
+ * - one thread at a time, like the package and resources themselves
+</pre>
+**/
+class DBPF_arenaType
+{
+public:
+  explicit DBPF_arenaType( const size_t initialSize = DBPF_ARENA_INITIAL_SIZE )
+    : mMemory( initialSize ) {}
+  ~DBPF_arenaType() { this->release(); }
+
+  // for pmr containers that should live in the arena
+  pmr::memory_resource * getMemoryResource() { return &( this->mMemory ); }
+
+  void * allocate( const size_t byteCount, const size_t alignment = alignof( max_align_t ) )
+  { return this->mMemory.allocate( byteCount, alignment ); }
+
+  // makes a T in the arena, release will destroy it
+  template< class T, class... Args >
+  T * make( Args &&... args )
+  {
+    T * p = new( this->allocate( sizeof( T ), alignof( T ) ) ) T( std::forward< Args >( args )... );
+    this->mObjects.push_back( make_pair( (void *)p, &DBPF_arenaType::destroy< T > ) );
+    return p;
+  }
+
+  // destroys what make made, newest first, then frees all the memory, the arena can be used again
+  void release();
+
+private:
+  template< class T >
+  static void destroy( void * p ) { static_cast< T * >( p )->~T(); }
+
+  DBPF_arenaType( const DBPF_arenaType & );              // no copies
+  DBPF_arenaType & operator=( const DBPF_arenaType & );
+
+  pmr::monotonic_buffer_resource mMemory;
+  vector< pair< void *, void (*)( void * ) > > mObjects;
+};
+
+
+// arena's memory resource, or the default (new/delete) one if there's no arena
+inline pmr::memory_resource * dbpfMemoryResource( DBPF_arenaType * pArena )
+{
+  return ( NULL == pArena ) ? pmr::get_default_resource() : pArena->getMemoryResource();
+}
+
+
+// new T( args ), in the arena if there is one, delete it with dbpfDelete and the same arena
+template< class T, class... Args >
+T * dbpfNew( DBPF_arenaType * pArena, Args &&... args )
+{
+  if( NULL == pArena )
+    return new T( std::forward< Args >( args )... );
+  return new( pArena->allocate( sizeof( T ), alignof( T ) ) ) T( std::forward< Args >( args )... );
+}
+
+template< class T >
+void dbpfDelete( DBPF_arenaType * pArena, T * p )
+{
+  if( NULL == p )
+    return;
+  if( NULL == pArena )
+    delete p;
+  else
+    p->~T(); // the memory goes with the arena
+}
+
+
+// byte arrays, new unsigned char[] without an arena
+inline unsigned char * dbpfNewBytes( DBPF_arenaType * pArena, const size_t byteCount )
+{
+  if( NULL == pArena )
+    return new unsigned char[ byteCount ];
+  return (unsigned char *)( pArena->allocate( byteCount, 1 ) );
+}
+
+inline void dbpfDeleteBytes( DBPF_arenaType * pArena, unsigned char * bytes )
+{
+  if( NULL == pArena )
+    delete [] bytes;
+}
+
+
+// DBPF_ARENA_H_CATOFEVILGENIUS
+#endif
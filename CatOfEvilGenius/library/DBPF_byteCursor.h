@@ -0,0 +1,190 @@
+/**
+ * file: DBPF_byteCursor.h
+ * author: CatOfEvilGenius
+ *
+ * DBPF_byteLoadType - fixed width integer loads and stores, little or big endian
+ * DBPF_byteCursorType - reads through a byte array, checked against its end
+ *
+ * Header only, so decoders get single loads (plus a byte swap where the order differs
+ * from the machine's) instead of a call and a loop per integer.
+**/
+
+#ifndef DBPF_BYTE_CURSOR_H_CATOFEVILGENIUS
+#define DBPF_BYTE_CURSOR_H_CATOFEVILGENIUS
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+using namespace std;
+
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#define DBPF_BSWAP16( x ) _byteswap_ushort( x )
+#define DBPF_BSWAP32( x ) _byteswap_ulong( x )
+#define DBPF_HOST_BIG_ENDIAN false
+#else
+#define DBPF_BSWAP16( x ) __builtin_bswap16( x )
+#define DBPF_BSWAP32( x ) __builtin_bswap32( x )
+#define DBPF_HOST_BIG_ENDIAN ( __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ )
+#endif
+
+
+/**
+<pre>
+ * load / store an unsigned integer of Width bytes (1 to 4)
+ * bBigEndian false - least significant byte first, as DBPF files are
+ * bBigEndian true  - most significant byte first, only the compression header uses that
+</pre>
+**/
+template< unsigned int Width, bool bBigEndian > class DBPF_byteLoadType;
+
+template< bool bBigEndian >
+class DBPF_byteLoadType< 1, bBigEndian >
+{
+public:
+  static unsigned int load( const unsigned char * p ) { return p[0]; }
+  static void store( unsigned char * p, const unsigned int u ) { p[0] = (unsigned char)u; }
+};
+
+template< bool bBigEndian >
+class DBPF_byteLoadType< 2, bBigEndian >
+{
+public:
+  static unsigned int load( const unsigned char * p )
+  { unsigned short u;
+    memcpy( &u, p, 2 );
+    if( bBigEndian != DBPF_HOST_BIG_ENDIAN )
+      u = DBPF_BSWAP16( u );
+    return u;
+  }
+  static void store( unsigned char * p, const unsigned int _u )
+  { unsigned short u = (unsigned short)_u;
+    if( bBigEndian != DBPF_HOST_BIG_ENDIAN )
+      u = DBPF_BSWAP16( u );
+    memcpy( p, &u, 2 );
+  }
+};
+
+// no 3 byte loads, put it together a byte at a time
+template< bool bBigEndian >
+class DBPF_byteLoadType< 3, bBigEndian >
+{
+public:
+  static unsigned int load( const unsigned char * p )
+  { if( bBigEndian )
+      return ( (unsigned int)p[0] << 16 ) | ( (unsigned int)p[1] << 8 ) | p[2];
+    return ( (unsigned int)p[2] << 16 ) | ( (unsigned int)p[1] << 8 ) | p[0];
+  }
+  static void store( unsigned char * p, const unsigned int u )
+  { p[ bBigEndian ? 0 : 2 ] = (unsigned char)( u >> 16 );
+    p[1] = (unsigned char)( u >> 8 );
+    p[ bBigEndian ? 2 : 0 ] = (unsigned char)u;
+  }
+};
+
+template< bool bBigEndian >
+class DBPF_byteLoadType< 4, bBigEndian >
+{
+public:
+  static unsigned int load( const unsigned char * p )
+  { unsigned int u;
+    memcpy( &u, p, 4 );
+    if( bBigEndian != DBPF_HOST_BIG_ENDIAN )
+      u = DBPF_BSWAP32( u );
+    return u;
+  }
+  static void store( unsigned char * p, unsigned int u )
+  { if( bBigEndian != DBPF_HOST_BIG_ENDIAN )
+      u = DBPF_BSWAP32( u );
+    memcpy( p, &u, 4 );
+  }
+};
+
+
+/**
+<pre>
+ * Reads through bytes begin ... end-1, little endian.
+ *
+ * A read past the end doesn't read anything: it gives 0 (or an empty string),
+ * leaves the cursor at the end, and ok() is false from then on.
+ * So a decoder can read a whole block and check ok() once, before it trusts what it read.
+ * Strings are views into the bytes, they last as long as the bytes do.
+</pre>
+**/
+class DBPF_byteCursorType
+{
+public:
+  DBPF_byteCursorType( const unsigned char * begin, const unsigned char * end )
+    : mpBegin( begin ), mpPos( begin ), mpEnd( end ), mbOK( NULL != begin ) {}
+  DBPF_byteCursorType( const unsigned char * begin, const size_t byteCount )
+    : mpBegin( begin ), mpPos( begin ), mpEnd( begin + byteCount ), mbOK( NULL != begin ) {}
+
+  bool ok() const { return this->mbOK; }
+  void fail() { this->mbOK = false; this->mpPos = this->mpEnd; }
+
+  const unsigned char * begin() const { return this->mpBegin; }
+  const unsigned char * pos() const { return this->mpPos; }
+  const unsigned char * end() const { return this->mpEnd; }
+  size_t offset() const { return (size_t)( this->mpPos - this->mpBegin ); } // bytes read so far
+  size_t left() const { return (size_t)( this->mpEnd - this->mpPos ); }
+
+  bool skip( const size_t n ) { return this->take( n ); }
+
+  template< unsigned int Width, bool bBigEndian = false >
+  unsigned int readUint()
+  { return this->take( Width ) ? DBPF_byteLoadType< Width, bBigEndian >::load( this->mpPos - Width ) : 0; }
+
+  unsigned char readUint8()   { return (unsigned char)( this->readUint< 1 >() ); }
+  unsigned short readUint16() { return (unsigned short)( this->readUint< 2 >() ); }
+  unsigned int readUint32()   { return this->readUint< 4 >(); }
+
+  // IEEE float, least significant byte first (CPF floats)
+  float readFloat()
+  { unsigned int u = this->readUint32();
+    float f;
+    memcpy( &f, &u, 4 );
+    return f;
+  }
+
+  string_view readChars( const size_t n )
+  { return this->take( n ) ? string_view( (const char *)( this->mpPos - n ), n ) : string_view(); }
+
+  // 1 byte length, then characters
+  string_view readStr8() { size_t n = this->readUint8(); return this->readChars( n ); }
+  // 4 byte length, then characters
+  string_view readStr32() { size_t n = this->readUint32(); return this->readChars( n ); }
+
+  // characters up to a null, the null is read too
+  string_view readStrNull()
+  { const void * pNull = this->mbOK ? memchr( this->mpPos, 0, this->left() ) : NULL;
+    if( NULL == pNull )
+    { this->fail();
+      return string_view();
+    }
+    size_t n = (size_t)( (const unsigned char *)pNull - this->mpPos );
+    string_view str( (const char *)( this->mpPos ), n );
+    this->mpPos += n + 1;
+    return str;
+  }
+
+private:
+  bool take( const size_t n )
+  { if( this->mbOK && this->left() >= n )
+    { this->mpPos += n;
+      return true;
+    }
+    this->fail();
+    return false;
+  }
+
+  const unsigned char * mpBegin;
+  const unsigned char * mpPos;
+  const unsigned char * mpEnd;
+  bool mbOK;
+};
+
+
+// DBPF_BYTE_CURSOR_H_CATOFEVILGENIUS
+#endif
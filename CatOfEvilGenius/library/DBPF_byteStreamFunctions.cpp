@@ -9,9 +9,27 @@
 #include <cstdio>
 #include <string>
 #include <cstring>
+#include <vector>
+#include "DBPF_byteCursor.h"
 
 using namespace std;
 
+
+// byteCount known only at run time, one fixed width load per case
+template< bool bBigEndian >
+static unsigned int loadUint( const unsigned char * bytes, const unsigned int byteCount )
+{
+  switch( byteCount )
+  {
+    case 1: return DBPF_byteLoadType< 1, bBigEndian >::load( bytes );
+    case 2: return DBPF_byteLoadType< 2, bBigEndian >::load( bytes );
+    case 3: return DBPF_byteLoadType< 3, bBigEndian >::load( bytes );
+    case 4: return DBPF_byteLoadType< 4, bBigEndian >::load( bytes );
+  }
+  return 0;
+}
+
+
 /**
 <pre>
  * input:   bytes - array of bytes, length 1 to 4
@@ -26,14 +44,7 @@ using namespace std;
 **/
 void bytes2uintBigEndian( const unsigned char * bytes, const unsigned int byteCount, unsigned int & foo )
 {
-  foo = 0;
-  foo += bytes[0];
-
-  for( unsigned int i = 1; i < byteCount; ++i )
-  {
-    foo = foo << 8;
-    foo += bytes[i];
-  }
+  foo = loadUint< true >( bytes, byteCount );
 }
 
 
@@ -50,13 +61,7 @@ void bytes2uintBigEndian( const unsigned char * bytes, const unsigned int byteCo
 **/
 void uint2bytesBigEndian( const unsigned int _foo, unsigned char * bytes )
 {
-  unsigned int foo = _foo;
-  unsigned int mask = 0x000000FF;
-
-  bytes[3] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[2] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[1] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[0] = (unsigned char)(foo & mask);
+  DBPF_byteLoadType< 4, true >::store( bytes, _foo );
 }
 
 
@@ -81,15 +86,7 @@ void uint2bytesBigEndian( const unsigned int _foo, unsigned char * bytes )
 **/
 void bytes2uint( const unsigned char * bytes, const unsigned int byteCount, unsigned int & foo )
 {
-  foo = 0;
-
-  unsigned int i = byteCount-1;
-  for( unsigned int k = 0; k < byteCount; ++k )
-  {
-    foo = foo << 8;
-    foo += bytes[i];
-    --i;
-  }
+  foo = loadUint< false >( bytes, byteCount );
 }
 
 
@@ -106,13 +103,7 @@ void bytes2uint( const unsigned char * bytes, const unsigned int byteCount, unsi
 **/
 void uint2bytes( const unsigned int _foo, unsigned char * bytes )
 {
-  unsigned int foo = _foo;
-  unsigned int mask = 0x000000FF;
-
-  bytes[0] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[1] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[2] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[3] = (unsigned char)(foo & mask);
+  DBPF_byteLoadType< 4, false >::store( bytes, _foo );
 }
 
 
@@ -128,10 +119,7 @@ void uint2bytes( const unsigned int _foo, unsigned char * bytes )
 **/
 void bytes2ushort( const unsigned char * bytes, unsigned short & foo )
 {
-  foo = 0;
-
-  foo += bytes[1];  foo = foo << 8;
-  foo += bytes[0];
+  foo = (unsigned short)( DBPF_byteLoadType< 2, false >::load( bytes ) );
 }
 
 
@@ -148,69 +136,41 @@ void bytes2ushort( const unsigned char * bytes, unsigned short & foo )
 **/
 void ushort2bytes( const unsigned short _foo, unsigned char * bytes )
 {
-  unsigned short foo = _foo;
-  unsigned short mask = 0x00FF;
-
-  bytes[0] = (unsigned char)(foo & mask);  foo = foo >> 8;
-  bytes[1] = (unsigned char)(foo & mask);
+  DBPF_byteLoadType< 2, false >::store( bytes, _foo );
 }
 
 
-// least significant byte first
+// The float names are the wrong way round, and always were:
+// bytes2float reads the most significant byte first, bytes2floatBigEndian the least
+// (CPF floats, which are least significant byte first, use the "BigEndian" ones).
+// They used to copy or reverse bytes in machine order, these give what they gave on x86 on any machine.
 void bytes2float( const unsigned char * bytes, float & foo )
 {
-  float bar = 0;
-  unsigned char tmp[4];
-
-  tmp[0] = bytes[3];
-  tmp[1] = bytes[2];
-  tmp[2] = bytes[1];
-  tmp[3] = bytes[0];
-
-  memcpy( &bar, tmp, 4 );
-  foo = bar;
+  unsigned int u = DBPF_byteLoadType< 4, true >::load( bytes );
+  memcpy( &foo, &u, 4 );
 }
 
 
 void bytes2floatBigEndian( const unsigned char * bytes, float & foo )
 {
-  float bar = 0;
-  unsigned char tmp[4];
-
-  tmp[0] = bytes[0];
-  tmp[1] = bytes[1];
-  tmp[2] = bytes[2];
-  tmp[3] = bytes[3];
-
-  memcpy( &bar, tmp, 4 );
-  foo = bar;
+  unsigned int u = DBPF_byteLoadType< 4, false >::load( bytes );
+  memcpy( &foo, &u, 4 );
 }
 
 
-// least significant byte first
-void float2bytes( const float _foo, unsigned char * bytes )
+void float2bytes( const float foo, unsigned char * bytes )
 {
-  float foo = _foo;
-  unsigned char tmp[4];
-  memcpy( tmp, &foo, 4 );
-
-  bytes[0] = tmp[3];
-  bytes[1] = tmp[2];
-  bytes[2] = tmp[1];
-  bytes[3] = tmp[0];
+  unsigned int u;
+  memcpy( &u, &foo, 4 );
+  DBPF_byteLoadType< 4, true >::store( bytes, u );
 }
 
 
-void float2bytesBigEndian( const float _foo, unsigned char * bytes )
+void float2bytesBigEndian( const float foo, unsigned char * bytes )
 {
-  float foo = _foo;
-  unsigned char tmp[4];
-  memcpy( tmp, &foo, 4 );
-
-  bytes[0] = tmp[0];
-  bytes[1] = tmp[1];
-  bytes[2] = tmp[2];
-  bytes[3] = tmp[3];
+  unsigned int u;
+  memcpy( &u, &foo, 4 );
+  DBPF_byteLoadType< 4, false >::store( bytes, u );
 }
 
 
@@ -352,7 +312,7 @@ void readByteStream_str2( unsigned char * & bytes, unsigned int & strLength, cha
   strLength = foo;
 
   // read string characters
-  for( unsigned char i = 0; i < strLength; ++i )
+  for( unsigned int i = 0; i < strLength; ++i )
     str[i] = bytes[i];
 
   str[ strLength ] = '\0';
@@ -384,16 +344,11 @@ void readByteStream_strNullTerminated( unsigned char * & bytes, string & str )
     ++length;
   }
 
-  // copy string text and null at end
-  static char strArray[1024];
-  strArray[0] = '\0';
-  if( length > 0 )
-    memcpy( strArray, bytes, length );
+  // copy string text (at most 1023 characters, same as a 1024 array with the null)
   if( length < 1024 )
-    strArray[length] = '\0';
+    str.assign( (const char *)bytes, length );
   else
-    strArray[1023] = '\0';
-  str.assign( strArray );
+    str.assign( (const char *)bytes, 1023 );
 
   // advance bytes pointer
   if( length < 1024 )
@@ -468,7 +423,7 @@ void writeByteStream_str2( unsigned char * & bytes, const char * str )
   writeByteStream_uint( bytes, strLength );
 
   // write string characters
-  for( unsigned char i = 0; i < strLength; ++i )
+  for( unsigned int i = 0; i < strLength; ++i )
     bytes[i] = str[i];
 
   // advance byte steam pointer
@@ -546,3 +501,77 @@ void writeByteStream_cSGResource( unsigned char * & bytes, const string & str )
   unsigned char strLength = (unsigned char)(strlen( _str ));
   writeByteStream_cSGResource( bytes, strLength, _str );
 }
+
+
+// -------------------------------------------------------------------------
+// index files
+
+bool readIndexUint( const unsigned char * & p, const unsigned char * end, unsigned int & u )
+{
+  if( end - p < 4 )
+    return false;
+  bytes2uint( p, 4, u );
+  p += 4;
+  return true;
+}
+
+bool readIndexUint64( const unsigned char * & p, const unsigned char * end, unsigned long long & u )
+{
+  unsigned int lo = 0, hi = 0;
+  if( false == readIndexUint( p, end, lo ) || false == readIndexUint( p, end, hi ) )
+    return false;
+  u = ( (unsigned long long)hi << 32 ) | lo;
+  return true;
+}
+
+bool readIndexString( const unsigned char * & p, const unsigned char * end, string & str )
+{
+  unsigned int length = 0;
+  if( false == readIndexUint( p, end, length ) || (size_t)( end - p ) < length )
+    return false;
+  str.assign( (const char *)p, length );
+  p += length;
+  return true;
+}
+
+bool readIndexColumn( const unsigned char * & p, const unsigned char * end,
+                      vector< unsigned int > & column, const unsigned int rowCount )
+{
+  if( (size_t)( end - p ) / 4 < rowCount )
+    return false;
+  column.resize( rowCount );
+  for( unsigned int i = 0; i < rowCount; ++i )
+    bytes2uint( p + 4 * i, 4, column[i] );
+  p += 4 * (size_t)rowCount;
+  return true;
+}
+
+
+void writeIndexUint64( vector< unsigned char > & bytes, const unsigned long long u )
+{
+  unsigned char b[8];
+  uint2bytes( (unsigned int)( u & 0xFFFFFFFF ), b );
+  uint2bytes( (unsigned int)( u >> 32 ), b + 4 );
+  bytes.insert( bytes.end(), b, b + 8 );
+}
+
+void writeIndexUint( vector< unsigned char > & bytes, const unsigned int u )
+{
+  unsigned char b[4];
+  uint2bytes( u, b );
+  bytes.insert( bytes.end(), b, b + 4 );
+}
+
+void writeIndexString( vector< unsigned char > & bytes, const string & str )
+{
+  writeIndexUint( bytes, (unsigned int)( str.size() ) );
+  bytes.insert( bytes.end(), str.begin(), str.end() );
+}
+
+void writeIndexColumn( vector< unsigned char > & bytes, const vector< unsigned int > & column )
+{
+  size_t at = bytes.size();
+  bytes.resize( at + 4 * column.size() );
+  for( size_t i = 0; i < column.size(); ++i )
+    uint2bytes( column[i], &bytes[at + 4 * i] );
+}
@@ -9,6 +9,7 @@
 #define DBPF_BYTE_STREAM_H_CATOFEVILGENIUS
 
 #include <string>
+#include <vector>
 using namespace std;
 
 
@@ -27,10 +28,10 @@ void ushort2bytes( const unsigned short foo, unsigned char * bytes );
 // least significant byte first
 void bytes2ushort( const unsigned char * bytes, unsigned short & foo );
 
-// least significant byte first
+// the names are backwards: the plain ones are most significant byte first,
+// the "BigEndian" ones least significant byte first (CPF uses those)
 void float2bytes( const float foo, unsigned char * bytes );
 void float2bytesBigEndian( const float foo, unsigned char * bytes );
-// least significant byte first
 void bytes2float( const unsigned char * bytes, float & foo );
 void bytes2floatBigEndian( const unsigned char * bytes, float & foo );
 
@@ -58,7 +59,8 @@ void writeByteStream_str( unsigned char * & bytes, const unsigned char strLength
 // writes string class object to byte stream, advanced bytes
 void writeByteStream_str( unsigned char * & bytes, const string & str );
 
-// read string from byte stream, advanced by bytes by string size, and length at start, 1 unsigned int (4 bytes)
+// read string from byte stream, advanced by bytes by string size, and length at start, 1 unsigned int (4 bytes),
+// str must have room for the string and a null, the length can be more than 255
 void readByteStream_str2( unsigned char * & bytes, unsigned int & strLength, char * str );
 // write string to byte stream, advanced by bytes by string size, and length at start, 1 unsigned int (4 bytes)
 void writeByteStream_str2( unsigned char * & bytes, const char * str );
@@ -77,5 +79,18 @@ void writeByteStream_cSGResource( unsigned char * & bytes, const unsigned char s
 void writeByteStream_cSGResource( unsigned char * & bytes, const string & str );
 
 
+// index files (DBPF_propertyIndex, DBPF_nameIndex), least significant byte first,
+// the reads check against end, and return false instead of reading past it
+bool readIndexUint(   const unsigned char * & p, const unsigned char * end, unsigned int & u );
+bool readIndexUint64( const unsigned char * & p, const unsigned char * end, unsigned long long & u );
+bool readIndexString( const unsigned char * & p, const unsigned char * end, string & str ); // uint length first
+bool readIndexColumn( const unsigned char * & p, const unsigned char * end,
+                      vector< unsigned int > & column, const unsigned int rowCount );
+void writeIndexUint(   vector< unsigned char > & bytes, const unsigned int u );
+void writeIndexUint64( vector< unsigned char > & bytes, const unsigned long long u );
+void writeIndexString( vector< unsigned char > & bytes, const string & str );
+void writeIndexColumn( vector< unsigned char > & bytes, const vector< unsigned int > & column );
+
+
 // DBPF_BYTE_STREAM_H_CATOFEVILGENIUS
 #endif
@@ -0,0 +1,628 @@
+/**
+ * file: DBPF_nameIndex.cpp
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_nameIndexType - names and text of every resource in a directory tree,
+ *                            searchable by substring or prefix, and saved to a file
+**/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "DBPF_nameIndex.h"
+#include "DBPF.h"
+#include "DBPF_CPF.h"
+#include "DBPF_typeRegistry.h"
+#include "DBPF_byteStreamFunctions.h"
+#include "DBPF_byteCursor.h"
+#include "../../benrq/dbpf.h"
+
+
+// CPF resources, their "name" property is indexed
+static const unsigned int gCPFTypes[] = { DBPF_GZPS, DBPF_XHTN, DBPF_XTOL, DBPF_BINX, DBPF_XOBJ };
+
+// RCOL resources, the cSGResource name of their first block is indexed
+static const unsigned int gRCOLTypes[] = {
+  DBPF_TXMT, DBPF_TXTR, DBPF_GMDC, DBPF_GMND, DBPF_SHPE, DBPF_CRES, DBPF_ANIM, DBPF_LIFO
+};
+
+// resources in STR# format, their text is indexed
+static const unsigned int gTextTypes[] = { DBPF_STR, DBPF_CATS, DBPF_CTSS, DBPF_TTAs };
+
+// file starts with this
+static const char gIndexMagic[8] = { 'D', 'B', 'P', 'F', 'N', 'I', 'D', 'X' };
+
+
+template< size_t N >
+static bool isOneOf( const unsigned int (&types)[N], const unsigned int type )
+{
+  for( size_t i = 0; i < N; ++i )
+    if( types[i] == type )
+      return true;
+  return false;
+}
+
+
+static void foldCase( string & str, const size_t from )
+{
+  for( size_t i = from; i < str.size(); ++i )
+    str[i] = (char)tolower( (unsigned char)str[i] );
+}
+
+
+/**
+<pre>
+ * in/out:  bytes - RCOL resource bytes
+ * returns: cSGResource name of the first block, in the bytes,
+ *          empty if the bytes don't look like an RCOL with a cSGResource
+ *
+ * purpose: the same walk as DBPF_RCOLtype and DBPF_TXMTtype, without keeping anything
+ *          (RCOL header, block name, block ID, block version, cSGResource)
+</pre>
+**/
+static string_view readRCOLname( DBPF_byteCursorType & bytes )
+{
+  size_t linkSize = 12;
+  const unsigned char * p = bytes.pos();
+  if( bytes.left() >= 4 && 1 == p[0] && 0 == p[1] && 0xFF == p[2] && 0xFF == p[3] )
+  { linkSize = 16;
+    bytes.skip( 4 );
+  }
+
+  bytes.skip( linkSize * bytes.readUint32() );
+  bytes.skip( 4 * (size_t)bytes.readUint32() );
+
+  // block name, block ID, block version
+  bytes.readStr8();
+  bytes.skip( 8 );
+
+  // cSGResource, 0, 2
+  if( "cSGResource" != bytes.readStr8() )
+    return string_view();
+  bytes.skip( 8 );
+
+  return bytes.readStr8();
+}
+
+
+// -------------------------------------------------------------------------
+
+
+void DBPF_nameIndexType::clear()
+{
+  this->mPackages.clear();
+  this->mRowPackage.clear();
+  this->mRowType.clear();
+  this->mRowGroup.clear();
+  this->mRowInstance.clear();
+  this->mRowInstance2.clear();
+  this->mRowSource.clear();
+  this->mRowItem.clear();
+  this->mRowName.clear();
+  this->mText.clear();
+  this->mFoldedText.clear();
+  this->mSortedRows.clear();
+  this->muScannedPackages = 0;
+}
+
+
+void DBPF_nameIndexType::addRow( const unsigned int package, const DBPF_TGIRtype & tgir, const int source,
+                                 const unsigned int item, const char * name, const size_t length )
+{
+  this->mRowPackage.push_back( package );
+  this->mRowType.push_back( tgir.muTypeID );
+  this->mRowGroup.push_back( tgir.muGroupID );
+  this->mRowInstance.push_back( tgir.muInstanceID );
+  this->mRowInstance2.push_back( tgir.muResourceID );
+  this->mRowSource.push_back( (unsigned int)source );
+  this->mRowItem.push_back( item );
+  this->mRowName.push_back( (unsigned int)( this->mText.size() ) );
+
+  const size_t from = this->mText.size();
+  this->mText.append( name, length );
+  this->mText.push_back( '\0' );
+  this->mFoldedText.append( this->mText, from, string::npos );
+  foldCase( this->mFoldedText, from );
+}
+
+
+// drop rows from rowCount on, with their names
+void DBPF_nameIndexType::truncateRows( const unsigned int rowCount )
+{
+  if( rowCount >= this->getRowCount() )
+    return;
+
+  const size_t textSize = this->mRowName[rowCount];
+  this->mRowPackage.resize( rowCount );
+  this->mRowType.resize( rowCount );
+  this->mRowGroup.resize( rowCount );
+  this->mRowInstance.resize( rowCount );
+  this->mRowInstance2.resize( rowCount );
+  this->mRowSource.resize( rowCount );
+  this->mRowItem.resize( rowCount );
+  this->mRowName.resize( rowCount );
+  this->mText.resize( textSize );
+  this->mFoldedText.resize( textSize );
+}
+
+
+// rows by lowercase name, for findPrefix
+struct lessFoldedName
+{
+  const char * mpText;
+  const vector< unsigned int > & mRowName;
+  lessFoldedName( const char * pText, const vector< unsigned int > & rowName ) : mpText( pText ), mRowName( rowName ) {}
+  bool operator()( const unsigned int a, const unsigned int b ) const
+  { return( strcmp( mpText + mRowName[a], mpText + mRowName[b] ) < 0 ); }
+};
+
+
+void DBPF_nameIndexType::sortRows()
+{
+  this->mSortedRows.resize( this->getRowCount() );
+  for( unsigned int row = 0; row < this->getRowCount(); ++row )
+    this->mSortedRows[row] = row;
+
+  stable_sort( this->mSortedRows.begin(), this->mSortedRows.end(),
+               lessFoldedName( this->mFoldedText.c_str(), this->mRowName ) );
+}
+
+
+/**
+<pre>
+ * input:   dirName - directory to index, such as a Downloads folder
+ * returns: success / failure
+ *
+ * purpose: bring the index up to date with the packages under dirName,
+ *          new and changed packages are read, rows of unchanged ones are kept,
+ *          packages that are gone are dropped.
+ *          Files that are not valid packages are skipped with a warning.
+</pre>
+**/
+bool DBPF_nameIndexType::update( const char * dirName )
+{
+  vector< string > fileNames;
+  if( false == listPackageFiles( dirName, fileNames ) )
+    return false;
+
+  // build a new index, copying rows over from this one where we can,
+  // so packages stay in load order and names of dropped packages go away
+
+  DBPF_nameIndexType old;
+  old.mPackages.swap( this->mPackages );
+  old.mRowPackage.swap( this->mRowPackage );
+  old.mRowType.swap( this->mRowType );
+  old.mRowGroup.swap( this->mRowGroup );
+  old.mRowInstance.swap( this->mRowInstance );
+  old.mRowInstance2.swap( this->mRowInstance2 );
+  old.mRowSource.swap( this->mRowSource );
+  old.mRowItem.swap( this->mRowItem );
+  old.mRowName.swap( this->mRowName );
+  old.mText.swap( this->mText );
+  this->clear();
+
+  unordered_map< string, unsigned int > oldPackages;
+  for( size_t k = 0; k < old.mPackages.size(); ++k )
+    oldPackages[ old.mPackages[k].mstrFileName ] = (unsigned int)k;
+
+  for( size_t i = 0; i < fileNames.size(); ++i )
+  {
+    unsigned long long fileSize = 0;
+    long long modTime = 0;
+    if( false == getPackageFileStamp( fileNames[i].c_str(), fileSize, modTime ) )
+    { fprintf( stderr, "WARNING: DBPF_nameIndexType.update, skipping %s\n", fileNames[i].c_str() );
+      continue;
+    }
+
+    unordered_map< string, unsigned int >::const_iterator it = oldPackages.find( fileNames[i] );
+    if( it != oldPackages.end()
+     && old.mPackages[it->second].muFileSize == fileSize
+     && old.mPackages[it->second].miModTime == modTime )
+    {
+      this->copyRows( old, old.mPackages[it->second] );
+      continue;
+    }
+
+    DBPF_nameIndexPackageType package;
+    package.mstrFileName = fileNames[i];
+    package.muFileSize = fileSize;
+    package.miModTime = modTime;
+    package.muFirstRow = this->getRowCount();
+    package.muRowCount = 0;
+    this->mPackages.push_back( package );
+
+    if( false == this->scanPackage( fileNames[i].c_str() ) )
+    { fprintf( stderr, "WARNING: DBPF_nameIndexType.update, skipping %s\n", fileNames[i].c_str() );
+
+      // drop the rows it got before it failed
+      this->truncateRows( this->mPackages.back().muFirstRow );
+      this->mPackages.pop_back();
+      continue;
+    }
+    ++this->muScannedPackages;
+  }
+
+  this->sortRows();
+  return true;
+}
+
+
+// append the rows of one package of another index
+void DBPF_nameIndexType::copyRows( const DBPF_nameIndexType & from, const DBPF_nameIndexPackageType & package )
+{
+  DBPF_nameIndexPackageType copy = package;
+  copy.muFirstRow = this->getRowCount();
+  unsigned int packageNumber = (unsigned int)( this->mPackages.size() );
+  this->mPackages.push_back( copy );
+
+  DBPF_TGIRtype tgir;
+  const unsigned int first = package.muFirstRow, last = package.muFirstRow + package.muRowCount;
+  for( unsigned int row = first; row < last; ++row )
+  {
+    tgir.muTypeID = from.mRowType[row];
+    tgir.muGroupID = from.mRowGroup[row];
+    tgir.muInstanceID = from.mRowInstance[row];
+    tgir.muResourceID = from.mRowInstance2[row];
+    const char * name = from.getName( row );
+    this->addRow( packageNumber, tgir, (int)( from.mRowSource[row] ), from.mRowItem[row], name, strlen( name ) );
+  }
+}
+
+
+/**
+<pre>
+ * add rows for the names in one package, the package is the last one in mPackages
+ *
+ * Read with benrq's library, which can stop decompressing after 64 bytes, and reads
+ * nothing at all of types that have no name.  A resource whose name can't be found
+ * (XML CPF, an RCOL that isn't, another STR# format) just gets no row, a package that
+ * can't be read fails.
+</pre>
+**/
+bool DBPF_nameIndexType::scanPackage( const char * fileName )
+{
+  const char * error = NULL;
+  DBPF * dbpf = dbpf_open_mmap( fileName, &error );
+  if( NULL == dbpf )
+  { fprintf( stderr, "ERROR: DBPF_nameIndexType.update, %s: %s\n", fileName, error );
+    return false;
+  }
+
+  const unsigned int packageNumber = (unsigned int)( this->mPackages.size() - 1 );
+  const unsigned int firstRow = this->getRowCount();
+
+  DBPF_CPFfieldType nameField( "name" );
+  vector< unsigned char > bytes;
+  unordered_set< string_view > texts;
+  DBPF_TGIRtype tgir;
+  bool bOK = true;
+
+  const int entryCount = dbpf_get_entry_count( dbpf );
+  const dbpf_entry * entries = dbpf_get_entries( dbpf );
+  for( int k = 0; bOK && k < entryCount; ++k )
+  {
+    const dbpf_entry & e = entries[k];
+    const DBPF_typeInfoType * pInfo = dbpfFindTypeInfo( e.type_id );
+    const bool bFileName = ( NULL != pInfo && pInfo->mbEmbeddedFilename );
+    const bool bCPF = isOneOf( gCPFTypes, e.type_id );
+    const bool bRCOL = isOneOf( gRCOLTypes, e.type_id );
+    const bool bText = isOneOf( gTextTypes, e.type_id );
+    if( false == ( bFileName || bCPF || bRCOL || bText ) )
+      continue;
+
+    tgir.muTypeID = e.type_id;
+    tgir.muGroupID = e.group_id;
+    tgir.muInstanceID = e.instance_id;
+    tgir.muResourceID = e.instance_id_2;
+
+    // only the file name?  read 64 bytes
+    if( bFileName && false == bText )
+    {
+      if( e.size < 64 )
+        continue;
+      unsigned char prefix[64];
+      if( dbpf_read_64bytes( dbpf, k, prefix, &error ) < 0 )
+      { bOK = false;
+        break;
+      }
+      size_t length = strnlen( (const char *)prefix, 64 );
+      if( length > 0 )
+        this->addRow( packageNumber, tgir, NAME_FILENAME, 0, (const char *)prefix, length );
+      continue;
+    }
+
+    bytes.resize( e.size > 0 ? e.size : 1 );
+    if( dbpf_read( dbpf, k, &bytes[0], &error ) < 0 )
+    { bOK = false;
+      break;
+    }
+    const unsigned char * data = &bytes[0];
+    DBPF_byteCursorType cursor( data, (size_t)( e.size ) );
+
+    if( bCPF )
+    {
+      if( DBPF_CPFextract( data, (unsigned int)( e.size ), &nameField, 1 )
+       && nameField.mbFound && CPF_STRING == nameField.miType && false == nameField.mstrValue.empty() )
+        this->addRow( packageNumber, tgir, NAME_CPF, 0, nameField.mstrValue.data(), nameField.mstrValue.size() );
+    }
+    else if( bRCOL )
+    {
+      string_view name = readRCOLname( cursor );
+      if( cursor.ok() && false == name.empty() )
+        this->addRow( packageNumber, tgir, NAME_RCOL, 0, name.data(), name.size() );
+    }
+    else if( e.size >= 68 )
+    {
+      // STR# format: file name (64 bytes), format code, item count,
+      // items of language code, value text, description text, both null terminated
+      if( bFileName )
+      { size_t length = strnlen( (const char *)data, 64 );
+        if( length > 0 )
+          this->addRow( packageNumber, tgir, NAME_FILENAME, 0, (const char *)data, length );
+      }
+
+      cursor.skip( 64 );
+      unsigned int formatCode = cursor.readUint16();
+      unsigned int itemCount = cursor.readUint16();
+      if( 0xFFFD != formatCode )
+        continue;
+
+      texts.clear();
+      for( unsigned int i = 0; i < itemCount; ++i )
+      {
+        cursor.readUint8();
+        string_view text = cursor.readStrNull();
+        if( false == cursor.ok() )
+          break;
+        cursor.readStrNull(); // description
+
+        // each language has its own copy, often the same text
+        if( false == text.empty() && texts.insert( text ).second )
+          this->addRow( packageNumber, tgir, NAME_TEXT, i, text.data(), text.size() );
+      }
+    }
+  }
+
+  if( false == bOK )
+    fprintf( stderr, "ERROR: DBPF_nameIndexType.update, %s: %s\n", fileName, error );
+
+  dbpf_close( dbpf );
+
+  this->mPackages.back().muRowCount = this->getRowCount() - firstRow;
+  return bOK;
+}
+
+
+/**
+<pre>
+ * input:   fileName - index file to write
+ * returns: success / failure
+ *
+ * purpose: save the index, the file is replaced only after it is written completely
+</pre>
+**/
+bool DBPF_nameIndexType::save( const char * fileName ) const
+{
+  vector< unsigned char > bytes( gIndexMagic, gIndexMagic + 8 );
+  writeIndexUint( bytes, DBPF_NAME_INDEX_VERSION );
+
+  writeIndexUint( bytes, (unsigned int)( this->mPackages.size() ) );
+  for( size_t k = 0; k < this->mPackages.size(); ++k )
+  {
+    const DBPF_nameIndexPackageType & package = this->mPackages[k];
+    writeIndexString( bytes, package.mstrFileName );
+    writeIndexUint64( bytes, package.muFileSize );
+    writeIndexUint64( bytes, (unsigned long long)package.miModTime );
+    writeIndexUint( bytes, package.muFirstRow );
+    writeIndexUint( bytes, package.muRowCount );
+  }
+
+  writeIndexUint( bytes, this->getRowCount() );
+  writeIndexColumn( bytes, this->mRowPackage );
+  writeIndexColumn( bytes, this->mRowType );
+  writeIndexColumn( bytes, this->mRowGroup );
+  writeIndexColumn( bytes, this->mRowInstance );
+  writeIndexColumn( bytes, this->mRowInstance2 );
+  writeIndexColumn( bytes, this->mRowSource );
+  writeIndexColumn( bytes, this->mRowItem );
+  writeIndexColumn( bytes, this->mRowName );
+  writeIndexString( bytes, this->mText );
+
+  return writeIndexFile( fileName, bytes );
+}
+
+
+/**
+<pre>
+ * input:   fileName - index file written by save
+ * returns: true - index loaded
+ *          false - no such file, or it's from another version or broken,
+ *                  the index is empty, update will rebuild it
+ *
+ * purpose: load an index saved earlier
+</pre>
+**/
+bool DBPF_nameIndexType::load( const char * fileName )
+{
+  this->clear();
+
+  vector< unsigned char > bytes;
+  if( false == readIndexFile( fileName, bytes ) )
+    return false;
+
+  const unsigned char * p = bytes.empty() ? NULL : &bytes[0];
+  const unsigned char * end = p + bytes.size();
+
+  unsigned int version = 0, count = 0;
+  if( bytes.size() < 12 || 0 != memcmp( p, gIndexMagic, 8 ) )
+  { fprintf( stderr, "WARNING: DBPF_nameIndexType.load, %s is not a name index\n", fileName );
+    return false;
+  }
+  p += 8;
+  readIndexUint( p, end, version );
+  if( DBPF_NAME_INDEX_VERSION != version )
+  { fprintf( stderr, "WARNING: DBPF_nameIndexType.load, %s is version %u, expected %u\n",
+             fileName, version, DBPF_NAME_INDEX_VERSION );
+    return false;
+  }
+
+  bool bOK = readIndexUint( p, end, count ) && count <= (size_t)( end - p ) / 28;
+  if( bOK )
+    this->mPackages.resize( count );
+  for( size_t k = 0; bOK && k < this->mPackages.size(); ++k )
+  {
+    DBPF_nameIndexPackageType & package = this->mPackages[k];
+    unsigned long long modTime = 0;
+    bOK = readIndexString( p, end, package.mstrFileName )
+       && readIndexUint64( p, end, package.muFileSize )
+       && readIndexUint64( p, end, modTime )
+       && readIndexUint( p, end, package.muFirstRow )
+       && readIndexUint( p, end, package.muRowCount );
+    package.miModTime = (long long)modTime;
+  }
+
+  unsigned int rowCount = 0;
+  bOK = bOK && readIndexUint( p, end, rowCount )
+     && readIndexColumn( p, end, this->mRowPackage, rowCount )
+     && readIndexColumn( p, end, this->mRowType, rowCount )
+     && readIndexColumn( p, end, this->mRowGroup, rowCount )
+     && readIndexColumn( p, end, this->mRowInstance, rowCount )
+     && readIndexColumn( p, end, this->mRowInstance2, rowCount )
+     && readIndexColumn( p, end, this->mRowSource, rowCount )
+     && readIndexColumn( p, end, this->mRowItem, rowCount )
+     && readIndexColumn( p, end, this->mRowName, rowCount )
+     && readIndexString( p, end, this->mText );
+
+  // everything in range?  names must start in order, right after the null of the one before
+  for( size_t k = 0; bOK && k < this->mPackages.size(); ++k )
+    bOK = this->mPackages[k].muFirstRow <= rowCount
+       && this->mPackages[k].muRowCount <= rowCount - this->mPackages[k].muFirstRow;
+  for( unsigned int row = 0; bOK && row < rowCount; ++row )
+    bOK = this->mRowPackage[row] < this->mPackages.size()
+       && this->mRowSource[row] <= NAME_TEXT
+       && this->mRowName[row] < this->mText.size()
+       && ( 0 == row ? 0 == this->mRowName[row]
+                     : this->mRowName[row] > this->mRowName[row - 1] && '\0' == this->mText[this->mRowName[row] - 1] );
+  bOK = bOK && ( this->mText.empty() ? 0 == rowCount : '\0' == this->mText[this->mText.size() - 1] );
+
+  if( false == bOK )
+  { fprintf( stderr, "WARNING: DBPF_nameIndexType.load, %s is broken\n", fileName );
+    this->clear();
+    return false;
+  }
+
+  this->mFoldedText = this->mText;
+  foldCase( this->mFoldedText, 0 );
+  this->sortRows();
+  return true;
+}
+
+
+bool DBPF_nameIndexType::getRow( const unsigned int row, unsigned int & package, DBPF_TGIRtype & tgir,
+                                 int & source, unsigned int & item ) const
+{
+  if( row >= this->getRowCount() )
+  { fprintf( stderr, "ERROR: DBPF_nameIndexType.getRow, row out of bounds, is %u, must be < %u\n",
+             row, this->getRowCount() );
+    return false;
+  }
+
+  package = this->mRowPackage[row];
+  tgir.muTypeID = this->mRowType[row];
+  tgir.muGroupID = this->mRowGroup[row];
+  tgir.muInstanceID = this->mRowInstance[row];
+  tgir.muResourceID = this->mRowInstance2[row];
+  source = (int)( this->mRowSource[row] );
+  item = this->mRowItem[row];
+  return true;
+}
+
+
+const char * DBPF_nameIndexType::getName( const unsigned int row ) const
+{
+  if( row >= this->getRowCount() )
+    return "";
+  return this->mText.c_str() + this->mRowName[row];
+}
+
+
+/**
+<pre>
+ * input:   text - what to look for anywhere in a name, case doesn't matter, "" finds every row
+ *          typeID - resource type to look at, 0 for all
+ * output:  rows - rows whose name contains text, each once, in package load order
+</pre>
+**/
+void DBPF_nameIndexType::findSubstring( const string & text, const unsigned int typeID, vector< unsigned int > & rows ) const
+{
+  rows.clear();
+
+  string folded( text );
+  foldCase( folded, 0 );
+  if( string::npos != folded.find( '\0' ) )
+    return;
+
+  // names are separated by nulls, which text doesn't have, so a match never spans two rows
+  size_t at = 0;
+  while( at < this->mFoldedText.size() )
+  {
+    at = this->mFoldedText.find( folded, at );
+    if( string::npos == at )
+      break;
+
+    unsigned int row = (unsigned int)( upper_bound( this->mRowName.begin(), this->mRowName.end(), (unsigned int)at )
+                                       - this->mRowName.begin() ) - 1;
+    if( 0 == typeID || this->mRowType[row] == typeID )
+      rows.push_back( row );
+
+    // on to the next name
+    at = ( row + 1 < this->getRowCount() ) ? this->mRowName[row + 1] : this->mFoldedText.size();
+  }
+}
+
+
+// is a row's lowercase name before a prefix, for findPrefix
+struct lessFoldedNamePrefix
+{
+  const char * mpText;
+  const vector< unsigned int > & mRowName;
+  lessFoldedNamePrefix( const char * pText, const vector< unsigned int > & rowName ) : mpText( pText ), mRowName( rowName ) {}
+  bool operator()( const unsigned int row, const string & prefix ) const
+  { return( strcmp( mpText + mRowName[row], prefix.c_str() ) < 0 ); }
+};
+
+
+/**
+<pre>
+ * input:   prefix - what names start with, case doesn't matter, "" finds every row
+ *          typeID - resource type to look at, 0 for all
+ * output:  rows - rows whose name starts with prefix, sorted by name
+</pre>
+**/
+void DBPF_nameIndexType::findPrefix( const string & prefix, const unsigned int typeID, vector< unsigned int > & rows ) const
+{
+  rows.clear();
+
+  string folded( prefix );
+  foldCase( folded, 0 );
+  if( string::npos != folded.find( '\0' ) )
+    return;
+
+  const char * text = this->mFoldedText.c_str();
+  vector< unsigned int >::const_iterator it =
+    lower_bound( this->mSortedRows.begin(), this->mSortedRows.end(), folded,
+                 lessFoldedNamePrefix( text, this->mRowName ) );
+  for( ; it != this->mSortedRows.end(); ++it )
+  {
+    if( 0 != strncmp( text + this->mRowName[*it], folded.c_str(), folded.size() ) )
+      break;
+    if( 0 == typeID || this->mRowType[*it] == typeID )
+      rows.push_back( *it );
+  }
+}
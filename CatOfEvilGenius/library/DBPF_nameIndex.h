@@ -0,0 +1,121 @@
+/**
+ * file: DBPF_nameIndex.h
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_nameIndexType - names and text of every resource in a directory tree,
+ *                            searchable by substring or prefix, and saved to a file
+**/
+
+#ifndef DBPF_NAME_INDEX_H_CATOFEVILGENIUS
+#define DBPF_NAME_INDEX_H_CATOFEVILGENIUS
+
+#include <string>
+#include <vector>
+#include "DBPF_types.h" // TGIR
+
+using namespace std;
+
+
+// file format version, an index file with another version is rebuilt
+#define DBPF_NAME_INDEX_VERSION 1
+
+
+/**
+<pre>
+ * a package in a DBPF_nameIndexType, its rows are muFirstRow ... muFirstRow + muRowCount - 1
+</pre>
+**/
+class DBPF_nameIndexPackageType
+{
+public:
+  string mstrFileName;
+  unsigned long long muFileSize;
+  long long miModTime;
+  unsigned int muFirstRow;
+  unsigned int muRowCount;
+};
+
+
+/**
+<pre>
+ * Name index of a CC library
+ * ==========================
+ *
+ * "Which package holds afhair_Casual1~hair_txmt?" used to mean opening every package.
+ * This class keeps one row per name, with where it came from:
+ *
+ * - NAME_FILENAME, the file name in the first 64 bytes of BHAV, OBJD, STR#, GLOB, ...
+ *   (types marked in the type registry), read with dbpf_read_64bytes, so a compressed
+ *   resource is only decompressed that far
+ * - NAME_CPF, the "name" property of GZPS, XHTN, XTOL, BINX, and XOBJ
+ * - NAME_RCOL, the cSGResource name of TXMT, TXTR, GMDC, GMND, SHPE, CRES, ANIM, LIFO
+ * - NAME_TEXT, each distinct text of STR#, CATS, CTSS, and TTAs, muItem is the text item number
+ *
+ * update, save and load work like DBPF_propertyIndexType, only new and changed packages are read.
+ * Names are kept end to end in one block of text, and a lowercase copy of it,
+ * so findSubstring is one search through memory, and findPrefix a binary search
+ * in rows sorted by name.  Both ignore case (ASCII only).
+</pre>
+**/
+class DBPF_nameIndexType
+{
+public:
+  enum { NAME_FILENAME, NAME_CPF, NAME_RCOL, NAME_TEXT };
+
+  DBPF_nameIndexType() { this->clear(); }
+  ~DBPF_nameIndexType() {}
+
+  void clear();
+
+  bool update( const char * dirName );
+  unsigned int getScannedPackageCount() const { return this->muScannedPackages; } // by the last update
+
+  bool save( const char * fileName ) const;
+  bool load( const char * fileName );
+
+  unsigned int getPackageCount() const { return (unsigned int)( this->mPackages.size() ); }
+  const DBPF_nameIndexPackageType & getPackage( const unsigned int k ) const { return this->mPackages[k]; }
+
+  unsigned int getRowCount() const { return (unsigned int)( this->mRowType.size() ); }
+  bool getRow( const unsigned int row, unsigned int & package, DBPF_TGIRtype & tgir,
+               int & source, unsigned int & item ) const;
+  // null terminated, valid until the index changes
+  const char * getName( const unsigned int row ) const;
+
+  // typeID 0 means any type, rows come out in package load order
+  void findSubstring( const string & text, const unsigned int typeID, vector< unsigned int > & rows ) const;
+  // typeID 0 means any type, rows come out sorted by name
+  void findPrefix( const string & prefix, const unsigned int typeID, vector< unsigned int > & rows ) const;
+
+private:
+  bool scanPackage( const char * fileName );
+  void addRow( const unsigned int package, const DBPF_TGIRtype & tgir, const int source,
+               const unsigned int item, const char * name, const size_t length );
+  void truncateRows( const unsigned int rowCount );
+  void copyRows( const DBPF_nameIndexType & from, const DBPF_nameIndexPackageType & package );
+  void sortRows();
+
+  vector< DBPF_nameIndexPackageType > mPackages;
+
+  // row columns
+  vector< unsigned int > mRowPackage;
+  vector< unsigned int > mRowType;
+  vector< unsigned int > mRowGroup;
+  vector< unsigned int > mRowInstance;
+  vector< unsigned int > mRowInstance2;
+  vector< unsigned int > mRowSource;
+  vector< unsigned int > mRowItem;
+  vector< unsigned int > mRowName;   // where the name starts in mText
+
+  // names, each followed by a null, and the same in lowercase (not saved)
+  string mText;
+  string mFoldedText;
+
+  vector< unsigned int > mSortedRows; // rows by lowercase name (not saved)
+
+  unsigned int muScannedPackages;
+};
+
+
+// DBPF_NAME_INDEX_H_CATOFEVILGENIUS
+#endif
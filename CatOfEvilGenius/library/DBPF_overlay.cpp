@@ -0,0 +1,241 @@
+/**
+ * file: DBPF_overlay.cpp
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_overlayType - merged view of every package in a directory tree
+**/
+
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+#include "DBPF_overlay.h"
+#include "DBPFcompress.h"
+
+
+// -------------------------------------------------------------------------
+
+
+// order of index entries by type, group, instance, instance2
+static bool lessTGI( const DBPFindexType & a, const DBPFindexType & b )
+{
+  if( a.muTypeID != b.muTypeID )
+    return( a.muTypeID < b.muTypeID );
+  if( a.muGroupID != b.muGroupID )
+    return( a.muGroupID < b.muGroupID );
+  if( a.muInstanceID != b.muInstanceID )
+    return( a.muInstanceID < b.muInstanceID );
+  return( a.muInstanceID2 < b.muInstanceID2 );
+}
+
+static bool lessOverlayEntry( const DBPF_overlayEntryType & a, const DBPF_overlayEntryType & b )
+{
+  return lessTGI( a.mEntry, b.mEntry );
+}
+
+
+// -------------------------------------------------------------------------
+
+
+DBPF_overlayType::~DBPF_overlayType()
+{
+  this->clear();
+}
+
+
+void DBPF_overlayType::clear()
+{
+  for( size_t i = 0; i < this->mPackages.size(); ++i )
+    delete this->mPackages[i];
+  this->mPackages.clear();
+  this->mEntries.clear();
+}
+
+
+/**
+<pre>
+ * input:   dirName - directory to overlay, such as a Downloads folder
+ * output:  none
+ * returns: success / failure
+ *
+ * purpose: find all packages under dirName, read their index tables,
+ *          and merge them in load order.  Resource data is not read.
+ *          Files that are not valid packages are skipped with a warning.
+</pre>
+**/
+bool DBPF_overlayType::read( const char * dirName )
+{
+  this->clear();
+
+  vector< string > fileNames;
+  if( false == listPackageFiles( dirName, fileNames ) )
+    return false;
+
+  // read every package's index, collect all entries in load order
+
+  vector< DBPF_overlayEntryType > allEntries;
+  DBPF_overlayEntryType overlayEntry;
+  size_t fileSize = 0;
+
+  for( size_t i = 0; i < fileNames.size(); ++i )
+  {
+    DBPFtype * pPackage = new DBPFtype();
+    if( false == pPackage->read( fileNames[i].c_str(), fileSize ) )
+    {
+      fprintf( stderr, "WARNING: DBPF_overlayType.read, skipping %s\n", fileNames[i].c_str() );
+      delete pPackage;
+      continue;
+    }
+
+    overlayEntry.muPackage = (unsigned int)( this->mPackages.size() );
+    this->mPackages.push_back( pPackage );
+
+    const unsigned int itemCount = pPackage->getItemCount();
+    for( unsigned int k = 0; k < itemCount; ++k )
+    {
+      pPackage->getIndexEntry( k, overlayEntry.mEntry );
+      if( DBPF_DIR == overlayEntry.mEntry.muTypeID )
+        continue;
+      allEntries.push_back( overlayEntry );
+    }
+  }
+
+  // group by TGI, stable sort keeps load order within a group,
+  // so the last entry of each group is the one that wins
+
+  stable_sort( allEntries.begin(), allEntries.end(), lessOverlayEntry );
+
+  size_t first = 0;
+  while( first < allEntries.size() )
+  {
+    size_t last = first;
+    while( last + 1 < allEntries.size()
+        && false == lessTGI( allEntries[first].mEntry, allEntries[last + 1].mEntry ) )
+      ++last;
+
+    allEntries[last].muOverrideCount = (unsigned int)( last - first );
+    this->mEntries.push_back( allEntries[last] );
+
+    first = last + 1;
+  }
+
+  return true;
+}
+
+
+const char * DBPF_overlayType::getPackageFileName( const unsigned int k ) const
+{
+  if( k < this->mPackages.size() )
+    return( this->mPackages[k]->getFileName() );
+
+  fprintf( stderr, "ERROR: DBPF_overlayType.getPackageFileName, k out of bounds, is %u, must be < %u\n",
+           k, (unsigned int)( this->mPackages.size() ) );
+  return NULL;
+}
+
+
+/**
+ * get the k'th effective resource, entries are sorted by type, group, instance, instance2
+**/
+bool DBPF_overlayType::getEntry( const unsigned int k, DBPF_overlayEntryType & entry ) const
+{
+  if( k < this->mEntries.size() )
+  {
+    entry = this->mEntries[k];
+    return true;
+  }
+
+  fprintf( stderr, "ERROR: DBPF_overlayType.getEntry, k out of bounds, is %u, must be < %u\n",
+           k, (unsigned int)( this->mEntries.size() ) );
+  return false;
+}
+
+
+/**
+<pre>
+ * input:   tgir - type, group, instance, and instance2 (muResourceID) to look for
+ * output:  entry - the effective resource for that TGI, if found
+ * returns: true if some package has this resource, false if none do
+</pre>
+**/
+bool DBPF_overlayType::find( const DBPF_TGIRtype & tgir, DBPF_overlayEntryType & entry ) const
+{
+  DBPF_overlayEntryType key;
+  key.mEntry.muTypeID = tgir.muTypeID;
+  key.mEntry.muGroupID = tgir.muGroupID;
+  key.mEntry.muInstanceID = tgir.muInstanceID;
+  key.mEntry.muInstanceID2 = tgir.muResourceID;
+
+  vector< DBPF_overlayEntryType >::const_iterator it =
+    lower_bound( this->mEntries.begin(), this->mEntries.end(), key, lessOverlayEntry );
+
+  if( it == this->mEntries.end() || lessOverlayEntry( key, *it ) )
+    return false;
+
+  entry = *it;
+  return true;
+}
+
+
+bool DBPF_overlayType::isCompressed( const DBPF_overlayEntryType & entry, unsigned int & decmpSize ) const
+{
+  if( entry.muPackage >= this->mPackages.size() )
+  { fprintf( stderr, "ERROR: DBPF_overlayType.isCompressed, bad package index %u\n", entry.muPackage );
+    return false;
+  }
+
+  return( this->mPackages[entry.muPackage]->isCompressed( entry.mEntry, decmpSize ) );
+}
+
+
+/**
+<pre>
+ * input:   entry - an effective resource, from getEntry or find
+ *          bDecompress - if true, compressed data is decompressed before it is returned
+ * output:  bytes - allocated here with new, use delete [] when done with the data
+ *          byteCount - size of the byte array
+ * returns: success / failure
+ *
+ * purpose: read a resource's data from the package that owns it
+</pre>
+**/
+bool DBPF_overlayType::getData( const DBPF_overlayEntryType & entry, unsigned char * & bytes, unsigned int & byteCount,
+                                bool bDecompress )
+{
+  bytes = NULL;
+  byteCount = 0;
+
+  if( entry.muPackage >= this->mPackages.size() )
+  { fprintf( stderr, "ERROR: DBPF_overlayType.getData, bad package index %u\n", entry.muPackage );
+    return false;
+  }
+
+  DBPFtype * pPackage = this->mPackages[entry.muPackage];
+
+  unsigned char * fileBytes = NULL;
+  unsigned int fileByteCount = 0;
+  if( false == pPackage->getData( entry.mEntry, fileBytes, fileByteCount ) )
+    return false;
+
+  unsigned int decmpByteCount = 0;
+  if( false == bDecompress
+   || false == pPackage->isCompressed( entry.mEntry, decmpByteCount ) )
+  {
+    bytes = fileBytes;
+    byteCount = fileByteCount;
+    return true;
+  }
+
+  byteCount = decmpByteCount;
+  bool bOK = dbpfDecompress( fileBytes, fileByteCount, bytes, byteCount );
+  delete [] fileBytes;
+
+  if( false == bOK )
+  {
+    delete [] bytes;
+    bytes = NULL;
+    byteCount = 0;
+  }
+
+  return bOK;
+}
@@ -0,0 +1,92 @@
+/**
+ * file: DBPF_overlay.h
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_overlayType - merged view of every package in a directory tree
+**/
+
+#ifndef DBPF_OVERLAY_H_CATOFEVILGENIUS
+#define DBPF_OVERLAY_H_CATOFEVILGENIUS
+
+#include <string>
+#include <vector>
+#include "DBPF.h"
+#include "DBPF_types.h" // TGIR
+
+using namespace std;
+
+
+/**
+<pre>
+ * one resource as the game sees it,
+ * the index entry from the package that wins,
+ * and which package that is
+</pre>
+**/
+class DBPF_overlayEntryType
+{
+public:
+  DBPFindexType mEntry;
+
+  // index of the owning package, see DBPF_overlayType::getPackageFileName
+  unsigned int muPackage;
+
+  // number of earlier packages that had this same TGI and lost to this one
+  unsigned int muOverrideCount;
+
+  DBPF_overlayEntryType() : muPackage( 0 ), muOverrideCount( 0 ) {}
+};
+
+
+/**
+<pre>
+ * Overlay "virtual package" of a directory tree, such as a Downloads folder
+ * =========================================================================
+ *
+ * The game loads packages in order and a resource in a later package
+ * replaces a resource with the same type, group, instance and instance2
+ * in an earlier one.  This class does the same thing for our tools.
+ *
+ * - read finds all .package files under a directory, in load order,
+ *   and reads only their headers, index tables and DIRs
+ * - the index entries are merged, the last package to have a TGI wins
+ * - getItemCount / getEntry walk the effective resources, sorted by TGI
+ * - find looks up the effective resource for a TGI
+ * - getData reads the bytes from the owning package, only when asked
+ *
+ * DIR resources are not part of the overlay, every package has its own.
+</pre>
+**/
+class DBPF_overlayType
+{
+private:
+  vector< DBPFtype * > mPackages;
+  vector< DBPF_overlayEntryType > mEntries; // sorted by TGI
+
+public:
+  DBPF_overlayType() {}
+  ~DBPF_overlayType();
+
+  bool read( const char * dirName );
+  void clear();
+
+  unsigned int getPackageCount() const { return (unsigned int)( this->mPackages.size() ); }
+  const char * getPackageFileName( const unsigned int k ) const;
+
+  unsigned int getItemCount() const { return (unsigned int)( this->mEntries.size() ); }
+  bool getEntry( const unsigned int k, DBPF_overlayEntryType & entry ) const;
+  bool find( const DBPF_TGIRtype & tgir, DBPF_overlayEntryType & entry ) const;
+
+  bool isCompressed( const DBPF_overlayEntryType & entry, unsigned int & decmpSize ) const;
+  bool getData( const DBPF_overlayEntryType & entry, unsigned char * & bytes, unsigned int & byteCount,
+                bool bDecompress = true );
+
+private:
+  // not copyable, owns the packages
+  DBPF_overlayType( const DBPF_overlayType & );
+  DBPF_overlayType & operator=( const DBPF_overlayType & );
+};
+
+
+// DBPF_OVERLAY_H_CATOFEVILGENIUS
+#endif
@@ -0,0 +1,591 @@
+/**
+ * file: DBPF_propertyIndex.cpp
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_propertyIndexType - CPF properties of every catalog resource in a directory tree,
+ *                                kept in columns and saved to a file
+**/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include "DBPF_propertyIndex.h"
+#include "DBPF.h"
+#include "DBPFcompress.h"
+#include "DBPF_byteStreamFunctions.h"
+
+
+// resource types that are CPF catalog resources
+static const unsigned int gIndexedTypes[] = { DBPF_GZPS, DBPF_XHTN, DBPF_BINX, DBPF_XTOL };
+
+// used when setKeys is never called
+static const char * gDefaultKeys[] = {
+  "name", "type", "age", "gender", "category", "outfit", "parts", "flags",
+  "family", "hairtone", "genetic", "sortindex", "stringsetidx", "creator"
+};
+
+// file starts with this
+static const char gIndexMagic[8] = { 'D', 'B', 'P', 'F', 'P', 'I', 'D', 'X' };
+
+
+static bool isIndexedType( const unsigned int type )
+{
+  for( size_t i = 0; i < sizeof( gIndexedTypes ) / sizeof( gIndexedTypes[0] ); ++i )
+    if( gIndexedTypes[i] == type )
+      return true;
+  return false;
+}
+
+
+DBPF_propertyIndexType::DBPF_propertyIndexType()
+{
+  for( size_t i = 0; i < sizeof( gDefaultKeys ) / sizeof( gDefaultKeys[0] ); ++i )
+    this->mKeys.push_back( gDefaultKeys[i] );
+  this->clear();
+}
+
+
+void DBPF_propertyIndexType::clear()
+{
+  this->mPackages.clear();
+  this->mRowPackage.clear();
+  this->mRowType.clear();
+  this->mRowGroup.clear();
+  this->mRowInstance.clear();
+  this->mRowInstance2.clear();
+  this->mColumnTypes.assign( this->mKeys.size(), vector< unsigned int >() );
+  this->mColumnValues.assign( this->mKeys.size(), vector< unsigned int >() );
+  this->mStrings.clear();
+  this->mStringIDs.clear();
+  this->muScannedPackages = 0;
+}
+
+
+void DBPF_propertyIndexType::setKeys( const vector< string > & keys )
+{
+  if( keys == this->mKeys )
+    return;
+
+  this->mKeys = keys;
+  this->clear();
+}
+
+
+int DBPF_propertyIndexType::findColumn( const string & key ) const
+{
+  for( size_t i = 0; i < this->mKeys.size(); ++i )
+    if( this->mKeys[i] == key )
+      return (int)i;
+  return -1;
+}
+
+
+unsigned int DBPF_propertyIndexType::internString( const char * str, const size_t length )
+{
+  string s( str, length );
+  unordered_map< string, unsigned int >::const_iterator it = this->mStringIDs.find( s );
+  if( it != this->mStringIDs.end() )
+    return it->second;
+
+  unsigned int id = (unsigned int)( this->mStrings.size() );
+  this->mStrings.push_back( s );
+  this->mStringIDs.insert( make_pair( s, id ) );
+  return id;
+}
+
+
+/**
+<pre>
+ * input:   dirName - directory to index, such as a Downloads folder
+ * returns: success / failure
+ *
+ * purpose: bring the index up to date with the packages under dirName,
+ *          new and changed packages are read, rows of unchanged ones are kept,
+ *          packages that are gone are dropped.
+ *          Files that are not valid packages are skipped with a warning.
+</pre>
+**/
+bool DBPF_propertyIndexType::update( const char * dirName )
+{
+  vector< string > fileNames;
+  if( false == listPackageFiles( dirName, fileNames ) )
+    return false;
+
+  // build a new index, copying rows over from this one where we can,
+  // so packages stay in load order and the string pool drops unused strings
+
+  DBPF_propertyIndexType old;
+  old.mKeys = this->mKeys;
+  old.mPackages.swap( this->mPackages );
+  old.mRowPackage.swap( this->mRowPackage );
+  old.mRowType.swap( this->mRowType );
+  old.mRowGroup.swap( this->mRowGroup );
+  old.mRowInstance.swap( this->mRowInstance );
+  old.mRowInstance2.swap( this->mRowInstance2 );
+  old.mColumnTypes.swap( this->mColumnTypes );
+  old.mColumnValues.swap( this->mColumnValues );
+  old.mStrings.swap( this->mStrings );
+  this->clear();
+
+  unordered_map< string, unsigned int > oldPackages;
+  for( size_t k = 0; k < old.mPackages.size(); ++k )
+    oldPackages[ old.mPackages[k].mstrFileName ] = (unsigned int)k;
+
+  for( size_t i = 0; i < fileNames.size(); ++i )
+  {
+    unsigned long long fileSize = 0;
+    long long modTime = 0;
+    if( false == getPackageFileStamp( fileNames[i].c_str(), fileSize, modTime ) )
+    { fprintf( stderr, "WARNING: DBPF_propertyIndexType.update, skipping %s\n", fileNames[i].c_str() );
+      continue;
+    }
+
+    unordered_map< string, unsigned int >::const_iterator it = oldPackages.find( fileNames[i] );
+    if( it != oldPackages.end()
+     && old.mPackages[it->second].muFileSize == fileSize
+     && old.mPackages[it->second].miModTime == modTime )
+    {
+      this->copyRows( old, old.mPackages[it->second] );
+      continue;
+    }
+
+    DBPF_propertyIndexPackageType package;
+    package.mstrFileName = fileNames[i];
+    package.muFileSize = fileSize;
+    package.miModTime = modTime;
+    package.muFirstRow = this->getRowCount();
+    package.muRowCount = 0;
+    this->mPackages.push_back( package );
+
+    if( false == this->scanPackage( fileNames[i].c_str() ) )
+    { fprintf( stderr, "WARNING: DBPF_propertyIndexType.update, skipping %s\n", fileNames[i].c_str() );
+
+      // drop the rows it got before it failed
+      const unsigned int rowCount = this->mPackages.back().muFirstRow;
+      this->mPackages.pop_back();
+      this->mRowPackage.resize( rowCount );
+      this->mRowType.resize( rowCount );
+      this->mRowGroup.resize( rowCount );
+      this->mRowInstance.resize( rowCount );
+      this->mRowInstance2.resize( rowCount );
+      for( size_t c = 0; c < this->mKeys.size(); ++c )
+      { this->mColumnTypes[c].resize( rowCount );
+        this->mColumnValues[c].resize( rowCount );
+      }
+      continue;
+    }
+    ++this->muScannedPackages;
+  }
+
+  return true;
+}
+
+
+// append the rows of one package of another index (with the same keys)
+void DBPF_propertyIndexType::copyRows( const DBPF_propertyIndexType & from, const DBPF_propertyIndexPackageType & package )
+{
+  DBPF_propertyIndexPackageType copy = package;
+  copy.muFirstRow = this->getRowCount();
+  unsigned int packageNumber = (unsigned int)( this->mPackages.size() );
+  this->mPackages.push_back( copy );
+
+  const unsigned int first = package.muFirstRow, last = package.muFirstRow + package.muRowCount;
+  for( unsigned int row = first; row < last; ++row )
+  {
+    this->mRowPackage.push_back( packageNumber );
+    this->mRowType.push_back( from.mRowType[row] );
+    this->mRowGroup.push_back( from.mRowGroup[row] );
+    this->mRowInstance.push_back( from.mRowInstance[row] );
+    this->mRowInstance2.push_back( from.mRowInstance2[row] );
+
+    for( size_t c = 0; c < this->mKeys.size(); ++c )
+    {
+      unsigned int type = from.mColumnTypes[c][row];
+      unsigned int value = from.mColumnValues[c][row];
+      if( CPF_STRING == type )
+      { const string & str = from.mStrings[value];
+        value = this->internString( str.data(), str.size() );
+      }
+      this->mColumnTypes[c].push_back( type );
+      this->mColumnValues[c].push_back( value );
+    }
+  }
+}
+
+
+// add rows for the catalog resources of one package, the package is the last one in mPackages
+bool DBPF_propertyIndexType::scanPackage( const char * fileName )
+{
+  DBPFtype package;
+  size_t fileSize = 0;
+  if( false == package.read( fileName, fileSize ) )
+    return false;
+
+  const unsigned int packageNumber = (unsigned int)( this->mPackages.size() - 1 );
+
+  vector< DBPF_CPFfieldType > fields( this->mKeys.size() );
+  for( size_t c = 0; c < this->mKeys.size(); ++c )
+    fields[c].mstrKey = this->mKeys[c];
+
+  DBPFindexType entry;
+  const unsigned int itemCount = package.getItemCount();
+  for( unsigned int k = 0; k < itemCount; ++k )
+  {
+    package.getIndexEntry( k, entry );
+    if( false == isIndexedType( entry.muTypeID ) )
+      continue;
+
+    // fresh each entry, dbpfDecompress can fail before it sets bytes
+    unsigned char * fileBytes = NULL, * bytes = NULL;
+    unsigned int fileByteCount = 0, byteCount = 0;
+
+    if( false == package.getData( entry, fileBytes, fileByteCount ) )
+      return false;
+
+    // decompress if needed
+    unsigned int decmpByteCount = 0;
+    if( package.isCompressed( entry, decmpByteCount ) )
+    {
+      byteCount = decmpByteCount;
+      bool bOK = dbpfDecompress( fileBytes, fileByteCount, bytes, byteCount );
+      delete [] fileBytes;
+      if( false == bOK )
+      { delete [] bytes;
+        return false;
+      }
+    }
+    else
+    {
+      bytes = fileBytes;
+      byteCount = fileByteCount;
+    }
+
+    bool bOK = DBPF_CPFextract( bytes, byteCount, fields.empty() ? NULL : &fields[0], (unsigned int)( fields.size() ) );
+    if( false == bOK )
+    {
+      fprintf( stderr, "WARNING: DBPF_propertyIndexType.update, bad CPF %x %x %x in %s\n",
+               entry.muTypeID, entry.muGroupID, entry.muInstanceID, fileName );
+      delete [] bytes;
+      continue;
+    }
+
+    this->mRowPackage.push_back( packageNumber );
+    this->mRowType.push_back( entry.muTypeID );
+    this->mRowGroup.push_back( entry.muGroupID );
+    this->mRowInstance.push_back( entry.muInstanceID );
+    this->mRowInstance2.push_back( entry.muInstanceID2 );
+
+    for( size_t c = 0; c < fields.size(); ++c )
+    {
+      const DBPF_CPFfieldType & field = fields[c];
+      unsigned int value = 0;
+      if( field.mbFound && CPF_STRING == field.miType )
+        value = this->internString( field.mstrValue.data(), field.mstrValue.size() );
+      else if( field.mbFound && CPF_BOOL == field.miType )
+        value = field.mbValue ? 1 : 0;
+      else if( field.mbFound )
+        value = field.miValue; // float bits too
+      this->mColumnTypes[c].push_back( field.mbFound ? field.miType : 0 );
+      this->mColumnValues[c].push_back( value );
+    }
+
+    ++this->mPackages.back().muRowCount;
+    delete [] bytes;
+  }
+
+  return true;
+}
+
+
+/**
+<pre>
+ * input:   fileName - index file to write
+ * returns: success / failure
+ *
+ * purpose: save the index, the file is replaced only after it is written completely
+</pre>
+**/
+bool DBPF_propertyIndexType::save( const char * fileName ) const
+{
+  vector< unsigned char > bytes( gIndexMagic, gIndexMagic + 8 );
+  writeIndexUint( bytes, DBPF_PROPERTY_INDEX_VERSION );
+
+  writeIndexUint( bytes, (unsigned int)( this->mKeys.size() ) );
+  for( size_t c = 0; c < this->mKeys.size(); ++c )
+    writeIndexString( bytes, this->mKeys[c] );
+
+  writeIndexUint( bytes, (unsigned int)( this->mStrings.size() ) );
+  for( size_t i = 0; i < this->mStrings.size(); ++i )
+    writeIndexString( bytes, this->mStrings[i] );
+
+  writeIndexUint( bytes, (unsigned int)( this->mPackages.size() ) );
+  for( size_t k = 0; k < this->mPackages.size(); ++k )
+  {
+    const DBPF_propertyIndexPackageType & package = this->mPackages[k];
+    writeIndexString( bytes, package.mstrFileName );
+    writeIndexUint64( bytes, package.muFileSize );
+    writeIndexUint64( bytes, (unsigned long long)package.miModTime );
+    writeIndexUint( bytes, package.muFirstRow );
+    writeIndexUint( bytes, package.muRowCount );
+  }
+
+  writeIndexUint( bytes, this->getRowCount() );
+  writeIndexColumn( bytes, this->mRowPackage );
+  writeIndexColumn( bytes, this->mRowType );
+  writeIndexColumn( bytes, this->mRowGroup );
+  writeIndexColumn( bytes, this->mRowInstance );
+  writeIndexColumn( bytes, this->mRowInstance2 );
+  for( size_t c = 0; c < this->mKeys.size(); ++c )
+  {
+    writeIndexColumn( bytes, this->mColumnTypes[c] );
+    writeIndexColumn( bytes, this->mColumnValues[c] );
+  }
+
+  return writeIndexFile( fileName, bytes );
+}
+
+
+/**
+<pre>
+ * input:   fileName - index file written by save
+ * returns: true - index loaded
+ *          false - no such file, or it's from another version or broken,
+ *                  the index is empty (with the same keys), update will rebuild it
+ *
+ * purpose: load an index saved earlier, the keys come from the file
+</pre>
+**/
+bool DBPF_propertyIndexType::load( const char * fileName )
+{
+  this->clear();
+
+  vector< unsigned char > bytes;
+  if( false == readIndexFile( fileName, bytes ) )
+    return false;
+
+  const unsigned char * p = bytes.empty() ? NULL : &bytes[0];
+  const unsigned char * end = p + bytes.size();
+
+  unsigned int version = 0, count = 0;
+  if( bytes.size() < 12 || 0 != memcmp( p, gIndexMagic, 8 ) )
+  { fprintf( stderr, "WARNING: DBPF_propertyIndexType.load, %s is not a property index\n", fileName );
+    return false;
+  }
+  p += 8;
+  readIndexUint( p, end, version );
+  if( DBPF_PROPERTY_INDEX_VERSION != version )
+  { fprintf( stderr, "WARNING: DBPF_propertyIndexType.load, %s is version %u, expected %u\n",
+             fileName, version, DBPF_PROPERTY_INDEX_VERSION );
+    return false;
+  }
+
+  bool bOK = readIndexUint( p, end, count );
+  vector< string > keys( bOK ? count : 0 );
+  for( size_t c = 0; bOK && c < keys.size(); ++c )
+    bOK = readIndexString( p, end, keys[c] );
+  if( bOK )
+  { this->mKeys = keys;
+    this->clear();
+  }
+
+  bOK = bOK && readIndexUint( p, end, count ) && count <= (size_t)( end - p ) / 4;
+  if( bOK )
+    this->mStrings.resize( count );
+  for( size_t i = 0; bOK && i < this->mStrings.size(); ++i )
+  { bOK = readIndexString( p, end, this->mStrings[i] );
+    this->mStringIDs.insert( make_pair( this->mStrings[i], (unsigned int)i ) );
+  }
+
+  bOK = bOK && readIndexUint( p, end, count ) && count <= (size_t)( end - p ) / 28;
+  if( bOK )
+    this->mPackages.resize( count );
+  for( size_t k = 0; bOK && k < this->mPackages.size(); ++k )
+  {
+    DBPF_propertyIndexPackageType & package = this->mPackages[k];
+    unsigned long long modTime = 0;
+    bOK = readIndexString( p, end, package.mstrFileName )
+       && readIndexUint64( p, end, package.muFileSize )
+       && readIndexUint64( p, end, modTime )
+       && readIndexUint( p, end, package.muFirstRow )
+       && readIndexUint( p, end, package.muRowCount );
+    package.miModTime = (long long)modTime;
+  }
+
+  unsigned int rowCount = 0;
+  bOK = bOK && readIndexUint( p, end, rowCount )
+     && readIndexColumn( p, end, this->mRowPackage, rowCount )
+     && readIndexColumn( p, end, this->mRowType, rowCount )
+     && readIndexColumn( p, end, this->mRowGroup, rowCount )
+     && readIndexColumn( p, end, this->mRowInstance, rowCount )
+     && readIndexColumn( p, end, this->mRowInstance2, rowCount );
+  for( size_t c = 0; bOK && c < this->mKeys.size(); ++c )
+    bOK = readIndexColumn( p, end, this->mColumnTypes[c], rowCount )
+       && readIndexColumn( p, end, this->mColumnValues[c], rowCount );
+
+  // everything in range?
+  for( size_t k = 0; bOK && k < this->mPackages.size(); ++k )
+    bOK = this->mPackages[k].muFirstRow <= rowCount
+       && this->mPackages[k].muRowCount <= rowCount - this->mPackages[k].muFirstRow;
+  for( unsigned int row = 0; bOK && row < rowCount; ++row )
+  { bOK = this->mRowPackage[row] < this->mPackages.size();
+    for( size_t c = 0; bOK && c < this->mKeys.size(); ++c )
+      if( CPF_STRING == this->mColumnTypes[c][row] )
+        bOK = this->mColumnValues[c][row] < this->mStrings.size();
+  }
+
+  if( false == bOK )
+  { fprintf( stderr, "WARNING: DBPF_propertyIndexType.load, %s is broken\n", fileName );
+    this->clear();
+    return false;
+  }
+
+  return true;
+}
+
+
+bool DBPF_propertyIndexType::getRow( const unsigned int row, unsigned int & package, DBPF_TGIRtype & tgir ) const
+{
+  if( row >= this->getRowCount() )
+  { fprintf( stderr, "ERROR: DBPF_propertyIndexType.getRow, row out of bounds, is %u, must be < %u\n",
+             row, this->getRowCount() );
+    return false;
+  }
+
+  package = this->mRowPackage[row];
+  tgir.muTypeID = this->mRowType[row];
+  tgir.muGroupID = this->mRowGroup[row];
+  tgir.muInstanceID = this->mRowInstance[row];
+  tgir.muResourceID = this->mRowInstance2[row];
+  return true;
+}
+
+
+/**
+ * Given a row and a property key, outputs the property value.
+ * Returns false if the key isn't indexed, or the resource doesn't have that property.
+**/
+bool DBPF_propertyIndexType::getValue( const unsigned int row, const string & key, DBPF_CPFitemType & value ) const
+{
+  int c = this->findColumn( key );
+  if( c < 0 || row >= this->getRowCount() || 0 == this->mColumnTypes[c][row] )
+    return false;
+
+  unsigned int u = this->mColumnValues[c][row];
+  value.miType = this->mColumnTypes[c][row];
+  value.mbValue = ( 0 != u );
+  value.miValue = u;
+  memcpy( &value.mfValue, &u, 4 );
+  if( CPF_STRING == value.miType )
+    value.mstrValue = this->mStrings[u];
+  else
+    value.mstrValue.clear();
+
+  return true;
+}
+
+
+// does one cell match a filter, filterString is the pool number of the filter's string, -1 if not in the pool
+bool DBPF_propertyIndexType::matches( const DBPF_propertyFilterType & filter, const unsigned int type,
+                                      const unsigned int value, const int filterString ) const
+{
+  const int op = filter.miOp;
+
+  if( 0 == type )
+    return( DBPF_propertyFilterType::FILTER_NOT_EQUAL == op );
+  if( DBPF_propertyFilterType::FILTER_EXISTS == op )
+    return true;
+
+  // compare, -1 less, 0 equal, 1 greater, 2 can't compare
+  int cmp = 2;
+  if( CPF_STRING == type && CPF_STRING == filter.mValue.miType )
+  {
+    if( DBPF_propertyFilterType::FILTER_EQUAL == op || DBPF_propertyFilterType::FILTER_NOT_EQUAL == op )
+      cmp = ( (int)value == filterString ) ? 0 : 1;
+    else if( DBPF_propertyFilterType::FILTER_PREFIX == op )
+      return( 0 == this->mStrings[value].compare( 0, filter.mValue.mstrValue.size(), filter.mValue.mstrValue ) );
+    else
+    { int c = this->mStrings[value].compare( filter.mValue.mstrValue );
+      cmp = ( c < 0 ) ? -1 : ( c > 0 ) ? 1 : 0;
+    }
+  }
+  else if( CPF_FLOAT == type || CPF_FLOAT == filter.mValue.miType )
+  {
+    float a = 0, b = filter.mValue.mfValue;
+    if( CPF_FLOAT == type )  memcpy( &a, &value, 4 );
+    else                     a = (float)(int)value;
+    if( CPF_FLOAT != filter.mValue.miType )
+      b = (float)(int)filter.mValue.miValue;
+    cmp = ( a < b ) ? -1 : ( a > b ) ? 1 : 0;
+  }
+  else if( CPF_BOOL == type || CPF_BOOL == filter.mValue.miType )
+  {
+    bool a = ( 0 != value );
+    bool b = ( CPF_BOOL == filter.mValue.miType ) ? filter.mValue.mbValue : ( 0 != filter.mValue.miValue );
+    cmp = ( a == b ) ? 0 : ( a ? 1 : -1 );
+  }
+  else if( CPF_STRING != type && CPF_STRING != filter.mValue.miType )
+  {
+    if( CPF_INT2 == type )
+      cmp = ( (int)value < (int)filter.mValue.miValue ) ? -1 : ( (int)value > (int)filter.mValue.miValue ) ? 1 : 0;
+    else
+      cmp = ( value < filter.mValue.miValue ) ? -1 : ( value > filter.mValue.miValue ) ? 1 : 0;
+  }
+
+  switch( op )
+  {
+  case DBPF_propertyFilterType::FILTER_EQUAL:     return( 0 == cmp );
+  case DBPF_propertyFilterType::FILTER_NOT_EQUAL: return( 0 != cmp );
+  case DBPF_propertyFilterType::FILTER_LESS:      return( -1 == cmp );
+  case DBPF_propertyFilterType::FILTER_GREATER:   return( 1 == cmp );
+  }
+  return false;
+}
+
+
+/**
+<pre>
+ * input:   typeID - resource type to look at, DBPF_GZPS..., 0 for all indexed types
+ *          filters - all of them must match
+ * output:  rows - matching rows, in package load order
+ * returns: false if a filter's key is not indexed
+</pre>
+**/
+bool DBPF_propertyIndexType::query( const unsigned int typeID, const vector< DBPF_propertyFilterType > & filters,
+                                    vector< unsigned int > & rows ) const
+{
+  rows.clear();
+
+  // candidate rows, narrowed one column at a time
+  for( unsigned int row = 0; row < this->getRowCount(); ++row )
+    if( 0 == typeID || this->mRowType[row] == typeID )
+      rows.push_back( row );
+
+  for( size_t i = 0; i < filters.size(); ++i )
+  {
+    const DBPF_propertyFilterType & filter = filters[i];
+    int c = this->findColumn( filter.mstrKey );
+    if( c < 0 )
+    { fprintf( stderr, "ERROR: DBPF_propertyIndexType.query, %s is not an indexed key\n", filter.mstrKey.c_str() );
+      rows.clear();
+      return false;
+    }
+
+    int filterString = -1;
+    if( CPF_STRING == filter.mValue.miType )
+    { unordered_map< string, unsigned int >::const_iterator it = this->mStringIDs.find( filter.mValue.mstrValue );
+      if( it != this->mStringIDs.end() )
+        filterString = (int)( it->second );
+    }
+
+    const vector< unsigned int > & types = this->mColumnTypes[c];
+    const vector< unsigned int > & values = this->mColumnValues[c];
+    size_t kept = 0;
+    for( size_t k = 0; k < rows.size(); ++k )
+      if( this->matches( filter, types[rows[k]], values[rows[k]], filterString ) )
+        rows[kept++] = rows[k];
+    rows.resize( kept );
+  }
+
+  return true;
+}
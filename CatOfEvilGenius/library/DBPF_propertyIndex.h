@@ -0,0 +1,150 @@
+/**
+ * file: DBPF_propertyIndex.h
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_propertyIndexType - CPF properties of every catalog resource in a directory tree,
+ *                                kept in columns and saved to a file
+**/
+
+#ifndef DBPF_PROPERTY_INDEX_H_CATOFEVILGENIUS
+#define DBPF_PROPERTY_INDEX_H_CATOFEVILGENIUS
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "DBPF_CPF.h"   // DBPF_CPFitemType
+#include "DBPF_types.h" // TGIR
+
+using namespace std;
+
+
+// file format version, an index file with another version is rebuilt
+#define DBPF_PROPERTY_INDEX_VERSION 1
+
+
+/**
+<pre>
+ * one condition of a DBPF_propertyIndexType query
+ * - FILTER_EXISTS, the resource has the property
+ * - the others compare the property with mValue,
+ *   numbers by value (CPF_INT2 signed), strings by characters, FILTER_PREFIX is for strings only
+ * - a resource without the property never matches, except with FILTER_NOT_EQUAL
+</pre>
+**/
+class DBPF_propertyFilterType
+{
+public:
+  enum { FILTER_EQUAL, FILTER_NOT_EQUAL, FILTER_LESS, FILTER_GREATER, FILTER_EXISTS, FILTER_PREFIX };
+
+  string mstrKey;
+  int miOp;
+  DBPF_CPFitemType mValue;
+
+  DBPF_propertyFilterType( const string & key, const int op ) : mstrKey( key ), miOp( op ) { mValue.miType = 0; }
+  DBPF_propertyFilterType( const string & key, const int op, const DBPF_CPFitemType & value )
+    : mstrKey( key ), miOp( op ), mValue( value ) {}
+  DBPF_propertyFilterType( const string & key, const int op, const unsigned int value )
+    : mstrKey( key ), miOp( op ) { mValue.miType = CPF_INT; mValue.miValue = value; }
+  DBPF_propertyFilterType( const string & key, const int op, const string & value )
+    : mstrKey( key ), miOp( op ) { mValue.miType = CPF_STRING; mValue.mstrValue = value; }
+};
+
+
+/**
+<pre>
+ * a package in a DBPF_propertyIndexType, its rows are muFirstRow ... muFirstRow + muRowCount - 1
+</pre>
+**/
+class DBPF_propertyIndexPackageType
+{
+public:
+  string mstrFileName;
+  unsigned long long muFileSize;
+  long long miModTime;
+  unsigned int muFirstRow;
+  unsigned int muRowCount;
+};
+
+
+/**
+<pre>
+ * Property index of a CC library
+ * ==============================
+ *
+ * Questions like "all GZPS with age 0x20 and family X" or "every BINX sortindex"
+ * used to mean reading every package again.  This class keeps the answers.
+ *
+ * - one row per GZPS, XHTN, BINX, and XTOL resource, in every package under a directory
+ * - columns: package, type, group, instance, instance2, and one column per indexed property key,
+ *   string values are numbers into one string pool, so equal strings compare as numbers
+ * - update scans only packages that are new or changed since the last update (by size and time),
+ *   reading just the indexed keys with DBPF_CPFextract, rows of unchanged packages are kept
+ * - save / load keep the index in a file between runs
+ * - query runs filters one column at a time, and gives matching row numbers,
+ *   use getRow and getValue to read a row
+ *
+ * The keys are set with setKeys before the first update, the default is a list of
+ * common catalog properties.  Changing the keys empties the index.
+</pre>
+**/
+class DBPF_propertyIndexType
+{
+public:
+  DBPF_propertyIndexType();
+  ~DBPF_propertyIndexType() {}
+
+  void clear();  // removes all rows and packages, keeps the keys
+
+  void setKeys( const vector< string > & keys );
+  const vector< string > & getKeys() const { return this->mKeys; }
+
+  bool update( const char * dirName );
+  unsigned int getScannedPackageCount() const { return this->muScannedPackages; } // by the last update
+
+  bool save( const char * fileName ) const;
+  bool load( const char * fileName );
+
+  unsigned int getPackageCount() const { return (unsigned int)( this->mPackages.size() ); }
+  const DBPF_propertyIndexPackageType & getPackage( const unsigned int k ) const { return this->mPackages[k]; }
+
+  unsigned int getRowCount() const { return (unsigned int)( this->mRowType.size() ); }
+  bool getRow( const unsigned int row, unsigned int & package, DBPF_TGIRtype & tgir ) const;
+  bool getValue( const unsigned int row, const string & key, DBPF_CPFitemType & value ) const;
+
+  // typeID 0 means any of the indexed types
+  bool query( const unsigned int typeID, const vector< DBPF_propertyFilterType > & filters,
+              vector< unsigned int > & rows ) const;
+
+private:
+  int findColumn( const string & key ) const;
+  unsigned int internString( const char * str, const size_t length );
+  bool scanPackage( const char * fileName );
+  void copyRows( const DBPF_propertyIndexType & from, const DBPF_propertyIndexPackageType & package );
+  bool matches( const DBPF_propertyFilterType & filter, const unsigned int type, const unsigned int value,
+                const int filterString ) const;
+
+  vector< string > mKeys;
+  vector< DBPF_propertyIndexPackageType > mPackages;
+
+  // row columns
+  vector< unsigned int > mRowPackage;
+  vector< unsigned int > mRowType;
+  vector< unsigned int > mRowGroup;
+  vector< unsigned int > mRowInstance;
+  vector< unsigned int > mRowInstance2;
+
+  // property columns, one pair per key, type 0 means the resource doesn't have the property,
+  // value is the bool, int, or float bits, or a string pool number
+  vector< vector< unsigned int > > mColumnTypes;
+  vector< vector< unsigned int > > mColumnValues;
+
+  // string pool
+  vector< string > mStrings;
+  unordered_map< string, unsigned int > mStringIDs;
+
+  unsigned int muScannedPackages;
+};
+
+
+// DBPF_PROPERTY_INDEX_H_CATOFEVILGENIUS
+#endif
@@ -14,7 +14,10 @@
 // -------------------------------------------------
 
 
-DBPF_resourceType::DBPF_resourceType()
+DBPF_resourceType::DBPF_resourceType( DBPF_arenaType * pArena )
+: mpArena( pArena ),
+  mstrName( dbpfMemoryResource( pArena ) ),
+  mstrDesc( dbpfMemoryResource( pArena ) )
 {
   this->mpRawBytes = NULL;
   this->mpProperties = NULL;
@@ -27,17 +30,11 @@ DBPF_resourceType::~DBPF_resourceType()
 {
   clear();
 
-  if( this->mpProperties != NULL )
-  {
-    delete this->mpProperties;
-    this->mpProperties = NULL;
-  }
+  dbpfDelete( this->mpArena, this->mpProperties );
+  this->mpProperties = NULL;
 
-  if( this->mpCPF != NULL )
-  {
-    delete this->mpCPF;
-    this->mpCPF = NULL;
-  }
+  dbpfDelete( this->mpArena, this->mpCPF );
+  this->mpCPF = NULL;
 }
 
 
@@ -50,8 +47,7 @@ void DBPF_resourceType::clear()
   this->mMyIndexEntry.clear();
 
   this->muRawBytesCount = 0;
-  if( this->mpRawBytes != NULL )
-    delete [] this->mpRawBytes;
+  dbpfDeleteBytes( this->mpArena, this->mpRawBytes );
   this->mpRawBytes = NULL;
 
   if( this->mpProperties != NULL )
@@ -149,6 +145,16 @@ bool DBPF_resourceType::isCompressed( unsigned int & cmprByteCount, unsigned int
 }
 
 
+bool DBPF_resourceType::areRawBytesCompressed( unsigned int & uncByteCount ) const
+{
+  if( NULL == this->mpRawBytes )
+    return false;
+
+  unsigned int cmprByteCount = 0, cmprID = 0;
+  return( dbpfGetCompressedHeader( this->mpRawBytes, cmprByteCount, cmprID, uncByteCount ) );
+}
+
+
 /**
 <pre>
  * returns true if compression was successful, raw bytes are now compressed, use isCompressed to get compressed size
@@ -190,13 +196,15 @@ bool DBPF_resourceType::compressRawBytes()
 
   unsigned char * cmprBytes = NULL;
   unsigned int cmprByteCount = 0;
-  if( false == dbpfCompress( this->mpRawBytes, this->muRawBytesCount, cmprBytes, cmprByteCount ) )
+  if( false == dbpfCompress( this->mpRawBytes, this->muRawBytesCount, cmprBytes, cmprByteCount, this->mpArena ) )
     return false;
 
-  // delete old bytes, save new compressed bytes
+  // delete old bytes, save new compressed bytes,
+  // CPF strings that still point into them are copied first
 
-  if( this->mpRawBytes != NULL )
-    delete [] this->mpRawBytes;
+  if( this->mpCPF != NULL )
+    this->mpCPF->ownStrings();
+  dbpfDeleteBytes( this->mpArena, this->mpRawBytes );
   this->mpRawBytes = cmprBytes;
 
   // remember compressed size
@@ -231,6 +239,25 @@ bool DBPF_resourceType::getPropertyValue(const std::string propName, DBPF_CPFite
 }
 
 
+bool DBPF_resourceType::getPropertyView( const string_view propName, string_view & propValue ) const
+{
+  if( NULL != this->mpProperties )
+    return( this->mpProperties->getPropertyView( propName, propValue ) );
+
+  if( NULL != this->mpCPF )
+  {
+    const DBPF_propertyType * item = this->mpCPF->findProperty( propName );
+    if( NULL == item || CPF_STRING != item->miType )
+      return false;
+
+    propValue = this->mpCPF->getStringView( *item );
+    return true;
+  }
+
+  return false;
+}
+
+
 // this sets the mbChanged flag if the new propValue is different, and adjusts change in raw byte count
 bool DBPF_resourceType::setPropertyValue( const string propName, string & propValue )
 {
@@ -290,7 +317,8 @@ bool DBPF_resourceType::setPropertyValue( const string propName, DBPF_CPFitemTyp
 // -----------------------------------------------
 
 
-DBPF_undecodedType::DBPF_undecodedType()
+DBPF_undecodedType::DBPF_undecodedType( DBPF_arenaType * pArena )
+: DBPF_resourceType( pArena )
 {
   this->mpRawBytes = NULL;
   clear();
@@ -349,3 +377,93 @@ void DBPF_undecodedType::dump( FILE * f ) const
   fprintf( f, "\n" );
 }
 #endif
+
+
+// -------------------------------------------------
+
+
+DBPF_passThroughType::DBPF_passThroughType( DBPF_arenaType * pArena )
+: DBPF_resourceType( pArena ),
+  muSourceLocation( 0 ),
+  mbCompressed( false ),
+  muDecompressedSize( 0 )
+{
+  this->mpRawBytes = NULL;
+  clear();
+}
+
+
+DBPF_passThroughType::~DBPF_passThroughType()
+{
+  clear();
+}
+
+
+/**
+<pre>
+ * input:   entry - index entry of this resource in the source package
+ *          bCompressed, decmpSize - from DBPFtype::isCompressed for that entry
+ * returns: success / failure
+ *
+ * purpose: init without reading any data, the bytes stay in the source file
+</pre>
+**/
+bool DBPF_passThroughType::initFromSource( const DBPFindexType & entry, const bool bCompressed, const unsigned int decmpSize )
+{
+  this->mbInitialized = false;
+  clear();
+
+  this->initIndexEntry( entry );
+
+  this->muSourceLocation = entry.muLocation;
+  this->muRawBytesCount = entry.muSize;
+  this->mbCompressed = bCompressed;
+  this->muDecompressedSize = bCompressed ? decmpSize : entry.muSize;
+
+  this->mbInitialized = true;
+
+  return true;
+}
+
+
+bool DBPF_passThroughType::initFromByteStream(
+  const DBPFindexType & /*entry*/, unsigned char * /*data*/, const unsigned int /*byteCountToRead*/ )
+{
+  fprintf( stderr, "ERROR: DBPF_passThroughType.initFromByteStream, pass-through resources are not read, use initFromSource\n" );
+  return false;
+}
+
+
+// nothing is decoded, nothing can change
+bool DBPF_passThroughType::updateRawBytes()
+{
+  return true;
+}
+
+
+/**
+ * compressed or not, as it was in the source package (there are no raw bytes to look at)
+**/
+bool DBPF_passThroughType::isCompressed( unsigned int & cmprByteCount, unsigned int & uncByteCount ) const
+{
+  if( this->mbInitialized == false )
+    return false;
+
+  if( false == this->mbCompressed )
+    return false;
+
+  cmprByteCount = this->muRawBytesCount;
+  uncByteCount = this->muDecompressedSize;
+  return true;
+}
+
+
+#ifdef _DEBUG
+void DBPF_passThroughType::dump( FILE * f ) const
+{
+  DBPF_resourceType::dump( f );
+
+  fprintf( f, "pass-through, bytes are at 0x%x in the source package\n", this->muSourceLocation );
+  fprintf( f, "\n" );
+}
+#endif
@@ -16,7 +16,9 @@
 #define DBPF_RESOURCE_H_CATOFEVILGENIUS
 
 #include <string>
+#include <memory_resource>
 #include "DBPF.h" // index entry type
+#include "DBPF_arena.h"
 #include "DBPF_CPF.h" // properties, set of name/value pairs
 #include "DBPF_types.h" // TGIR
 using namespace std;
@@ -27,7 +29,9 @@ class DBPF_resourceType
 {
 public:
   // this should call clear, set mpRawBytes to NULL (do this in all subclasses!)
-  DBPF_resourceType();
+  // pArena - where this resource's bytes, CPF, and name go, NULL for the heap (see DBPF_arena.h),
+  //          a resource in an arena must be made there, with DBPF_arenaType::make
+  explicit DBPF_resourceType( DBPF_arenaType * pArena = NULL );
 
   // this should call clear
   virtual ~DBPF_resourceType();
@@ -53,6 +57,7 @@ public:
    * save data and byteCountToRead and mpRawBytes and muRawBytesCount,
    * call initTGI, do init of other class specific stuff,
    * then set mbInitialized to true
+   * the resource owns data from then on, it must be from new [], or from dbpfNewBytes( getArena(), ... )
   </pre>
   **/
   virtual bool initFromByteStream(
@@ -75,6 +80,8 @@ public:
    * To get the size of the byte array, in bytes, use getRawByteCount.
    * The bytes are only valid if the changed flag is false.
    * If the changed flag is true, use updateRawBytes before calling getRawBytes.
+   * NULL for pass-through resources (check isPassThrough first),
+   * their bytes are still in the source package, getRawByteCount is their size there.
   </pre>
   **/
   const unsigned char * getRawBytes() const { return this->mpRawBytes; }
@@ -92,7 +99,13 @@ public:
   bool compressRawBytes();
 
   // check if this resource is compressed, if so, what's the compressed and uncompressed sizes
-  bool isCompressed( unsigned int & cmprByteCount, unsigned int & uncByteCount ) const;
+  virtual bool isCompressed( unsigned int & cmprByteCount, unsigned int & uncByteCount ) const;
+
+  // true for resources whose bytes stay in the source package, see DBPF_passThroughType
+  virtual bool isPassThrough() const { return false; }
+
+  // arena this resource lives in, NULL if it's on the heap
+  DBPF_arenaType * getArena() const { return this->mpArena; }
 
 
   bool isInitialized() const { return this->mbInitialized; }
@@ -120,12 +133,22 @@ public:
   bool setPropertyValue( const string propName, DBPF_CPFitemType & propValue );
   bool getPropertyValue( const string propName, DBPF_CPFitemType & propValue ) const;
 
+  // string property of either kind, without copying,
+  // the view is valid until the resource is changed, updated, compressed, or cleared
+  bool getPropertyView( const string_view propName, string_view & propValue ) const;
+
 
 protected:
   DBPFindexType mMyIndexEntry;
   void initIndexEntry( const DBPFindexType & entry );
 
+  // as isCompressed, but also while changed, for updateRawBytes
+  bool areRawBytesCompressed( unsigned int & uncByteCount ) const;
+
 protected:
+  // NULL, or where mpRawBytes, mpProperties, mpCPF, and the name strings are allocated
+  DBPF_arenaType * mpArena;
+
   // if this is true, initFromByteStream has been done
   bool mbInitialized;
 
@@ -145,13 +168,13 @@ protected:
   **/
   unsigned char * mpRawBytes;
 
-  string mstrName;
-  string mstrDesc;
+  pmr::string mstrName;
+  pmr::string mstrDesc;
 
 public:
   /**
    * set of string key/value pairs, not all resource types have properties, but many do,
-   * subclasses that use mpProperties must allocate it with new before doing stuff with it
+   * subclasses that use mpProperties must allocate it with dbpfNew( mpArena, ... ) before doing stuff with it
   **/
   DBPF_propertiesType * mpProperties;
 
@@ -166,7 +189,7 @@ public:
 class DBPF_undecodedType : public DBPF_resourceType
 {
 public:
-  DBPF_undecodedType();
+  explicit DBPF_undecodedType( DBPF_arenaType * pArena = NULL );
   ~DBPF_undecodedType();
 
   bool initFromByteStream( const DBPFindexType & entry, unsigned char * data, const unsigned int byteCountToRead );
@@ -178,5 +201,46 @@ public:
 };
 
 
+/**
+<pre>
+ * A resource that is not read into memory at all.
+ * It remembers where its bytes are in the source package,
+ * and DBPFtype::write copies them straight from that file to the new one
+ * (with copy_file_range where the OS has it).
+ * Use readPackage with bPassThrough = true to get these for untouched types.
+ * getRawBytes returns NULL, there are no bytes to change.
+</pre>
+**/
+class DBPF_passThroughType : public DBPF_resourceType
+{
+public:
+  explicit DBPF_passThroughType( DBPF_arenaType * pArena = NULL );
+  ~DBPF_passThroughType();
+
+  // entry - index entry from the source package, decmpSize is 0 if not compressed
+  bool initFromSource( const DBPFindexType & entry, const bool bCompressed, const unsigned int decmpSize );
+
+  // not used, there is no byte stream, returns false
+  bool initFromByteStream( const DBPFindexType & entry, unsigned char * data, const unsigned int byteCountToRead );
+  bool updateRawBytes();
+
+  bool isCompressed( unsigned int & cmprByteCount, unsigned int & uncByteCount ) const;
+  bool isPassThrough() const { return true; }
+
+  // where this resource's bytes are in the source package
+  unsigned int getSourceLocation() const { return this->muSourceLocation; }
+
+private:
+  unsigned int muSourceLocation;
+  bool mbCompressed;
+  unsigned int muDecompressedSize;
+
+#ifdef _DEBUG
+public:
+  void dump( FILE * f ) const;
+#endif
+};
+
+
 // DBPF_RESOURCE_H_CATOFEVILGENIUS
 #endif
@@ -0,0 +1,647 @@
+/**
+ * file: DBPF_transaction.cpp
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_transactionType - several edits to one package, written in one go
+**/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <io.h>      // _chsize
+#else
+#include <unistd.h>  // ftruncate
+#endif
+
+#include "DBPF_transaction.h"
+#include "DBPF_resource.h"
+#include "../../benrq/dbpf.h"
+
+
+// -------------------------------------------------------------------------
+// file callbacks for benrq's library, stdio
+
+
+static int transactionRead( void * ctx, int start, int length, void * buf, const char ** error )
+{
+  FILE * f = (FILE *)ctx;
+  if( 0 == fseek( f, start, SEEK_SET )
+   && fread( buf, 1, length, f ) == (size_t)length )
+    return 0;
+
+  *error = ferror( f ) ? "read error" : "unexpected end of file while reading";
+  return -1;
+}
+
+
+// length 0 means truncate the file at start
+static int transactionWrite( void * ctx, int start, int length, const void * buf, const char ** error )
+{
+  FILE * f = (FILE *)ctx;
+
+  if( 0 == length )
+  {
+    fflush( f );
+#if defined(_WIN32)
+    if( 0 == _chsize( _fileno( f ), start ) )
+      return 0;
+#else
+    if( 0 == ftruncate( fileno( f ), start ) )
+      return 0;
+#endif
+    *error = "truncate error";
+    return -1;
+  }
+
+  if( 0 == fseek( f, start, SEEK_SET )
+   && fwrite( buf, 1, length, f ) == (size_t)length )
+    return 0;
+
+  *error = "write error";
+  return -1;
+}
+
+
+static int transactionClose( void * ctx )
+{
+  return fclose( (FILE *)ctx );
+}
+
+
+// data for dbpf_write / dbpf_append, ctx is a vector of pointers, one per new index entry
+static const unsigned char * transactionGetData( void * ctx, int entryIndex, const char ** error )
+{
+  vector< const unsigned char * > & data = *(vector< const unsigned char * > *)ctx;
+  if( NULL == data[entryIndex] )
+    *error = "no data for a changed resource (bug)";
+  return data[entryIndex];
+}
+
+
+// -------------------------------------------------------------------------
+
+
+bool DBPF_lessTGIRtype::operator()( const DBPF_TGIRtype & a, const DBPF_TGIRtype & b ) const
+{
+  if( a.muTypeID != b.muTypeID )
+    return( a.muTypeID < b.muTypeID );
+  if( a.muGroupID != b.muGroupID )
+    return( a.muGroupID < b.muGroupID );
+  if( a.muInstanceID != b.muInstanceID )
+    return( a.muInstanceID < b.muInstanceID );
+  return( a.muResourceID < b.muResourceID );
+}
+
+
+static void entryToTGIR( const dbpf_entry & e, DBPF_TGIRtype & tgir )
+{
+  tgir.muTypeID = e.type_id;
+  tgir.muGroupID = e.group_id;
+  tgir.muInstanceID = e.instance_id;
+  tgir.muResourceID = e.instance_id_2;
+}
+
+
+static void tgirToEntry( const DBPF_TGIRtype & tgir, dbpf_entry & e )
+{
+  memset( &e, 0, sizeof( e ) );
+  e.type_id = tgir.muTypeID;
+  e.group_id = tgir.muGroupID;
+  e.instance_id = tgir.muInstanceID;
+  e.instance_id_2 = tgir.muResourceID;
+}
+
+
+// orders benrq entry numbers by the TGI of their entries
+class lessEntryNumber
+{
+public:
+  const dbpf_entry * mpEntries;
+  lessEntryNumber( const dbpf_entry * pEntries ) : mpEntries( pEntries ) {}
+  bool operator()( const int a, const int b ) const
+  { return( dbpf_compare_entries( &mpEntries[a], &mpEntries[b] ) < 0 ); }
+};
+
+
+// -------------------------------------------------------------------------
+
+
+DBPF_transactionType::DBPF_transactionType()
+: mpDBPF( NULL ), miLastCommitMethod( COMMIT_NOTHING )
+{
+}
+
+
+DBPF_transactionType::~DBPF_transactionType()
+{
+  this->close();
+}
+
+
+/**
+<pre>
+ * input:   fileName - package to edit, it must exist and be writable
+ * returns: success / failure
+ *
+ * purpose: read the package's index, nothing else is read until it is needed
+</pre>
+**/
+bool DBPF_transactionType::open( const char * fileName )
+{
+  this->close();
+
+  if( NULL == fileName )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.open, NULL file name\n" );
+    return false;
+  }
+
+  FILE * f = fopen( fileName, "r+b" );
+  if( NULL == f )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.open, can't open %s for writing\n", fileName );
+    return false;
+  }
+
+  // on failure dbpf_open closes f
+  const char * error = "unknown error";
+  this->mpDBPF = dbpf_open( f, transactionRead, transactionWrite, transactionClose, &error );
+  if( NULL == this->mpDBPF )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.open, %s: %s\n", fileName, error );
+    return false;
+  }
+
+  this->mstrFileName.assign( fileName );
+  this->sortEntries();
+  return true;
+}
+
+
+void DBPF_transactionType::close()
+{
+  if( NULL != this->mpDBPF )
+    dbpf_close( this->mpDBPF );
+  this->mpDBPF = NULL;
+  this->mstrFileName.clear();
+  this->mSortedEntries.clear();
+  this->mEdits.clear();
+}
+
+
+void DBPF_transactionType::sortEntries()
+{
+  const int entryCount = dbpf_get_entry_count( this->mpDBPF );
+  this->mSortedEntries.resize( entryCount );
+  for( int i = 0; i < entryCount; ++i )
+    this->mSortedEntries[i] = i;
+
+  sort( this->mSortedEntries.begin(), this->mSortedEntries.end(),
+        lessEntryNumber( dbpf_get_entries( this->mpDBPF ) ) );
+}
+
+
+// benrq entry number for tgir, -1 if the package doesn't have it
+int DBPF_transactionType::findEntry( const DBPF_TGIRtype & tgir ) const
+{
+  if( NULL == this->mpDBPF )
+    return -1;
+
+  const dbpf_entry * entries = dbpf_get_entries( this->mpDBPF );
+  dbpf_entry key;
+  tgirToEntry( tgir, key );
+
+  size_t lo = 0, hi = this->mSortedEntries.size();
+  while( lo < hi )
+  {
+    size_t mid = ( lo + hi ) / 2;
+    int cmp = dbpf_compare_entries( &entries[this->mSortedEntries[mid]], &key );
+    if( 0 == cmp )
+      return this->mSortedEntries[mid];
+    if( cmp < 0 )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return -1;
+}
+
+
+unsigned int DBPF_transactionType::getItemCount() const
+{
+  if( NULL == this->mpDBPF )
+    return 0;
+  return (unsigned int)( dbpf_get_entry_count( this->mpDBPF ) );
+}
+
+
+bool DBPF_transactionType::getIndexEntry( const unsigned int k, DBPFindexType & entry ) const
+{
+  if( k >= this->getItemCount() )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.getIndexEntry, k out of bounds, is %u, must be < %u\n",
+             k, this->getItemCount() );
+    return false;
+  }
+
+  const dbpf_entry & e = dbpf_get_entries( this->mpDBPF )[k];
+  entry.muTypeID = e.type_id;
+  entry.muGroupID = e.group_id;
+  entry.muInstanceID = e.instance_id;
+  entry.muInstanceID2 = e.instance_id_2;
+  entry.muLocation = (unsigned int)( e.offset_in_file );
+  entry.muSize = (unsigned int)( e.size_in_file );
+  return true;
+}
+
+
+// true if the package has this resource, counting pending edits
+bool DBPF_transactionType::contains( const DBPF_TGIRtype & tgir ) const
+{
+  map< DBPF_TGIRtype, DBPF_transactionEditType, DBPF_lessTGIRtype >::const_iterator it = this->mEdits.find( tgir );
+  if( it != this->mEdits.end() )
+    return( DBPF_transactionEditType::EDIT_REMOVE != it->second.miAction );
+
+  return( this->findEntry( tgir ) >= 0 );
+}
+
+
+/**
+<pre>
+ * input:   tgir - resource to get
+ * output:  bytes - its uncompressed data, with any pending edits
+ * returns: success / failure
+</pre>
+**/
+bool DBPF_transactionType::getData( const DBPF_TGIRtype & tgir, vector< unsigned char > & bytes )
+{
+  bytes.clear();
+
+  map< DBPF_TGIRtype, DBPF_transactionEditType, DBPF_lessTGIRtype >::const_iterator it = this->mEdits.find( tgir );
+  if( it != this->mEdits.end() )
+  {
+    if( DBPF_transactionEditType::EDIT_REMOVE == it->second.miAction )
+    { fprintf( stderr, "ERROR: DBPF_transactionType.getData, resource was removed\n" );
+      return false;
+    }
+    bytes = it->second.mBytes;
+    return true;
+  }
+
+  int k = this->findEntry( tgir );
+  if( k < 0 )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.getData, no resource %x %x %x %x\n",
+             tgir.muTypeID, tgir.muGroupID, tgir.muInstanceID, tgir.muResourceID );
+    return false;
+  }
+
+  const dbpf_entry & e = dbpf_get_entries( this->mpDBPF )[k];
+  bytes.resize( e.size );
+  if( 0 == e.size )
+    return true;
+
+  const char * error = "unknown error";
+  if( dbpf_read( this->mpDBPF, k, &bytes[0], &error ) < 0 )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.getData, %s\n", error );
+    bytes.clear();
+    return false;
+  }
+
+  return true;
+}
+
+
+// decodes the current data of a resource with its library class, delete the result when done
+DBPF_resourceType * DBPF_transactionType::decode( const DBPF_TGIRtype & tgir )
+{
+  vector< unsigned char > bytes;
+  if( false == this->getData( tgir, bytes ) )
+    return NULL;
+
+  DBPF_resourceType * pResource = newDecodedResource( tgir.muTypeID );
+  if( NULL == pResource )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.decode, can't decode resources of type %x\n", tgir.muTypeID );
+    return NULL;
+  }
+
+  // the resource owns the data after this
+  unsigned char * data = new unsigned char[ bytes.size() + 1 ];
+  if( false == bytes.empty() )
+    memcpy( data, &bytes[0], bytes.size() );
+
+  DBPFindexType entry;
+  entry.muTypeID = tgir.muTypeID;
+  entry.muGroupID = tgir.muGroupID;
+  entry.muInstanceID = tgir.muInstanceID;
+  entry.muInstanceID2 = tgir.muResourceID;
+  entry.muSize = (unsigned int)( bytes.size() );
+
+  if( false == pResource->initFromByteStream( entry, data, (unsigned int)( bytes.size() ) ) )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.decode, failed to decode resource of type %x\n", tgir.muTypeID );
+    delete pResource;
+    return NULL;
+  }
+
+  return pResource;
+}
+
+
+// if the decoded resource changed, re-encode it and keep the bytes as a pending edit
+bool DBPF_transactionType::keepEncoded( const DBPF_TGIRtype & tgir, DBPF_resourceType * pResource )
+{
+  if( false == pResource->isChanged() )
+    return true;
+
+  if( false == pResource->updateRawBytes() )
+    return false;
+
+  // no bytes in memory to keep
+  if( pResource->isPassThrough() )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.keepEncoded, pass-through resource %x has no bytes\n", tgir.muTypeID );
+    return false;
+  }
+
+  return( this->replaceData( tgir, pResource->getRawBytes(), pResource->getRawByteCount() ) );
+}
+
+
+bool DBPF_transactionType::setPropertyValue( const DBPF_TGIRtype & tgir, const string propName, string & propValue )
+{
+  DBPF_resourceType * pResource = this->decode( tgir );
+  if( NULL == pResource )
+    return false;
+
+  bool bOK = pResource->setPropertyValue( propName, propValue )
+          && this->keepEncoded( tgir, pResource );
+
+  delete pResource;
+  return bOK;
+}
+
+
+bool DBPF_transactionType::setPropertyValue( const DBPF_TGIRtype & tgir, const string propName, DBPF_CPFitemType & propValue )
+{
+  DBPF_resourceType * pResource = this->decode( tgir );
+  if( NULL == pResource )
+    return false;
+
+  bool bOK = pResource->setPropertyValue( propName, propValue )
+          && this->keepEncoded( tgir, pResource );
+
+  delete pResource;
+  return bOK;
+}
+
+
+/**
+<pre>
+ * input:   tgir - resource to change, must be in the package (or added in this transaction)
+ *          bytes, byteCount - new uncompressed data, copied
+ * returns: success / failure
+</pre>
+**/
+bool DBPF_transactionType::replaceData( const DBPF_TGIRtype & tgir, const unsigned char * bytes, const unsigned int byteCount )
+{
+  if( NULL == bytes && byteCount > 0 )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.replaceData, NULL data\n" );
+    return false;
+  }
+
+  if( false == this->contains( tgir ) )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.replaceData, no resource %x %x %x %x, use add\n",
+             tgir.muTypeID, tgir.muGroupID, tgir.muInstanceID, tgir.muResourceID );
+    return false;
+  }
+
+  // an added resource stays added
+  DBPF_transactionEditType & edit = this->mEdits[tgir];
+  if( DBPF_transactionEditType::EDIT_ADD != edit.miAction )
+    edit.miAction = DBPF_transactionEditType::EDIT_REPLACE;
+  edit.mBytes.assign( bytes, bytes + byteCount );
+  return true;
+}
+
+
+bool DBPF_transactionType::remove( const DBPF_TGIRtype & tgir )
+{
+  if( false == this->contains( tgir ) )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.remove, no resource %x %x %x %x\n",
+             tgir.muTypeID, tgir.muGroupID, tgir.muInstanceID, tgir.muResourceID );
+    return false;
+  }
+
+  // added in this transaction?  then there's nothing to remove from the file
+  if( this->findEntry( tgir ) < 0 )
+  {
+    this->mEdits.erase( tgir );
+    return true;
+  }
+
+  DBPF_transactionEditType & edit = this->mEdits[tgir];
+  edit.miAction = DBPF_transactionEditType::EDIT_REMOVE;
+  edit.mBytes.clear();
+  return true;
+}
+
+
+bool DBPF_transactionType::add( const DBPF_TGIRtype & tgir, const unsigned char * bytes, const unsigned int byteCount )
+{
+  if( NULL == this->mpDBPF )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.add, no package open\n" );
+    return false;
+  }
+
+  if( NULL == bytes && byteCount > 0 )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.add, NULL data\n" );
+    return false;
+  }
+
+  if( DBPF_DIR == tgir.muTypeID )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.add, can't add a DIR, it is made by commit\n" );
+    return false;
+  }
+
+  if( true == this->contains( tgir ) )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.add, already have resource %x %x %x %x, use replaceData\n",
+             tgir.muTypeID, tgir.muGroupID, tgir.muInstanceID, tgir.muResourceID );
+    return false;
+  }
+
+  // removed earlier in this transaction?  then it's a replacement
+  DBPF_transactionEditType & edit = this->mEdits[tgir];
+  edit.miAction = ( this->findEntry( tgir ) >= 0 ) ? DBPF_transactionEditType::EDIT_REPLACE
+                                                   : DBPF_transactionEditType::EDIT_ADD;
+  edit.mBytes.assign( bytes, bytes + byteCount );
+  return true;
+}
+
+
+/**
+<pre>
+ * returns: IN_PLACE_DONE - every edit was written in place
+ *          IN_PLACE_NOT_APPLICABLE - some are left for commit to write another way,
+ *                                    the ones written in place are no longer pending
+ *          IN_PLACE_ERROR - a write failed, the package may be damaged, don't write it again
+ *
+ * purpose: replacements with the same size as before are written over the old data,
+ *          only done if all edits are like that, or there'd be no point
+</pre>
+**/
+int DBPF_transactionType::commitInPlace()
+{
+  const dbpf_entry * entries = dbpf_get_entries( this->mpDBPF );
+
+  map< DBPF_TGIRtype, DBPF_transactionEditType, DBPF_lessTGIRtype >::iterator it;
+  for( it = this->mEdits.begin(); it != this->mEdits.end(); ++it )
+  {
+    if( DBPF_transactionEditType::EDIT_REPLACE != it->second.miAction )
+      return IN_PLACE_NOT_APPLICABLE;
+    int k = this->findEntry( it->first );
+    if( k < 0 || entries[k].size != (int)( it->second.mBytes.size() ) )
+      return IN_PLACE_NOT_APPLICABLE;
+  }
+
+  // a compressed resource may not compress to the same size, that one is left for commit
+  const char * error = "unknown error";
+  it = this->mEdits.begin();
+  while( it != this->mEdits.end() )
+  {
+    int k = this->findEntry( it->first );
+    const unsigned char * bytes = it->second.mBytes.empty() ? (const unsigned char *)"" : &it->second.mBytes[0];
+    int rtn = dbpf_update_in_place( this->mpDBPF, k, bytes, &error );
+    if( rtn < 0 )
+    { fprintf( stderr, "ERROR: DBPF_transactionType.commitInPlace, %s, %s may be damaged\n",
+               error, this->mstrFileName.c_str() );
+      return IN_PLACE_ERROR;
+    }
+    if( rtn > 0 )
+      this->mEdits.erase( it++ );
+    else
+      ++it;
+  }
+
+  return this->mEdits.empty() ? IN_PLACE_DONE : IN_PLACE_NOT_APPLICABLE;
+}
+
+
+/**
+<pre>
+ * returns: success / failure, on failure the edits that weren't written are still pending,
+ *          same size replacements may already have been written in place (see getEditCount)
+ *
+ * purpose: write all pending edits to the package,
+ *          in place if they all fit, otherwise with one new index table,
+ *          appended at the end of the file if that won't leave it too fragmented,
+ *          otherwise reusing the holes in the file
+</pre>
+**/
+bool DBPF_transactionType::commit()
+{
+  this->miLastCommitMethod = COMMIT_NOTHING;
+
+  if( NULL == this->mpDBPF )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.commit, no package open\n" );
+    return false;
+  }
+
+  if( true == this->mEdits.empty() )
+    return true;
+
+  this->miLastCommitMethod = COMMIT_IN_PLACE;
+  int inPlace = this->commitInPlace();
+  if( IN_PLACE_DONE == inPlace )
+    return true;
+  if( IN_PLACE_ERROR == inPlace )
+    return false;  // don't write more to a package that may be damaged
+
+  // new index, unchanged entries are kept where they are
+
+  const int entryCount = dbpf_get_entry_count( this->mpDBPF );
+  const dbpf_entry * entries = dbpf_get_entries( this->mpDBPF );
+
+  vector< dbpf_entry > newEntries;
+  vector< const unsigned char * > data;
+  newEntries.reserve( entryCount + this->mEdits.size() );
+  data.reserve( entryCount + this->mEdits.size() );
+
+  double supersededBytes = 0;  // becomes holes
+  double writtenBytes = 0;
+  double fileEnd = DBPF_HEADER_SIZE;
+
+  DBPF_TGIRtype tgir;
+  map< DBPF_TGIRtype, DBPF_transactionEditType, DBPF_lessTGIRtype >::iterator it;
+
+  for( int i = 0; i < entryCount; ++i )
+  {
+    const dbpf_entry & e = entries[i];
+    if( fileEnd < (double)e.offset_in_file + e.size_in_file )
+      fileEnd = (double)e.offset_in_file + e.size_in_file;
+
+    entryToTGIR( e, tgir );
+    it = this->mEdits.find( tgir );
+    if( it == this->mEdits.end() )
+    {
+      newEntries.push_back( e );
+      newEntries.back().write_disposition = dbpf_write_keep_existing;
+      data.push_back( NULL );
+      continue;
+    }
+
+    supersededBytes += e.size_in_file;
+    if( DBPF_transactionEditType::EDIT_REMOVE == it->second.miAction )
+      continue;
+
+    newEntries.push_back( e );
+    newEntries.back().size = (int)( it->second.mBytes.size() );
+    newEntries.back().write_disposition = e.compressed_in_file ? dbpf_write_compressed : dbpf_write_uncompressed;
+    data.push_back( it->second.mBytes.empty() ? (const unsigned char *)"" : &it->second.mBytes[0] );
+    writtenBytes += it->second.mBytes.size();
+  }
+
+  for( it = this->mEdits.begin(); it != this->mEdits.end(); ++it )
+  {
+    if( DBPF_transactionEditType::EDIT_ADD != it->second.miAction )
+      continue;
+
+    dbpf_entry e;
+    tgirToEntry( it->first, e );
+    e.size = (int)( it->second.mBytes.size() );
+    e.write_disposition = dbpf_write_compressed;
+    newEntries.push_back( e );
+    data.push_back( it->second.mBytes.empty() ? (const unsigned char *)"" : &it->second.mBytes[0] );
+    writtenBytes += it->second.mBytes.size();
+  }
+
+  // append, unless the holes it leaves (old ones plus what it supersedes) would be too much,
+  // written size is uncompressed, so this errs toward a rewrite
+
+  double fragmentation = dbpf_get_fragmentation( this->mpDBPF );
+  double holesAfterAppend = fragmentation * fileEnd + supersededBytes;
+  bool bAppend = ( fragmentation >= 0 )
+              && ( holesAfterAppend <= DBPF_TRANSACTION_MAX_APPEND_FRAGMENTATION * ( fileEnd + writtenBytes ) );
+
+  const char * error = "unknown error";
+  dbpf_entry * pNewEntries = newEntries.empty() ? NULL : &newEntries[0];
+  int rtn;
+  if( bAppend )
+  {
+    this->miLastCommitMethod = COMMIT_APPEND;
+    rtn = dbpf_append( this->mpDBPF, pNewEntries, (int)( newEntries.size() ), &data, transactionGetData, &error );
+  }
+  else
+  {
+    this->miLastCommitMethod = COMMIT_REWRITE;
+    rtn = dbpf_write( this->mpDBPF, pNewEntries, (int)( newEntries.size() ), &data, transactionGetData, &error );
+  }
+
+  if( rtn < 0 )
+  { fprintf( stderr, "ERROR: DBPF_transactionType.commit, %s, %u pending edits to %s were not written\n",
+             error, (unsigned int)( this->mEdits.size() ), this->mstrFileName.c_str() );
+    this->miLastCommitMethod = COMMIT_NOTHING;
+    return false;
+  }
+
+  this->mEdits.clear();
+  this->sortEntries();
+  return true;
+}
@@ -0,0 +1,147 @@
+/**
+ * file: DBPF_transaction.h
+ * author: CatOfEvilGenius
+ *
+ * class DBPF_transactionType - several edits to one package, written in one go
+**/
+
+#ifndef DBPF_TRANSACTION_H_CATOFEVILGENIUS
+#define DBPF_TRANSACTION_H_CATOFEVILGENIUS
+
+#include <string>
+#include <vector>
+#include <map>
+#include "DBPF.h"
+#include "DBPF_CPF.h"   // DBPF_CPFitemType
+#include "DBPF_types.h" // TGIR
+
+using namespace std;
+
+// benrq's package handle, see benrq/dbpf.h
+struct DBPF;
+
+
+// commit uses append instead of a full rewrite while the package is at most this fraction holes
+#define DBPF_TRANSACTION_MAX_APPEND_FRAGMENTATION 0.25
+
+
+// order of TGIRs, for looking up pending edits
+class DBPF_lessTGIRtype
+{
+public:
+  bool operator()( const DBPF_TGIRtype & a, const DBPF_TGIRtype & b ) const;
+};
+
+
+/**
+<pre>
+ * one pending edit of a DBPF_transactionType
+</pre>
+**/
+class DBPF_transactionEditType
+{
+public:
+  enum { EDIT_REPLACE, EDIT_REMOVE, EDIT_ADD };
+
+  int miAction;
+
+  // new uncompressed data, for EDIT_REPLACE and EDIT_ADD
+  vector< unsigned char > mBytes;
+
+  DBPF_transactionEditType() : miAction( EDIT_REPLACE ) {}
+};
+
+
+/**
+<pre>
+ * Transaction, several edits to one package
+ * =========================================
+ *
+ * Each tool pass used to read and rewrite the whole package.
+ * This class collects edits instead, and commit writes them all at once,
+ * with one new index table.
+ *
+ * - open the package, then make any number of edits:
+ * --- setPropertyValue, decodes the resource with its library class (TXMT, GZPS, XHTN, BINX...),
+ *     changes the property, and keeps the re-encoded bytes
+ * --- replaceData, new bytes for a resource
+ * --- remove, take a resource out of the package
+ * --- add, a new resource
+ * - edits see earlier edits in the same transaction, so you can set several properties of one resource
+ * - commit writes the edits, rollback forgets them
+ *
+ * commit picks how to write (see getLastCommitMethod):
+ * - in place, if every edit is a replacement with the same size as before (and still fits, if compressed)
+ * - append, new data and index go at the end of the file, if the file isn't too fragmented
+ * - rewrite, new data goes in the holes, index is rewritten
+ * Append and rewrite are safe, if they fail the package is unchanged.
+ * In place writes over the old data, one resource at a time,
+ * a write error there leaves the package possibly damaged, and commit stops.
+ * A compressed one that doesn't fit is left for append or rewrite, the others are already written,
+ * so after a failed commit, getEditCount says what is still pending.
+ *
+ * The package is written with benrq's library, so the file is not copied,
+ * unchanged resources stay where they are.
+</pre>
+**/
+class DBPF_transactionType
+{
+public:
+  enum { COMMIT_NOTHING, COMMIT_IN_PLACE, COMMIT_APPEND, COMMIT_REWRITE };
+
+private:
+  DBPF * mpDBPF;
+  string mstrFileName;
+
+  // benrq entry numbers, sorted by TGI, for lookups
+  vector< int > mSortedEntries;
+
+  map< DBPF_TGIRtype, DBPF_transactionEditType, DBPF_lessTGIRtype > mEdits;
+
+  int miLastCommitMethod;
+
+public:
+  DBPF_transactionType();
+  ~DBPF_transactionType();
+
+  bool open( const char * fileName );
+  void close();  // forgets pending edits
+  bool isOpen() const { return( NULL != this->mpDBPF ); }
+
+  // resources in the package, as of the last commit
+  unsigned int getItemCount() const;
+  bool getIndexEntry( const unsigned int k, DBPFindexType & entry ) const;
+
+  // these two include pending edits
+  bool contains( const DBPF_TGIRtype & tgir ) const;
+  bool getData( const DBPF_TGIRtype & tgir, vector< unsigned char > & bytes );
+
+  // edits
+  bool setPropertyValue( const DBPF_TGIRtype & tgir, const string propName, string & propValue );            // TXMT
+  bool setPropertyValue( const DBPF_TGIRtype & tgir, const string propName, DBPF_CPFitemType & propValue );  // GZPS, XHTN, BINX
+  bool replaceData( const DBPF_TGIRtype & tgir, const unsigned char * bytes, const unsigned int byteCount );
+  bool remove( const DBPF_TGIRtype & tgir );
+  bool add( const DBPF_TGIRtype & tgir, const unsigned char * bytes, const unsigned int byteCount );
+
+  unsigned int getEditCount() const { return (unsigned int)( this->mEdits.size() ); }
+  bool commit();
+  void rollback() { this->mEdits.clear(); }
+
+  int getLastCommitMethod() const { return this->miLastCommitMethod; }
+
+private:
+  int findEntry( const DBPF_TGIRtype & tgir ) const;
+  void sortEntries();
+  DBPF_resourceType * decode( const DBPF_TGIRtype & tgir );
+  bool keepEncoded( const DBPF_TGIRtype & tgir, DBPF_resourceType * pResource );
+  enum { IN_PLACE_DONE, IN_PLACE_NOT_APPLICABLE, IN_PLACE_ERROR };
+  int commitInPlace();
+
+  // not copyable, owns the package handle
+  DBPF_transactionType( const DBPF_transactionType & );
+  DBPF_transactionType & operator=( const DBPF_transactionType & );
+};
+
+
+// DBPF_TRANSACTION_H_CATOFEVILGENIUS
+#endif
@@ -0,0 +1,280 @@
+/**
+ * file: DBPF_typeRegistry.cpp
+ * author: CatOfEvilGenius
+ *
+ * the resource type table, and a perfect hash for looking types up in it,
+ * both built by the compiler
+**/
+
+#include <cstdlib>
+
+#include "DBPF_typeRegistry.h"
+#include "DBPF_3IDR.h"
+#include "DBPF_BINX.h"
+#include "DBPF_GZPS.h"
+#include "DBPF_STR.h"
+#include "DBPF_TXMT.h"
+#include "DBPF_TXTR.h"
+#include "DBPF_XHTN.h"
+
+
+template< class T >
+static DBPF_resourceType * newResource( DBPF_arenaType * pArena )
+{ return ( NULL == pArena ) ? new T() : pArena->make< T >( pArena ); }
+
+
+// SimPE's database of type ID information, from tgi.xml (Revision 312, 2007 Mar 14),
+// as copied into benrq/dbpf.cpp, sorted by type ID
+//   type ID, file name in first 64 bytes, extension, short name, long name, decoder
+static constexpr DBPF_typeInfoType gTypes[] = {
+  { 0x00000000, false, "uiScript", "UI",      "UI Data",                           NULL },
+  { 0x0A284D0B, false, NULL,       "WGRA",    "Wall Graph",                        NULL },
+  { 0x0B9EB87E, false, NULL,       "TRKS",    "Track Settings",                    NULL },
+  { 0x0BF999E7, false, NULL,       "DESC",    "Lot Description",                   NULL }, // SimPE: LTXT
+  { 0x0C1FE246, false, "xml",      "XMOL",    "Mesh Overlay XML",                  NULL },
+  { 0x0C560F39, false, NULL,       "BINX",    "Binary Index",                      newResource< DBPF_BINXtype > },
+  { 0x0C7E9A76, false, "jpg",      "JPG",     "JPEG Image",                        NULL },
+  { 0x0C900FDB, false, NULL,       "POOL",    "UNK: 0x0C900FDB",                   NULL }, // SimPE: UNK
+  { 0x0C93E3DE, false, "xml",      "XFMD",    "Face Modifier XML",                 NULL },
+  { 0x104F6A6E, false, NULL,       "BNFO",    "Business Info",                     NULL },
+  { 0x1C4A276C, false, "6tx",      "TXTR",    "Texture Image",                     newResource< DBPF_TXTRtype > },
+  { 0x2026960B, false, "mp3",      "MP3",     "mp3 or xa Sound File",              NULL },
+  { 0x25232B11, false, "5sc",      "SCEN",    "Scene Node",                        NULL },
+  { 0x2A51171B, false, NULL,       "3ARY",    "3D Array",                          NULL },
+  { 0x2C1FD8A1, false, "xml",      "XTOL",    "Texture Overlay XML",               NULL },
+  { 0x2C30E040, false, "jpg",      "THUB",    "Fence Arch Thumbnail",              NULL },
+  { 0x2C310F46, false, NULL,       "POPS",    "Popups",                            NULL },
+  { 0x2C43CBD4, false, "jpg",      "THUB",    "Foundation or Pool Thumbnail",      NULL },
+  { 0x2C488BCA, false, "jpg",      "THUB",    "Dormer Thmbnail",                   NULL },
+  { 0x2CB230B8, false, "xml",      "XFNC",    "Fence XML",                         NULL },
+  { 0x3053CF74, false, NULL,       "SCOR",    "Sim: Scores",                       NULL },
+  { 0x42434F4E, true,  NULL,       "BCON",    "Behaviour Constant",                NULL },
+  { 0x42484156, true,  NULL,       "BHAV",    "Behaviour Function",                NULL },
+  { 0x424D505F, true,  "bmp",      "BMP",     "Bitmap Image",                      NULL },
+  { 0x43415453, false, NULL,       "CATS",    "Catalog String",                    NULL },
+  { 0x43545353, false, NULL,       "CTSS",    "Catalog Description",               NULL },
+  { 0x44475250, false, NULL,       "DGRP",    "Layered Image",                     NULL },
+  { 0x46414345, false, NULL,       "FACE",    "Face Properties",                   NULL },
+  { 0x46414D49, false, NULL,       "FAMI",    "Family Information",                NULL },
+  { 0x46414D68, false, NULL,       "FAMH",    "Family Unknown",                    NULL },
+  { 0x46434E53, false, NULL,       "FCNS",    "Function",                          NULL },
+  { 0x46574156, true,  NULL,       "FWAV",    "Audio Reference",                   NULL },
+  { 0x474C4F42, true,  NULL,       "GLOB",    "Global Data",                       NULL },
+  { 0x484F5553, false, NULL,       "HOUS",    "House Descriptor",                  NULL },
+  { 0x49596978, false, "5tm",      "TXMT",    "Material Definition",               newResource< DBPF_TXMTtype > },
+  { 0x49FF7D76, false, NULL,       "WRLD",    "World Database",                    NULL },
+  { 0x4B58975B, false, NULL,       "LTTX",    "Lot Texture",                       NULL },
+  { 0x4C158081, false, "xml",      "XSTN",    "Skin Tone XML",                     NULL },
+  { 0x4C697E5A, false, NULL,       "MMAT",    "Material Override",                 NULL },
+  { 0x4D51F042, false, "5cs",      "CINE",    "Cinematic Scene",                   NULL },
+  { 0x4D533EDD, false, "jpg",      "JPG",     "JPEG Image",                        NULL },
+  { 0x4DCADB7E, false, "xml",      "XFLR",    "Floor XML",                         NULL },
+  { 0x4E474248, false, NULL,       "NGBH",    "Neighborhood/Memory",               NULL },
+  { 0x4E524546, true,  NULL,       "NREF",    "Name Reference",                    NULL },
+  { 0x4E6D6150, false, NULL,       "NMAP",    "Name Map",                          NULL },
+  { 0x4F424A44, true,  NULL,       "OBJD",    "Object Data",                       NULL },
+  { 0x4F424A66, true,  NULL,       "OBJF",    "Object Functions",                  NULL }, // SimPE: OBJf
+  { 0x4F626A4D, false, NULL,       "OBJM",    "Object Material?",                  NULL },
+  { 0x4F6FD33D, false, NULL,       "INIT",    "Inventory Item",                    NULL },
+  { 0x50414C54, false, NULL,       "PALT",    "Image Color Palette (Version 1)",   NULL },
+  { 0x50455253, false, NULL,       NULL,      "UNK: 0x50455253",                   NULL },
+  { 0x504F5349, false, NULL,       "POSI",    "Stack Script",                      NULL },
+  { 0x50544250, false, NULL,       "PTBP",    "Package Text",                      NULL },
+  { 0x53494D49, false, NULL,       "SIMI",    "Sim Information",                   NULL },
+  { 0x534C4F54, true,  NULL,       "SLOT",    "Slot File",                         NULL },
+  { 0x53505232, true,  NULL,       "SPR2",    "Sprites",                           NULL },
+  { 0x53545223, true,  NULL,       "STR#",    "Text Lists",                        newResource< DBPF_STRtype > },
+  { 0x54415454, true,  NULL,       "TATT",    "TATT",                              NULL },
+  { 0x54505250, true,  NULL,       "TPRP",    "Edith Simantics Behaviour Labels",  NULL },
+  { 0x5452434E, true,  NULL,       "TRCN",    "Behaviour Constant Labels",         NULL },
+  { 0x54524545, true,  NULL,       "TREE",    "Edith Flowchart Trees",             NULL },
+  { 0x54535053, false, NULL,       "GROP",    "Groups Cache",                      NULL },
+  { 0x54544142, true,  NULL,       "TTAB",    "Pie Menu Functions",                NULL },
+  { 0x54544173, true,  NULL,       "TTAs",    "Pie Menu Strings",                  NULL },
+  { 0x584D544F, false, NULL,       "XMTO",    "Material Object?",                  NULL },
+  { 0x584F424A, false, "xml",      "XOBJ",    "Object XML",                        NULL },
+  { 0x61754C1B, true,  NULL,       "SLUA",    "SimPE Object Lua",                  NULL },
+  { 0x6A97042F, false, "5el",      "LGHT",    "Lighting (Environment Cube Light)", NULL },
+  { 0x6B943B43, false, NULL,       "LOTG",    "Lot Terrain Geometry",              NULL },
+  { 0x6C4F359D, false, NULL,       "COLL",    "Collection",                        NULL },
+  { 0x6C589723, false, NULL,       "LOT ",    "UNK: 0x6C589723",                   NULL }, // SimPE: UNK
+  { 0x6C93B566, false, "xml",      "XFNU",    "Face Neural XML",                   NULL },
+  { 0x6D619378, false, "xml",      "XNGB",    "Neighborhood Object XML",           NULL },
+  { 0x6D814AFE, false, "xml",      "WNTT",    "Wants Tree Item",                   NULL },
+  { 0x6F626A74, false, NULL,       "OBJT",    "Object",                            NULL },
+  { 0x7181C501, false, NULL,       "PUNK",    "Pet Unknown",                       NULL },
+  { 0x7B1ACFCD, false, NULL,       NULL,      "UNK: 0x7B1ACFCD",                   NULL },
+  { 0x7BA3838C, false, "5gn",      "GMND",    "Geometric Node",                    NULL },
+  { 0x856DDBAC, false, "jpg",      "IMG",     "jpg/tga/png Image",                 NULL },
+  { 0x8A84D7B0, false, NULL,       "WLAY",    "Wall Layer",                        NULL },
+  { 0x8B0C79D6, false, NULL,       NULL,      "UNK: 0x8B0C79D6",                   NULL },
+  { 0x8C1580B5, false, "xml",      "XHTN",    "Hair Tone XML",                     newResource< DBPF_XHTNtype > },
+  { 0x8C31125E, false, "jpg",      "THUB",    "Wall Thumbnail",                    NULL },
+  { 0x8C311262, false, "jpg",      "THUB",    "Floor Thumbnail",                   NULL },
+  { 0x8C3CE95A, false, "jpg",      "JPG",     "JPEG Image",                        NULL },
+  { 0x8C870743, false, NULL,       "FAMT",    "Family Ties",                       NULL },
+  { 0x8C93BF6C, false, "xml",      "XFRG",    "Face Region XML",                   NULL },
+  { 0x8C93E35C, false, "xml",      "XFCH",    "Face Arch XML",                     NULL },
+  { 0x8CC0A14B, false, NULL,       "SDBA",    "UNK: 0x8CC0A14B",                   NULL },
+  { 0x8DB5E4C2, false, NULL,       "FXSD",    "FX Sound",                          NULL },
+  { 0x9012468A, false, NULL,       "GLUA",    "Global Object Lua",                 NULL },
+  { 0x9012468B, false, NULL,       "OLUA",    "Object Lua",                        NULL },
+  { 0xA2E3D533, false, NULL,       "KEYD",    "Accelerator Key Definitions",       NULL },
+  { 0xAACE2EFB, false, NULL,       "PDAT",    "Sim Description",                   NULL }, // SimPE: SDSC
+  { 0xAB4BA572, false, NULL,       "PFL ",    "Fence Post Layer",                  NULL }, // SimPE: FPST
+  { 0xAB9406AA, false, NULL,       "ROOF",    "UNK: 0xAB9406AA",                   NULL }, // SimPE: UNK
+  { 0xABCB5DA4, false, NULL,       "NHTG",    "Neighborhood Terrain Geometry",     NULL },
+  { 0xABD0DC63, false, NULL,       "NHTR",    "Neighborhood Terrain",              NULL },
+  { 0xAC06A66F, false, "5lf",      "LGHT",    "Lighting (Linear Fog Light)",       NULL },
+  { 0xAC06A676, false, "5ds",      "LGHT",    "Lighting (Draw State Light)",       NULL },
+  { 0xAC2950C1, false, "jpg",      "THUB",    "Thumbnail",                         NULL },
+  { 0xAC4F8687, false, "5gd",      "GMDC",    "Geometric Data Container",          NULL },
+  { 0xAC506764, false, NULL,       "3IDR",    "3D ID Referencing File",            newResource< DBPF_3IDRtype > },
+  { 0xAC598EAC, false, NULL,       "AGED",    "Age Data",                          NULL },
+  { 0xAC8A7A2E, false, NULL,       "IDNO",    "ID Number",                         NULL },
+  { 0xACA8EA06, false, "xml",      "XROF",    "Roof XML",                          NULL },
+  { 0xACE46235, false, NULL,       "RTEX",    "Road Texture",                      NULL },
+  { 0xADEE8D84, false, "nlo",      "NLO",     "Light Override",                    NULL },
+  { 0xBA353CE1, false, NULL,       "TSSG",    "TSSG System",                       NULL },
+  { 0xBC66BAEC, false, NULL,       NULL,      "UNK: 0xBC66BAEC",                   NULL },
+  { 0xC9C81B9B, false, "5dl",      "LGHT",    "Lighting (Directional Light)",      NULL },
+  { 0xC9C81BA3, false, "5al",      "LGHT",    "Lighting (Ambient Light)",          NULL },
+  { 0xC9C81BA9, false, "5pl",      "LGHT",    "Lighting (Point Light)",            NULL },
+  { 0xC9C81BAD, false, "5sl",      "LGHT",    "Lighting (Spot Light)",             NULL },
+  { 0xCAC4FC40, false, NULL,       "SMAP",    "String Map",                        NULL },
+  { 0xCB4387A1, false, NULL,       "VERT",    "Vertex",                            NULL },
+  { 0xCC2A6A34, false, NULL,       "SCID",    "Sim Creation Index",                NULL },
+  { 0xCC30CDF8, false, "jpg",      "THUB",    "Fence Thumbnail",                   NULL },
+  { 0xCC364C2A, false, NULL,       "SREL",    "Sim Relations",                     NULL },
+  { 0xCC44B5EC, false, "jpg",      "THUB",    "Modular Stair Thumbnail",           NULL },
+  { 0xCC489E46, false, "jpg",      "THUB",    "Roof Thumbnail",                    NULL },
+  { 0xCC48C51F, false, "jpg",      "THUB",    "Chimney Thumbnail",                 NULL },
+  { 0xCCA8E925, false, "xml",      "WaFl",    "Object XML",                        NULL }, // SimPE: XOBJ
+  { 0xCCCEF852, false, NULL,       "LxNR",    "Facial Structure",                  NULL },
+  { 0xCD7FE87A, false, "matshad",  "MATSHAD", "Maxis Material Shader",             NULL },
+  { 0xCD8B6498, false, NULL,       NULL,      "UNK: 0xCD8B6498",                   NULL },
+  { 0xCD95548E, false, NULL,       "SWAF",    "Sim Wants and Fears",               NULL },
+  { 0xCDB467B8, false, NULL,       "CREG",    "Content Registry",                  NULL },
+  { 0xD1954460, false, NULL,       "PBOP",    "Pet Body Options",                  NULL },
+  { 0xE519C933, false, "5cr",      "CRES",    "Resource Node",                     NULL },
+  { 0xE86B1EEF, false, "dir",      "DIR ",    "Directory of Compressed Files",     NULL }, // SimPE: CLST
+  { 0xEA5118B0, false, "fx",       "FX",      "Effects List",                      NULL },
+  { 0xEBCF3E27, false, NULL,       "GZPS",    "Property Set",                      newResource< DBPF_GZPStype > },
+  { 0xEBFEE33F, false, NULL,       "SDNA",    "Sim DNA",                           NULL },
+  { 0xEBFEE342, false, NULL,       "VERS",    "Version Information",               NULL },
+  { 0xEBFEE345, false, NULL,       "AUDT",    "Audio Test",                        NULL },
+  { 0xEC3126C4, false, "jpg",      "THUB",    "Terrain Thumbnail",                 NULL },
+  { 0xEC44BDDC, false, NULL,       NULL,      "UNK: 0xEC44BDDC",                   NULL },
+  { 0xED534136, false, "6li",      "LIFO",    "Large Image File",                  NULL },
+  { 0xED7D7B4D, false, "xml",      "XWNT",    "Wants XML",                         NULL },
+  { 0xFA1C39F7, false, NULL,       "OBJT",    "Object",                            NULL },
+  { 0xFB00791E, false, "5an",      "ANIM",    "Animation Resource",                NULL },
+  { 0xFC6EB1F7, false, "5sh",      "SHPE",    "Shape",                             NULL },
+  { 0xFFFFFFFF, false, NULL,       "----",    "--- User Defined ---",              NULL }
+};
+
+static constexpr unsigned int gTypeCount = sizeof( gTypes ) / sizeof( gTypes[0] );
+
+
+// -------------------------------------------------------------------------
+// perfect hash, hash and displace:
+// a type's bucket is typeHash( type, 0 ), the bucket's seed picks its slot, typeHash( type, seed ),
+// and the seeds are chosen so that no two types share a slot
+
+
+static constexpr unsigned int gBucketCount = 64;
+static constexpr unsigned int gSlotCount = 256;
+
+static constexpr unsigned int typeHash( const unsigned int type, const unsigned int seed )
+{
+  unsigned int h = type ^ ( seed * 0x9E3779B9u );
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+
+class DBPF_typeHashType
+{
+public:
+  unsigned short mSeeds[gBucketCount];
+  unsigned short mSlots[gSlotCount];  // index into gTypes, gTypeCount if empty
+  bool mbOK;
+};
+
+
+static constexpr DBPF_typeHashType makeTypeHash()
+{
+  DBPF_typeHashType hash = {};
+  for( unsigned int s = 0; s < gSlotCount; ++s )
+    hash.mSlots[s] = gTypeCount;
+
+  unsigned int bucketSize[gBucketCount] = {};
+  for( unsigned int i = 0; i < gTypeCount; ++i )
+    ++bucketSize[ typeHash( gTypes[i].muTypeID, 0 ) % gBucketCount ];
+
+  // place the biggest buckets first, while most slots are free
+  hash.mbOK = true;
+  for( unsigned int size = gTypeCount; size > 0 && hash.mbOK; --size )
+    for( unsigned int b = 0; b < gBucketCount && hash.mbOK; ++b )
+    {
+      if( bucketSize[b] != size )
+        continue;
+
+      bool bPlaced = false;
+      for( unsigned int seed = 1; seed < 0x10000 && false == bPlaced; ++seed )
+      {
+        unsigned int types[gTypeCount] = {}, slots[gTypeCount] = {};
+        unsigned int n = 0;
+        bPlaced = true;
+        for( unsigned int i = 0; i < gTypeCount && bPlaced; ++i )
+        {
+          if( typeHash( gTypes[i].muTypeID, 0 ) % gBucketCount != b )
+            continue;
+          unsigned int s = typeHash( gTypes[i].muTypeID, seed ) % gSlotCount;
+          bPlaced = ( gTypeCount == hash.mSlots[s] );
+          for( unsigned int k = 0; k < n && bPlaced; ++k )
+            bPlaced = ( slots[k] != s );
+          types[n] = i;
+          slots[n] = s;
+          ++n;
+        }
+
+        if( bPlaced )
+        { hash.mSeeds[b] = (unsigned short)seed;
+          for( unsigned int k = 0; k < n; ++k )
+            hash.mSlots[ slots[k] ] = (unsigned short)( types[k] );
+        }
+      }
+      hash.mbOK = bPlaced;
+    }
+
+  return hash;
+}
+
+
+static constexpr DBPF_typeHashType gTypeHash = makeTypeHash();
+static_assert( gTypeHash.mbOK, "DBPF type table has a type ID twice, or needs more hash slots" );
+
+
+// -------------------------------------------------------------------------
+
+
+/**
+<pre>
+ * input:   type - resource type, such as DBPF_GZPS
+ * returns: what the library knows about type, NULL if it's not in the table
+</pre>
+**/
+const DBPF_typeInfoType * dbpfFindTypeInfo( const unsigned int type )
+{
+  const unsigned int seed = gTypeHash.mSeeds[ typeHash( type, 0 ) % gBucketCount ];
+  const unsigned int i = gTypeHash.mSlots[ typeHash( type, seed ) % gSlotCount ];
+
+  if( i < gTypeCount && gTypes[i].muTypeID == type )
+    return &gTypes[i];
+  return NULL;
+}
@@ -0,0 +1,44 @@
+/**
+ * file: DBPF_typeRegistry.h
+ * author: CatOfEvilGenius
+ *
+ * what the library knows about each resource type:
+ * name, whether it starts with a file name, and the class that decodes it
+**/
+
+#ifndef DBPF_TYPE_REGISTRY_H_CATOFEVILGENIUS
+#define DBPF_TYPE_REGISTRY_H_CATOFEVILGENIUS
+
+
+class DBPF_resourceType;
+class DBPF_arenaType;
+
+
+/**
+<pre>
+ * one resource type, the table is in DBPF_typeRegistry.cpp
+ * - the names come from SimPE's type table (the one in benrq/dbpf.cpp),
+ *   except where this library always had its own name for a type
+ * - mbEmbeddedFilename, the first 64 bytes are a null terminated file name
+ * - mpNewResource makes a new, uninitialized resource of the class that decodes the type,
+ *   in the arena if it's given one, to add a decoder, give its type one in the table
+</pre>
+**/
+class DBPF_typeInfoType
+{
+public:
+  unsigned int muTypeID;
+  bool mbEmbeddedFilename;
+  const char * mstrExtension;  // NULL if SimPE has none
+  const char * mstrShortName;  // TXMT, STR#, ..., NULL if SimPE doesn't know it either
+  const char * mstrLongName;
+  DBPF_resourceType * (*mpNewResource)( DBPF_arenaType * );  // NULL if the library has no class for it
+};
+
+
+// type's entry, NULL if it's not in the table, one hash lookup
+const DBPF_typeInfoType * dbpfFindTypeInfo( const unsigned int type );
+
+
+// DBPF_TYPE_REGISTRY_H_CATOFEVILGENIUS
+#endif
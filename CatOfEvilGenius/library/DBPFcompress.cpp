@@ -17,6 +17,7 @@
 #include <vector>
 
 #include "DBPF_byteStreamFunctions.h"
+#include "DBPF_arena.h"
 
 // ================================================================================
 
@@ -74,6 +75,8 @@ extern bool decompress( const ::byte* src, int compressed_size, ::byte* dst, int
  * input:   data, dataByteCount - uncompressed data and size
  * output:  dataCmpr, dataCmprByteCount - compressed data and compressed size,
  *                         dataCmpr should be NULL when passed in, will be allocated here
+ * input:   pArena - where dataCmpr is allocated, NULL for new [],
+ *                   the first, worst case size, try is always on the heap, only the result goes in the arena
  * returns: success / failure
  *
  * purpose: compress data compressed with QFC compression
@@ -81,7 +84,8 @@ extern bool decompress( const ::byte* src, int compressed_size, ::byte* dst, int
 </pre>
 **/
 bool dbpfCompress( const unsigned char * data, const unsigned int dataByteCount,  // IN
-                   unsigned char * & dataCmpr, unsigned int & dataCmprByteCount ) // OUT
+                   unsigned char * & dataCmpr, unsigned int & dataCmprByteCount,  // OUT
+                   DBPF_arenaType * pArena )                                      // IN
 {
   // sanity check
   if( NULL == data )
@@ -134,7 +138,7 @@ bool dbpfCompress( const unsigned char * data, const unsigned int dataByteCount,
   // remake the compressed data array without extra unused space at the end
 
   unsigned char * tmp = dataCmpr;
-  dataCmpr = new unsigned char[ dataCmprByteCount ];
+  dataCmpr = dbpfNewBytes( pArena, dataCmprByteCount );
   if( NULL == dataCmpr )
   {
     dataCmpr = tmp;
@@ -158,6 +162,7 @@ bool dbpfCompress( const unsigned char * data, const unsigned int dataByteCount,
  * input:   data, dataByteCount - compressed data with 9 byte header containing size, size of data
  * output:  dataUnc, dataUncByteCount - uncompressed data and size,
  *                         dataUnc should be NULL when passed in, will be allocated here
+ * input:   pArena - where dataUnc is allocated, NULL for new []
  * returns: success / failure
  *
  * purpose: decompress data compressed with QFC compression
@@ -165,7 +170,8 @@ bool dbpfCompress( const unsigned char * data, const unsigned int dataByteCount,
 </pre>
 **/
 bool dbpfDecompress( const unsigned char * data, const unsigned int dataByteCount, // IN
-                     unsigned char * & dataUnc, unsigned int & dataUncByteCount )  // OUT
+                     unsigned char * & dataUnc, unsigned int & dataUncByteCount,  // OUT
+                     DBPF_arenaType * pArena )                                    // IN
 {
   // header - first 9 bytes
   // ----------------------
@@ -182,7 +188,7 @@ bool dbpfDecompress( const unsigned char * data, const unsigned int dataByteCoun
   }
 
   // allocate memory for uncompressed data
-  dataUnc = new unsigned char[ dataUncByteCount ];
+  dataUnc = dbpfNewBytes( pArena, dataUncByteCount );
   if( NULL == dataUnc )
   { fprintf( stderr, "ERRROR: dbpfDecompress, failed to allocate memory\n" );
     return false;
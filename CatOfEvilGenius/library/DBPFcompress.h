@@ -9,13 +9,19 @@
 </pre>
 **/
 
-// QFC compression
+#include <cstddef>
+
+class DBPF_arenaType;
+
+// QFC compression, dataCmpr comes from pArena, or from new [] if that's NULL
 bool dbpfCompress( const unsigned char * data, const unsigned int dataByteCount,
-                   unsigned char * & dataCmpr, unsigned int & dataCmprByteCount );
+                   unsigned char * & dataCmpr, unsigned int & dataCmprByteCount,
+                   DBPF_arenaType * pArena = NULL );
 
-// QFC decompression
+// QFC decompression, dataUnc comes from pArena, or from new [] if that's NULL
 bool dbpfDecompress( const unsigned char * data, const unsigned int dataByteCount,
-                     unsigned char * & dataUnc, unsigned int & dataUncByteCount );
+                     unsigned char * & dataUnc, unsigned int & dataUncByteCount,
+                     DBPF_arenaType * pArena = NULL );
 
 // given raw byte data, check for a QFC 9 byte header
 bool dbpfGetCompressedHeader( const unsigned char * data,
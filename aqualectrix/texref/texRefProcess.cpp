@@ -130,10 +130,11 @@ bool texRefProcess(const char* filename, const char* texId, const char* subsetTo
 
   // Write back to file
   clog << endl << "Overwriting file " << filename << "..." << endl;
-  bool write_success = writeCompressedPackage(filename, package, resources);
+  // (atomic: written to a temp file, then renamed over the original)
+  bool write_success = writeCompressedPackage(filename, package, resources, true);
   if (!write_success) {
-    cerr << "Writing to file " << filename << " failed. File may be corrupted... " <<
-            "or you may have the file open somewhere else (SimPE, maybe?). " <<
+    cerr << "Writing to file " << filename << " failed. The original file was left unchanged... " <<
+            "you may have the file open somewhere else (SimPE, maybe?). " <<
             "If so, close the file elsewhere and try again." << endl;
   }
   else {
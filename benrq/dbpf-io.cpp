@@ -0,0 +1,307 @@
+/*
+ * Ready-made callbacks for dbpf_open_ex: files read with positioned
+ * reads (pread), memory-mapped files and archives already in memory.
+ * All of them can be read from several threads at once. See dbpf.h.
+ *
+ * This file is Copyright 2007 Ben Rudiak-Gould. Anyone may use it
+ * under the terms of the GNU General Public License, version 2 or
+ * (at your option) any later version. This code comes with
+ * NO WARRANTY. Make backups!
+ */
+
+#include "dbpf.h"
+
+#include <errno.h>
+#include <string.h>  // for memcpy
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+typedef unsigned char byte;
+
+
+// Both kinds of archive are just a block of memory once they're open.
+
+struct memory_file
+{
+    const byte* data;
+    int size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+    bool mapped;  // false for dbpf_open_memory
+};
+
+
+static bool in_range(const memory_file* mf, int start, int length, const char** error)
+{
+    if (start < 0 || length < 0 || start > mf->size || length > mf->size - start) {
+        *error = "unexpected end of file while reading";
+        return false;
+    }
+    return true;
+}
+
+static int memory_read(void* ctx, int start, int length, void* buf, const char** error)
+{
+    const memory_file* mf = (const memory_file*)ctx;
+    if (!in_range(mf, start, length, error))
+        return -1;
+    memcpy(buf, mf->data + start, length);
+    return 0;
+}
+
+static int memory_readv(void* ctx, const dbpf_iovec* vec, int count, const char** error)
+{
+    for (int i = 0; i < count; ++i)
+        if (memory_read(ctx, vec[i].start, vec[i].length, vec[i].buf, error) < 0)
+            return -1;
+    return 0;
+}
+
+static const void* memory_map(void* ctx, int start, int length, const char** error)
+{
+    const memory_file* mf = (const memory_file*)ctx;
+    return in_range(mf, start, length, error) ? mf->data + start : 0;
+}
+
+static int memory_close(void* ctx)
+{
+    memory_file* mf = (memory_file*)ctx;
+    int rtn = 0;
+    if (mf->mapped) {
+#ifdef _WIN32
+        if (mf->data && !UnmapViewOfFile(mf->data)) rtn = -1;
+        if (mf->mapping && !CloseHandle(mf->mapping)) rtn = -1;
+        if (!CloseHandle(mf->file)) rtn = -1;
+#else
+        if (mf->size && munmap((void*)mf->data, mf->size) < 0) rtn = -1;
+        if (close(mf->fd) < 0) rtn = -1;
+#endif
+    }
+    free(mf);
+    return rtn;
+}
+
+static const dbpf_callbacks memory_callbacks = {
+    memory_read, 0, memory_close, memory_map, 0, memory_readv
+};
+
+
+extern "C"
+DBPF* dbpf_open_memory(const void* data, int size, const char** error)
+{
+    memory_file* mf = (memory_file*)malloc(sizeof(memory_file));
+    if (!mf) {
+        *error = "allocation failure";
+        return 0;
+    }
+    mf->data = (const byte*)data;
+    mf->size = size;
+    mf->mapped = false;
+    return dbpf_open_ex(mf, &memory_callbacks, error);
+}
+
+
+extern "C"
+DBPF* dbpf_open_mmap(const char* filename, const char** error)
+{
+    memory_file* mf = (memory_file*)malloc(sizeof(memory_file));
+    if (!mf) {
+        *error = "allocation failure";
+        return 0;
+    }
+    mf->data = 0;
+    mf->size = 0;
+    mf->mapped = true;
+
+#ifdef _WIN32
+    mf->mapping = 0;
+    mf->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (mf->file == INVALID_HANDLE_VALUE) {
+        free(mf);
+        *error = "open failed";
+        return 0;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mf->file, &size) || size.QuadPart > 0x7FFFFFFF) {
+        memory_close(mf);
+        *error = "DBPF file too large";
+        return 0;
+    }
+    mf->size = (int)size.QuadPart;
+    // an empty file can't be mapped; the header read will fail instead
+    if (mf->size) {
+        mf->mapping = CreateFileMappingA(mf->file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mf->mapping)
+            mf->data = (const byte*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!mf->data) {
+            memory_close(mf);
+            *error = "mapping the file failed";
+            return 0;
+        }
+    }
+#else
+    mf->fd = open(filename, O_RDONLY);
+    if (mf->fd < 0) {
+        free(mf);
+        *error = "open failed";
+        return 0;
+    }
+    struct stat st;
+    if (fstat(mf->fd, &st) < 0 || st.st_size > 0x7FFFFFFF) {
+        memory_close(mf);
+        *error = "DBPF file too large";
+        return 0;
+    }
+    // an empty file can't be mapped; the header read will fail instead
+    if (st.st_size) {
+        void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+        if (p == MAP_FAILED) {
+            memory_close(mf);
+            *error = "mapping the file failed";
+            return 0;
+        }
+        mf->data = (const byte*)p;
+        mf->size = (int)st.st_size;
+    }
+#endif
+
+    return dbpf_open_ex(mf, &memory_callbacks, error);
+}
+
+
+// Plain files. Every read says where it reads from, instead of seeking
+// first, so there's no file position to share between threads.
+
+struct plain_file
+{
+#ifdef _WIN32
+    HANDLE h;
+#else
+    int fd;
+#endif
+};
+
+static int file_read(void* ctx, int start, int length, void* buf, const char** error)
+{
+    plain_file* pf = (plain_file*)ctx;
+    byte* p = (byte*)buf;
+    while (length > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = start;
+        DWORD n;
+        if (!ReadFile(pf->h, p, length, &n, &ov)) {
+            *error = (GetLastError() == ERROR_HANDLE_EOF) ? "unexpected end of file while reading" : "read error";
+            return -1;
+        }
+#else
+        ssize_t n = pread(pf->fd, p, length, start);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            *error = "read error";
+            return -1;
+        }
+#endif
+        if (n == 0) {
+            *error = "unexpected end of file while reading";
+            return -1;
+        }
+        p += n;
+        start += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int file_write(void* ctx, int start, int length, const void* buf, const char** error)
+{
+    plain_file* pf = (plain_file*)ctx;
+    if (length == 0) {  // truncate
+#ifdef _WIN32
+        LARGE_INTEGER pos;
+        pos.QuadPart = start;
+        if (SetFilePointerEx(pf->h, pos, 0, FILE_BEGIN) && SetEndOfFile(pf->h)) return 0;
+#else
+        if (ftruncate(pf->fd, start) == 0) return 0;
+#endif
+        *error = "truncate failed";
+        return -1;
+    }
+    const byte* p = (const byte*)buf;
+    while (length > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = start;
+        DWORD n;
+        if (!WriteFile(pf->h, p, length, &n, &ov) || n == 0) {
+            *error = "write error";
+            return -1;
+        }
+#else
+        ssize_t n = pwrite(pf->fd, p, length, start);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            *error = "write error";
+            return -1;
+        }
+#endif
+        p += n;
+        start += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int file_close(void* ctx)
+{
+    plain_file* pf = (plain_file*)ctx;
+#ifdef _WIN32
+    int rtn = CloseHandle(pf->h) ? 0 : -1;
+#else
+    int rtn = close(pf->fd);
+#endif
+    free(pf);
+    return rtn;
+}
+
+
+extern "C"
+DBPF* dbpf_open_file(const char* filename, int writable, const char** error)
+{
+    plain_file* pf = (plain_file*)malloc(sizeof(plain_file));
+    if (!pf) {
+        *error = "allocation failure";
+        return 0;
+    }
+#ifdef _WIN32
+    pf->h = CreateFileA(filename, writable ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ,
+                        FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (pf->h == INVALID_HANDLE_VALUE) {
+#else
+    pf->fd = open(filename, writable ? O_RDWR : O_RDONLY);
+    if (pf->fd < 0) {
+#endif
+        free(pf);
+        *error = "open failed";
+        return 0;
+    }
+
+    dbpf_callbacks callbacks = { file_read, writable ? file_write : 0, file_close, 0, 0, 0 };
+    return dbpf_open_ex(pf, &callbacks, error);
+}
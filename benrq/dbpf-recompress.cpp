@@ -12,8 +12,26 @@
 #include "dbpf.h"
 
 #include <malloc.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <io.h>      // for _chsize
+#else
+#include <unistd.h>  // for ftruncate
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 //#include <assert.h>
 #define assert(expr) do{}while(0)
@@ -37,6 +55,16 @@ static int stdio_read(void* ctx, int start, int length, void* buf, const char**
 static int stdio_write(void* ctx, int start, int length, const void* buf, const char** error)
 {
     FILE* f = (FILE*)ctx;
+    if (length == 0) {  // truncate
+        fflush(f);
+#ifdef _WIN32
+        if (_chsize(_fileno(f), start) == 0) return 0;
+#else
+        if (ftruncate(fileno(f), start) == 0) return 0;
+#endif
+        *error = "truncate error";
+        return -1;
+    }
     fseek(f, start, SEEK_SET);
     if (fwrite(buf, 1, length, f) == (size_t)length) {
         return 0;
@@ -88,30 +116,116 @@ public:
     DBPF* val;
     auto_close_dbpf(DBPF* newval) { val = newval; }
     ~auto_close_dbpf() { dbpf_close(val); }
+    DBPF* operator=(DBPF* newval) { dbpf_close(val); return val = newval; }
     bool operator!() { return !val; }
     operator DBPF*() { return val; }
 };
 
 
-bool verify(FILE* f, FILE* g)
+/*
+ * XXH64 (see https://github.com/Cyan4973/xxHash), used to check that what
+ * ends up in the new file is what the workers produced.
+ */
+
+static const uint64_t xxh_prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t xxh_prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t xxh_read64(const byte* p)
 {
-    const char* error = "??? unknown error (bug)";
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;  // little-endian only, like the rest of this code
+}
 
-    auto_close_dbpf dbpf1 = dbpf_open_stdio(f, &error);
-    if (!dbpf1) {
-        printf("  *** verify failed: reopen of old file failed: %s\n", error);
-        return false;
+static inline uint32_t xxh_read32(const byte* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * xxh_prime2;
+    acc = xxh_rotl(acc, 31);
+    return acc * xxh_prime1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * xxh_prime1 + xxh_prime4;
+}
+
+uint64_t xxh64(const void* data, size_t len, uint64_t seed)
+{
+    const byte* p = (const byte*)data;
+    const byte* end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + xxh_prime1 + xxh_prime2;
+        uint64_t v2 = seed + xxh_prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - xxh_prime1;
+        const byte* limit = end - 32;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p+8));
+            v3 = xxh_round(v3, xxh_read64(p+16));
+            v4 = xxh_round(v4, xxh_read64(p+24));
+            p += 32;
+        } while (p <= limit);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge_round(h, v1);
+        h = xxh_merge_round(h, v2);
+        h = xxh_merge_round(h, v3);
+        h = xxh_merge_round(h, v4);
+    } else {
+        h = seed + xxh_prime5;
+    }
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = xxh_rotl(h ^ xxh_round(0, xxh_read64(p)), 27) * xxh_prime1 + xxh_prime4;
+    if (p + 4 <= end) {
+        h = xxh_rotl(h ^ (xxh_read32(p) * xxh_prime1), 23) * xxh_prime2 + xxh_prime3;
+        p += 4;
     }
+    for (; p < end; ++p)
+        h = xxh_rotl(h ^ (*p * xxh_prime5), 11) * xxh_prime1;
+
+    h ^= h >> 33;
+    h *= xxh_prime2;
+    h ^= h >> 29;
+    h *= xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+// Reopens the new file (without closing it afterwards) and compares every
+// entry with the old one in full. This is only done with -p; normally
+// check_written is enough.
+bool verify(const char* name, DBPF* dbpf1, FILE* g)
+{
+    const char* error = "??? unknown error (bug)";
 
-    auto_close_dbpf dbpf2 = dbpf_open_stdio(g, &error);
+    auto_close_dbpf dbpf2 = dbpf_open(g, stdio_read, 0, 0, &error);
     if (!dbpf2) {
-        printf("  *** verify failed: reopen of new file failed: %s\n", error);
+        printf("%s: *** verify failed: reopen of new file failed: %s\n", name, error);
         return false;
     }
 
     int entry_count = dbpf_get_entry_count(dbpf1);
     if (entry_count != dbpf_get_entry_count(dbpf2)) {
-        printf("  *** verify failed: entry count mismatch\n");
+        printf("%s: *** verify failed: entry count mismatch\n", name);
         return false;
     }
 
@@ -128,7 +242,7 @@ bool verify(FILE* f, FILE* g)
             || a->instance_id_2 != b->instance_id_2
             || a->size != b->size)
         {
-            printf("  *** verify failed: file metadata mismatch\n");
+            printf("%s: *** verify failed: file metadata mismatch\n", name);
             return false;
         }
         if (max_size < a->size) max_size = a->size;
@@ -141,15 +255,15 @@ bool verify(FILE* f, FILE* g)
         byte* buf2 = buf + a->size;
 
         if (dbpf_read(dbpf1, i, buf, &error) < 0) {
-            printf("  *** verify failed: read of old file failed: %s\n", error);
+            printf("%s: *** verify failed: read of old file failed: %s\n", name, error);
             return false;
         }
         if (dbpf_read(dbpf2, i, buf2, &error) < 0) {
-            printf("  *** verify failed: read of new file failed: %s\n", error);
+            printf("%s: *** verify failed: read of new file failed: %s\n", name, error);
             return false;
         }
         if (memcmp(buf, buf2, a->size) != 0) {
-            printf("  *** verify failed: old and new files are different\n");
+            printf("%s: *** verify failed: old and new files are different\n", name);
             return false;
         }
     }
@@ -158,57 +272,562 @@ bool verify(FILE* f, FILE* g)
 }
 
 
-struct write_info {
-    DBPF* dbpf;
+/*
+ * Pipelined recompression. Worker threads read entries from the input
+ * (all at once; it's opened with the thread-safe callbacks from
+ * dbpf-io.cpp), decompress them and compress them again, while
+ * dbpf_write_ex writes the results in index order. Workers run at most
+ * `window' entries ahead of the writer, so memory use doesn't depend on
+ * the size of the file.
+ *
+ * Verification is split the same way. Each worker decompresses what it
+ * just compressed and compares it with the original, and hashes both the
+ * original contents and the bytes it hands to the writer. Once the file
+ * is written, the same workers decode every entry of the new file and
+ * compare hashes (check_written), without rereading the old file.
+ */
+
+struct work_slot
+{
+    int entry_index;  // which entry this slot holds, or is being filled with
+    bool done;
+    const char* error;  // set if reading failed
+
+    byte* buf;        // decompressed data
+    int buf_size;
+    byte* cbuf;       // recompressed data
+    int cbuf_size;
+    byte* vbuf;       // cbuf decompressed again, for checking
+    int vbuf_size;
+    const byte* stored;  // the entry as stored, from dbpf_map_entry
+    int stored_index;
+
+    const byte* data;  // buf or cbuf
+    char write_disposition;
+    int size_in_file;
+    uint64_t hash;     // of data
+    uint64_t content_hash;  // of the entry decompressed
+};
+
+struct pipeline
+{
+    DBPF* dbpf_in;
     const dbpf_entry* entries;
-    byte* p;
+    int entry_count;
+    bool decompress;
+    int window;
+
+    std::mutex lock;
+    std::condition_variable filled;  // a worker finished a slot
+    std::condition_variable moved;   // the writer moved on to the next entry
+    int next_to_read;
+    int next_to_write;
+    bool stop;
+
+    std::vector<work_slot> slots;  // entry i goes in slots[i % window]
+
+    std::vector<uint64_t> hashes;  // of each entry as handed to the writer
+    std::vector<uint64_t> content_hashes;  // of each entry decompressed
+
+    // Checking the new file, once it's written. The workers decode
+    // entries of dbpf_check until next_to_check reaches entry_count.
+    DBPF* dbpf_check;
+    bool check;  // dbpf_check is ready
+    int next_to_check;
+    int check_failed;  // first entry that didn't match, or entry_count
+    const char* check_error;
+
+    // Hashes of entries this encoder wrote before (from the manifest).
+    // Entries whose stored bytes hash to one of these are copied as they are.
+    const std::unordered_set<uint64_t>* known;
+
+    std::vector<std::thread> workers;
 };
 
-const byte* get_data(void* ctx, int entry_index, const char** error)
+static bool grow(byte** p, int* size, int need)
 {
-    write_info* wi = (write_info*)ctx;
-    const dbpf_entry* e = &wi->entries[entry_index];
-    if (e->size == 0) return (const byte*)"";
-    wi->p = (byte*)realloc(wi->p, e->size);
-    if (dbpf_read(wi->dbpf, entry_index, wi->p, error) >= 0) {
-/*
-        byte buf[65];
-        memset(buf, 'z', 65);
-        if (dbpf_read_64bytes(wi->dbpf, entry_index, buf, error) >= 0) {
-            if (buf[64] != 'z') abort();
-            if (memcmp(buf, wi->p, 64)) abort();
-//            for (int j=0; j<64; ++j)
-//                putchar(buf[j] < 32 || buf[j] >= 127 ? '.' : buf[j]);
-//            putchar('\n');
-        } else {
-            if (e->size >= 64) abort();
+    if (*size >= need && *p) return true;
+    byte* q = (byte*)realloc(*p, need + !need);
+    if (!q) return false;
+    *p = q;
+    *size = need;
+    return true;
+}
+
+// Reads the entry as stored and keeps it that way if it's already what
+// we would write. Otherwise leaves it decompressed in ws->buf.
+static bool copy_if_done(pipeline* pl, work_slot* ws, int entry_index)
+{
+    const dbpf_entry* e = &pl->entries[entry_index];
+    int stored_size = e->compressed_in_file ? e->size_in_file : e->size;
+    if (!(ws->stored = dbpf_map_entry(pl->dbpf_in, entry_index, &ws->error)))
+        return true;
+    ws->stored_index = entry_index;
+
+    uint64_t hash = xxh64(ws->stored, stored_size, 0);
+    bool done = pl->decompress ? !e->compressed_in_file
+                               : pl->known->find(hash) != pl->known->end();
+    if (done) {
+        ws->data = ws->stored;  // released when the slot is reused
+        ws->write_disposition = e->compressed_in_file ? dbpf_write_compressed_raw : dbpf_write_uncompressed;
+        ws->size_in_file = stored_size;
+        ws->hash = hash;
+        ws->content_hash = hash;
+        if (e->compressed_in_file) {
+            if (dbpf_decompress(ws->stored, stored_size, ws->buf, e->size) < 0)
+                ws->error = "bad DBPF file (invalid compressed data)";
+            else
+                ws->content_hash = xxh64(ws->buf, e->size, 0);
         }
-*/
-        return wi->p;
-    } else {
+        return true;
+    }
+
+    if (!e->compressed_in_file) {
+        memcpy(ws->buf, ws->stored, e->size);
+    } else if (dbpf_decompress(ws->stored, stored_size, ws->buf, e->size) < 0) {
+        ws->error = "bad DBPF file (invalid compressed data)";
+        return true;
+    }
+    return false;
+}
+
+static void release_stored(pipeline* pl, work_slot* ws)
+{
+    if (ws->stored)
+        dbpf_unmap_entry(pl->dbpf_in, ws->stored_index, ws->stored);
+    ws->stored = 0;
+}
+
+static void fill_slot(pipeline* pl, work_slot* ws, int entry_index, dbpf_scratch* scratch)
+{
+    const dbpf_entry* e = &pl->entries[entry_index];
+    ws->error = 0;
+    release_stored(pl, ws);
+    if (!grow(&ws->buf, &ws->buf_size, e->size)) {
+        ws->error = "allocation failure";
+        return;
+    }
+    if (pl->known || pl->decompress) {
+        if (copy_if_done(pl, ws, entry_index))
+            return;
+    } else if (dbpf_read(pl->dbpf_in, entry_index, ws->buf, &ws->error) < 0) {
+        if (!ws->error) ws->error = "read error";
+        return;
+    }
+
+    ws->data = ws->buf;
+    ws->write_disposition = dbpf_write_uncompressed;
+    ws->size_in_file = e->size;
+    ws->content_hash = xxh64(ws->buf, e->size, 0);
+    if (pl->decompress) {
+        ws->hash = ws->content_hash;
+        return;
+    }
+
+    if (!grow(&ws->cbuf, &ws->cbuf_size, e->size)) {
+        ws->error = "allocation failure";
+        return;
+    }
+    int compressed_size = dbpf_compress_scratch(ws->buf, e->size, ws->cbuf, scratch);
+    if (compressed_size) {
+        if (!grow(&ws->vbuf, &ws->vbuf_size, e->size)) {
+            ws->error = "allocation failure";
+            return;
+        }
+        if (dbpf_decompress(ws->cbuf, compressed_size, ws->vbuf, e->size) < 0
+            || memcmp(ws->vbuf, ws->buf, e->size) != 0)
+        {
+            ws->error = "compressed data doesn't decompress to the original (bug)";
+            return;
+        }
+        ws->data = ws->cbuf;
+        ws->write_disposition = dbpf_write_compressed_raw;
+        ws->size_in_file = compressed_size;
+    }
+    ws->hash = xxh64(ws->data, ws->size_in_file, 0);
+}
+
+static void check_entries(pipeline* pl);
+
+static void worker(pipeline* pl)
+{
+    dbpf_scratch* scratch = dbpf_scratch_new();  // NULL is allowed, just slower
+
+    for (;;) {
+        int i;
+        work_slot* ws;
+        {
+            std::unique_lock<std::mutex> guard(pl->lock);
+            pl->moved.wait(guard, [pl] {
+                return pl->stop || pl->next_to_read >= pl->entry_count
+                    || pl->next_to_read < pl->next_to_write + pl->window;
+            });
+            if (pl->stop || pl->next_to_read >= pl->entry_count)
+                break;
+            i = pl->next_to_read++;
+            ws = &pl->slots[i % pl->window];
+            ws->entry_index = i;
+            ws->done = false;
+        }
+
+        fill_slot(pl, ws, i, scratch);
+
+        {
+            std::lock_guard<std::mutex> guard(pl->lock);
+            ws->done = true;
+        }
+        pl->filled.notify_all();
+    }
+
+    dbpf_scratch_free(scratch);
+
+    check_entries(pl);
+}
+
+// dbpf_write_ex callback: waits for the workers to finish entry_index
+const byte* get_data(void* ctx, int entry_index, dbpf_entry* entry, const char** error)
+{
+    pipeline* pl = (pipeline*)ctx;
+    work_slot* ws = &pl->slots[entry_index % pl->window];
+    {
+        std::unique_lock<std::mutex> guard(pl->lock);
+        pl->next_to_write = entry_index;  // the previous entry's slot is free now
+        pl->moved.notify_all();
+        pl->filled.wait(guard, [pl, ws, entry_index] {
+            return ws->entry_index == entry_index && ws->done;
+        });
+    }
+
+    if (ws->error) {
+        *error = ws->error;
         return 0;
     }
+    entry->write_disposition = ws->write_disposition;
+    entry->size_in_file = ws->size_in_file;
+    pl->hashes[entry_index] = ws->hash;
+    pl->content_hashes[entry_index] = ws->content_hash;
+    return ws->data;
+}
+
+
+// Worker side of check_written: waits until the new file is written (or
+// the run is stopped), then decodes its entries and compares the stored
+// bytes and the decompressed contents with what the workers hashed.
+static void check_entries(pipeline* pl)
+{
+    {
+        std::unique_lock<std::mutex> guard(pl->lock);
+        pl->moved.wait(guard, [pl] { return pl->stop || pl->check; });
+        if (pl->stop)
+            return;
+    }
+
+    const dbpf_entry* entries = dbpf_get_entries(pl->dbpf_check);
+    byte* buf = 0;
+    int buf_size = 0;
+
+    for (;;) {
+        int i;
+        {
+            std::lock_guard<std::mutex> guard(pl->lock);
+            if (pl->next_to_check >= pl->entry_count || pl->check_failed < pl->entry_count)
+                break;
+            i = pl->next_to_check++;
+        }
+
+        const dbpf_entry* e = &entries[i];
+        const char* error = 0;
+        const byte* stored = dbpf_map_entry(pl->dbpf_check, i, &error);
+        if (stored) {
+            if (xxh64(stored, e->size_in_file, 0) != pl->hashes[i]) {
+                error = "old and new files are different";
+            } else if (!grow(&buf, &buf_size, e->size)) {
+                error = "allocation failure";
+            } else {
+                if (!e->compressed_in_file)
+                    memcpy(buf, stored, e->size);
+                else if (dbpf_decompress(stored, e->size_in_file, buf, e->size) < 0)
+                    error = "new file has invalid compressed data";
+                if (!error && xxh64(buf, e->size, 0) != pl->content_hashes[i])
+                    error = "old and new files are different";
+            }
+            dbpf_unmap_entry(pl->dbpf_check, i, stored);
+        } else if (!error) {
+            error = "read of new file failed";
+        }
+
+        if (error) {
+            std::lock_guard<std::mutex> guard(pl->lock);
+            if (i < pl->check_failed) {
+                pl->check_failed = i;
+                pl->check_error = error;
+            }
+        }
+    }
+
+    mydelete(buf);
 }
 
 
-bool recompress(const char* srcname, const char* dstname, bool decompress)
+// Checks the index of the new file against the old one, then has the
+// workers (still waiting in check_entries) decode every entry of it.
+// dstname is reopened, for reading from several threads at once.
+bool check_written(const char* name, const char* dstname, DBPF* dbpf_in, DBPF* dbpf_out, FILE* g, pipeline* pl)
 {
-    FILE* f = fopen(srcname, "rb");
+    int entry_count = dbpf_get_entry_count(dbpf_in);
+    if (entry_count != dbpf_get_entry_count(dbpf_out)) {
+        printf("%s: *** verify failed: entry count mismatch\n", name);
+        return false;
+    }
+
+    const dbpf_entry* entries1 = dbpf_get_entries(dbpf_in);
+    const dbpf_entry* entries2 = dbpf_get_entries(dbpf_out);
+
+    for (int i = 0; i < entry_count; ++i) {
+        const dbpf_entry *a = &entries1[i], *b = &entries2[i];
+        if (a->type_id != b->type_id || a->group_id != b->group_id
+            || a->instance_id != b->instance_id
+            || a->instance_id_2 != b->instance_id_2
+            || a->size != b->size
+            || (b->compressed_in_file ? b->size_in_file : b->size) != b->size_in_file)
+        {
+            printf("%s: *** verify failed: file metadata mismatch\n", name);
+            return false;
+        }
+    }
+
+    const char* error = "??? unknown error (bug)";
+    fflush(g);
+    auto_close_dbpf dbpf_check = dbpf_open_mmap(dstname, &error);
+    if (!dbpf_check)
+        dbpf_check = dbpf_open_file(dstname, 0, &error);
+    if (!dbpf_check) {
+        printf("%s: *** verify failed: reopen of new file failed: %s\n", name, error);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pl->lock);
+        pl->dbpf_check = dbpf_check;
+        pl->check = true;
+    }
+    pl->moved.notify_all();
+    for (size_t i = 0; i < pl->workers.size(); ++i)
+        pl->workers[i].join();
+    pl->workers.clear();
+
+    if (pl->check_failed < entry_count) {
+        printf("%s: *** verify failed: %s\n", name, pl->check_error);
+        return false;
+    }
+    return true;
+}
+
+
+struct options
+{
+    bool decompress;
+    bool paranoid;
+    bool compact_only;
+    int order;
+    double min_fragmentation;
+    int jobs;
+    const char* manifest_name;
+};
+
+/*
+ * The manifest (-m) remembers what dbpf-recompress did to each package,
+ * so that later runs can skip packages nothing has touched since and, in
+ * packages that have changed, the entries that were already done. The
+ * file is text: a header line, then for each package a line
+ *   <encoder> <size> <mtime> <index hash> <entry count> <path>
+ * followed by a line with the hash of each entry as stored.
+ */
+
+#define MANIFEST_HEADER "dbpf-recompress manifest 1"
+
+// Names the output of dbpf_compress (there is only one level). Change it
+// if the compressor ever changes, so that old manifests don't stop
+// entries from being recompressed.
+#define ENCODER_ID "benrq-qfs-20261018"
+#define DECOMPRESSED_ID "uncompressed"
+
+struct manifest_record
+{
+    std::string encoder;
+    long long size, mtime;
+    uint64_t index_hash;
+    std::vector<uint64_t> hashes;
+};
+
+struct manifest
+{
+    std::mutex lock;
+    std::map<std::string, manifest_record> records;  // by path as given on the command line
+};
+
+// A missing manifest file is the same as an empty one.
+static bool load_manifest(const char* name, manifest* m)
+{
+    FILE* f = fopen(name, "r");
+    if (!f)
+        return true;
+
+    char header[64];
+    if (!fgets(header, sizeof(header), f) || strncmp(header, MANIFEST_HEADER "\n", sizeof(header)) != 0) {
+        printf("%s: *** not a dbpf-recompress manifest\n", name);
+        fclose(f);
+        return false;
+    }
+
+    for (;;) {
+        char encoder[64];
+        manifest_record r;
+        unsigned long long index_hash;
+        int entry_count;
+        if (fscanf(f, "%63s %lld %lld %llx %d ", encoder, &r.size, &r.mtime, &index_hash, &entry_count) != 5 || entry_count < 0)
+            break;
+        r.encoder = encoder;
+        r.index_hash = index_hash;
+
+        std::string path;
+        int c;
+        while ((c = getc(f)) != EOF && c != '\n')
+            path += (char)c;
+
+        r.hashes.resize(entry_count);
+        int i;
+        for (i = 0; i < entry_count; ++i) {
+            unsigned long long hash;
+            if (fscanf(f, "%llx", &hash) != 1)
+                break;
+            r.hashes[i] = hash;
+        }
+        if (i < entry_count)
+            break;
+
+        m->records[path] = r;
+    }
+
+    bool ok = feof(f) && !ferror(f);
+    fclose(f);
+    if (!ok)
+        printf("%s: *** manifest is damaged\n", name);
+    return ok;
+}
+
+static bool save_manifest(const char* name, manifest* m)
+{
+    std::string name_new = std::string(name) + ".$new";
+    FILE* f = fopen(name_new.c_str(), "w");
     if (!f) {
-        puts("  *** open failed\n");
+        printf("%s: *** can't write manifest\n", name);
+        return false;
+    }
+
+    fprintf(f, MANIFEST_HEADER "\n");
+    for (std::map<std::string, manifest_record>::const_iterator it = m->records.begin(); it != m->records.end(); ++it) {
+        const manifest_record& r = it->second;
+        fprintf(f, "%s %lld %lld %016llx %d %s\n", r.encoder.c_str(), r.size, r.mtime,
+                (unsigned long long)r.index_hash, (int)r.hashes.size(), it->first.c_str());
+        for (size_t i = 0; i < r.hashes.size(); ++i)
+            fprintf(f, i ? " %016llx" : "%016llx", (unsigned long long)r.hashes[i]);
+        fprintf(f, "\n");
+    }
+
+    bool ok = !ferror(f);
+    ok &= (fclose(f) == 0);
+    if (!ok) {
+        printf("%s: *** can't write manifest\n", name);
+        remove(name_new.c_str());
+        return false;
+    }
+
+    // Swap the files the way go() does for packages, so that some
+    // manifest is in place at every point
+    std::string name_old = std::string(name) + ".$old";
+    std::error_code ec;
+    bool had_old = std::filesystem::exists(name, ec);
+    remove(name_old.c_str());
+    if (had_old && rename(name, name_old.c_str()) < 0) {
+        printf("%s: *** renaming \"%s\" to \"%s\" failed; the new manifest is in \"%s\"\n", name, name, name_old.c_str(), name_new.c_str());
         return false;
     }
+    if (rename(name_new.c_str(), name) < 0) {
+        printf("%s: *** renaming \"%s\" to \"%s\" failed; please check \"%s\" and \"%s\" and rename as appropriate\n", name, name_new.c_str(), name, name_new.c_str(), name_old.c_str());
+        return false;
+    }
+    if (had_old && remove(name_old.c_str()) < 0)
+        printf("%s: *** removing \"%s\" failed; please delete manually\n", name, name_old.c_str());
+    return true;
+}
+
+// mtime is in the file system's own units, often finer than seconds.
+static bool get_file_time(const char* name, long long* size, long long* mtime)
+{
+    std::error_code ec;
+    *size = std::filesystem::file_size(name, ec);
+    if (ec) return false;
+    *mtime = std::filesystem::last_write_time(name, ec).time_since_epoch().count();
+    return !ec;
+}
+
+// Hash of everything in the index, including where each entry is.
+static uint64_t index_hash(DBPF* dbpf)
+{
+    int entry_count = dbpf_get_entry_count(dbpf);
+    const dbpf_entry* entries = dbpf_get_entries(dbpf);
+    std::vector<uint32_t> fields;
+    fields.reserve(entry_count * 8);
+    for (int i = 0; i < entry_count; ++i) {
+        const dbpf_entry* e = &entries[i];
+        fields.push_back(e->type_id);
+        fields.push_back(e->group_id);
+        fields.push_back(e->instance_id);
+        fields.push_back(e->instance_id_2);
+        fields.push_back(e->size);
+        fields.push_back(e->compressed_in_file);
+        fields.push_back(e->offset_in_file);
+        fields.push_back(e->size_in_file);
+    }
+    return xxh64(fields.data(), fields.size() * sizeof(uint32_t), 0);
+}
 
+// True if the file is still as this program last left it.
+static bool unchanged(const char* name, const manifest_record& r)
+{
+    long long size, mtime;
+    if (!get_file_time(name, &size, &mtime) || size != r.size || mtime != r.mtime)
+        return false;
+
+    FILE* f = fopen(name, "rb");
+    if (!f)
+        return false;
+    const char* error;
+    auto_close_dbpf dbpf = dbpf_open_stdio(f, &error);
+    return dbpf && index_hash(dbpf) == r.index_hash
+        && dbpf_get_entry_count(dbpf) == (int)r.hashes.size();
+}
+
+
+bool recompress(const char* srcname, const char* dstname, const options* opt, int jobs,
+                const std::unordered_set<uint64_t>* known, manifest_record* record)
+{
+    bool decompress = opt->decompress;
+
+    // Workers read the input all at once, so it needs thread-safe callbacks
     const char* error = "??? unknown error (bug)";
-    auto_close_dbpf dbpf_in = dbpf_open_stdio(f, &error);
+    auto_close_dbpf dbpf_in = dbpf_open_mmap(srcname, &error);
+    if (!dbpf_in)
+        dbpf_in = dbpf_open_file(srcname, 0, &error);
     if (!dbpf_in) {
-        printf("  *** open failed: %s\n", error);
+        printf("%s: *** open failed: %s\n", srcname, error);
         return false;
     }
 
     FILE* g = fopen(dstname, "w+b");
     if (!g) {
-        puts("  *** output open failed\n");
+        printf("%s: *** output open failed\n", srcname);
         return false;
     }
 
@@ -218,7 +837,7 @@ bool recompress(const char* srcname, const char* dstname, bool decompress)
 
     auto_close_dbpf dbpf_out = dbpf_open_stdio(g, &error);
     if (!dbpf_out) {
-        printf("  *** output open failed: %s\n", error);
+        printf("%s: *** output open failed: %s\n", srcname, error);
         return false;
     }
 
@@ -232,64 +851,282 @@ bool recompress(const char* srcname, const char* dstname, bool decompress)
         new_entries[i].write_disposition = decompress ? dbpf_write_uncompressed : dbpf_write_compressed;
     }
 
-    write_info wi = { dbpf_in, entries, 0 };
-    bool success = (dbpf_write(dbpf_out, new_entries, entry_count, &wi, get_data, &error) >= 0);
-    if (wi.p) free(wi.p);
+    pipeline pl;
+    pl.dbpf_in = dbpf_in;
+    pl.entries = entries;
+    pl.entry_count = entry_count;
+    pl.decompress = decompress;
+    pl.window = jobs * 4;
+    pl.next_to_read = 0;
+    pl.next_to_write = 0;
+    pl.stop = false;
+    work_slot empty_slot = { -1, false, 0, 0, 0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0 };
+    pl.slots.assign(pl.window, empty_slot);
+    pl.hashes.assign(entry_count, 0);
+    pl.content_hashes.assign(entry_count, 0);
+    pl.known = known;
+    pl.dbpf_check = 0;
+    pl.check = false;
+    pl.next_to_check = 0;
+    pl.check_failed = entry_count;
+    pl.check_error = 0;
+
+    for (int i = 0; i < jobs && i < entry_count; ++i)
+        pl.workers.push_back(std::thread(worker, &pl));
+
+    bool success = (dbpf_write_ex(dbpf_out, new_entries, entry_count, &pl, get_data, 0, &error) >= 0);
+
+    // The workers are done reading and wait to check the new file; the
+    // slots aren't needed any more either way.
+    bool checked = success && check_written(srcname, dstname, dbpf_in, dbpf_out, g, &pl);
+
+    {
+        std::lock_guard<std::mutex> guard(pl.lock);
+        pl.stop = true;
+    }
+    pl.moved.notify_all();
+    for (size_t i = 0; i < pl.workers.size(); ++i)
+        pl.workers[i].join();
+    for (int i = 0; i < pl.window; ++i) {
+        mydelete(pl.slots[i].buf);
+        mydelete(pl.slots[i].cbuf);
+        mydelete(pl.slots[i].vbuf);
+        release_stored(&pl, &pl.slots[i]);
+    }
+
     if (!success) {
-        printf("  *** rewrite failed: %s\n", error);
+        printf("%s: *** rewrite failed: %s\n", srcname, error);
         return false;
     }
 
-    return verify(f,g);
+    if (!checked)
+        return false;
+
+    record->index_hash = index_hash(dbpf_out);
+    record->hashes.swap(pl.hashes);
+
+    return !opt->paranoid || verify(srcname, dbpf_in, g);
 }
 
 
-bool go(const char* name, bool decompress)
+bool go(const char* name, const options* opt, manifest* m, int jobs)
 {
     printf("%s\n", name);
 
+    const char* encoder = opt->decompress ? DECOMPRESSED_ID : ENCODER_ID;
+    manifest_record record;
+    if (m) {
+        std::lock_guard<std::mutex> guard(m->lock);
+        std::map<std::string, manifest_record>::const_iterator it = m->records.find(name);
+        if (it != m->records.end() && it->second.encoder == encoder)
+            record = it->second;
+    }
+    if (!record.encoder.empty() && unchanged(name, record)) {
+        printf("%s: unchanged since the last run, skipped\n", name);
+        return true;
+    }
+    std::unordered_set<uint64_t> known(record.hashes.begin(), record.hashes.end());
+
     auto_mydelete<char> name_new = mynew<char>(strlen(name) + 6);
     auto_mydelete<char> name_old = mynew<char>(strlen(name) + 6);
     sprintf(name_new, "%s.$new", name);
     sprintf(name_old, "%s.$old", name);
 
-    if (recompress(name, name_new, decompress)) {
+    if (recompress(name, name_new, opt, jobs, m ? &known : 0, &record)) {
         if (rename(name, name_old) < 0) {
-            printf("  *** renaming \"%s\" to \"%s\" failed; cleaning up\n", name, (char*)name_old);
+            printf("%s: *** renaming \"%s\" to \"%s\" failed; cleaning up\n", name, name, (char*)name_old);
             remove(name_new);
             return false;
         }
         if (rename(name_new, name) < 0) {
-            printf("  *** renaming \"%s\" to \"%s\" failed; please check \"%s\" and \"%s\" and rename as appropriate\n", (char*)name_new, name, (char*)name_new, (char*)name_old);
+            printf("%s: *** renaming \"%s\" to \"%s\" failed; please check \"%s\" and \"%s\" and rename as appropriate\n", name, (char*)name_new, name, (char*)name_new, (char*)name_old);
             return false;
         }
         if (remove(name_old) < 0) {
-            printf("  *** removing \"%s\" failed; please delete manually\n", (char*)name_old);
+            printf("%s: *** removing \"%s\" failed; please delete manually\n", name, (char*)name_old);
         }
     } else {
         remove(name_new);
         return false;
     }
 
+    if (m && get_file_time(name, &record.size, &record.mtime)) {
+        record.encoder = encoder;
+        std::lock_guard<std::mutex> guard(m->lock);
+        m->records[name] = record;
+    }
+
     return true;
 }
 
 
+bool compact(const char* name, int order, double min_fragmentation)
+{
+    FILE* f = fopen(name, "r+b");
+    if (!f) {
+        printf("%s: *** open failed\n", name);
+        return false;
+    }
+
+    const char* error = "??? unknown error (bug)";
+    auto_close_dbpf dbpf = dbpf_open_stdio(f, &error);
+    if (!dbpf) {
+        printf("%s: *** open failed: %s\n", name, error);
+        return false;
+    }
+
+    double fragmentation = dbpf_get_fragmentation(dbpf);
+    if (fragmentation < 0) {
+        printf("%s: *** allocation failure\n", name);
+        return false;
+    }
+    printf("%s: %.1f%% free space\n", name, fragmentation * 100);
+    if (fragmentation * 100 < min_fragmentation)
+        return true;
+
+    if (dbpf_compact(dbpf, order, &error) < 0) {
+        printf("%s: *** compaction failed, the file may be damaged: %s\n", name, error);
+        return false;
+    }
+
+    return true;
+}
+
+
+// Adds name to names, or if it's a directory, every .package file under it.
+static bool add_files(const char* name, std::vector<std::string>& names)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!fs::is_directory(name, ec)) {
+        names.push_back(name);
+        return true;
+    }
+
+    fs::recursive_directory_iterator it(name, ec), end;
+    if (ec) {
+        printf("%s: *** can't read directory\n", name);
+        return false;
+    }
+    size_t first = names.size();
+    for (; it != end; it.increment(ec)) {
+        if (ec) {
+            printf("%s: *** can't read directory\n", name);
+            return false;
+        }
+        if (!it->is_regular_file(ec))
+            continue;
+        std::string ext = it->path().extension().string();
+        for (size_t i = 0; i < ext.size(); ++i)
+            ext[i] = (char)tolower((unsigned char)ext[i]);
+        if (ext == ".package")
+            names.push_back(it->path().string());
+    }
+    std::sort(names.begin() + first, names.end());
+    return true;
+}
+
+
+// Works through names[*next...] with the other file threads.
+static void process_files(const options* opt, manifest* m, const std::vector<std::string>* names,
+                          int jobs_per_file, std::atomic<int>* next, std::atomic<int>* failures)
+{
+    for (int i; (i = (*next)++) < (int)names->size(); ) {
+        const char* name = (*names)[i].c_str();
+        bool ok = opt->compact_only ? compact(name, opt->order, opt->min_fragmentation)
+                                    : go(name, opt, m, jobs_per_file);
+        if (!ok)
+            ++*failures;
+    }
+}
+
+
 int main(int argc, char** argv)
 {
-    bool decompress = false;
-    if (argc >= 2 && strcmp(argv[1], "-d") == 0) {
-        decompress = true;
-        --argc;
-        ++argv;
+    options opt;
+    opt.decompress = false;
+    opt.paranoid = false;
+    opt.manifest_name = 0;
+    opt.compact_only = false;
+    opt.order = dbpf_compact_keep_order;
+    opt.min_fragmentation = 0;
+    opt.jobs = std::thread::hardware_concurrency();
+    if (opt.jobs < 1) opt.jobs = 1;
+
+    for (; argc >= 2 && argv[1][0] == '-'; --argc, ++argv) {
+        if (strcmp(argv[1], "-d") == 0) {
+            opt.decompress = true;
+        } else if (strcmp(argv[1], "-p") == 0) {
+            opt.paranoid = true;
+        } else if (strcmp(argv[1], "-m") == 0 && argc >= 3) {
+            opt.manifest_name = argv[2];
+            --argc;
+            ++argv;
+        } else if (strcmp(argv[1], "-c") == 0) {
+            opt.compact_only = true;
+        } else if (strcmp(argv[1], "-ct") == 0) {
+            opt.compact_only = true;
+            opt.order = dbpf_compact_by_type;
+        } else if (strcmp(argv[1], "-cs") == 0) {
+            opt.compact_only = true;
+            opt.order = dbpf_compact_by_tgi;
+        } else if (strcmp(argv[1], "-f") == 0 && argc >= 3) {
+            opt.min_fragmentation = atof(argv[2]);
+            --argc;
+            ++argv;
+        } else if (strcmp(argv[1], "-j") == 0 && argc >= 3 && atoi(argv[2]) > 0) {
+            opt.jobs = atoi(argv[2]);
+            --argc;
+            ++argv;
+        } else {
+            argc = 0;  // show usage
+            break;
+        }
     }
     if (argc < 2) {
-        printf("usage: dbpf-recompress [-d] a.package b.package ...\n"
-               "  -d  decompress all files instead of recompressing\n");
+        printf("usage: dbpf-recompress [-d] [-p] [-m manifest] [-j threads] a.package b.package dir ...\n"
+               "       dbpf-recompress -c|-ct|-cs [-f percent] [-j threads] a.package b.package dir ...\n"
+               "  -d   decompress all files instead of recompressing\n"
+               "  -p   after recompressing, compare old and new files in full\n"
+               "  -m   remember finished packages in this file, and skip them next time\n"
+               "  -c   only remove unused space (no recompression); NOT a safe update\n"
+               "  -ct  like -c, and group the files in the package by type\n"
+               "  -cs  like -c, and sort the files in the package by type/group/instance\n"
+               "  -f   with -c, skip packages with less than this percentage of unused space\n"
+               "  -j   number of threads to use (default: one per CPU)\n"
+               "Directories are searched for .package files.\n");
         return 0;
     }
+
+    std::vector<std::string> names;
     for (int i=1; i<argc; ++i)
-        if (!go(argv[i], decompress))
+        if (!add_files(argv[i], names))
             return 1;
-    return 0;
+
+    // Several packages are done at once, and each big one is also
+    // split up between threads; there are `jobs' threads either way.
+    int file_threads = std::min(opt.jobs, (int)names.size());
+    if (file_threads < 1) file_threads = 1;
+    int jobs_per_file = std::max(1, opt.jobs / file_threads);
+
+    manifest m;
+    manifest* pm = 0;
+    if (opt.manifest_name && !opt.compact_only) {
+        if (!load_manifest(opt.manifest_name, &m))
+            return 1;
+        pm = &m;
+    }
+
+    std::atomic<int> next(0), failures(0);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < file_threads; ++i)
+        threads.push_back(std::thread(process_files, &opt, pm, &names, jobs_per_file, &next, &failures));
+    process_files(&opt, pm, &names, jobs_per_file, &next, &failures);
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    if (pm && !save_manifest(opt.manifest_name, pm))
+        ++failures;
+
+    return failures ? 1 : 0;
 }
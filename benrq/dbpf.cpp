@@ -105,6 +105,9 @@ struct DBPF
     int (*read)(void* ctx, int start, int length, void* buf, const char** error);
     int (*write)(void* ctx, int start, int length, const void* buf, const char** error);
     int (*close)(void* ctx);
+    const void* (*map)(void* ctx, int start, int length, const char** error);  // these three may be NULL
+    void (*release)(void* ctx, const void* p, int start, int length);
+    int (*readv)(void* ctx, const dbpf_iovec* vec, int count, const char** error);
 
     int entry_count;
     dbpf_entry* entries;
@@ -119,6 +122,17 @@ int call_read(DBPF* dbpf, int start, int length, void* buf, const char** error)
     return length ? dbpf->read(dbpf->ctx, start, length, buf, error) : 0;
 }
 
+static inline
+int call_readv(DBPF* dbpf, const dbpf_iovec* vec, int count, const char** error)
+{
+    if (dbpf->readv && count > 1)
+        return dbpf->readv(dbpf->ctx, vec, count, error);
+    for (int i = 0; i < count; ++i)
+        if (call_read(dbpf, vec[i].start, vec[i].length, vec[i].buf, error) < 0)
+            return -1;
+    return 0;
+}
+
 static inline
 int call_write(DBPF* dbpf, int start, int length, const void* buf, const char** error)
 {
@@ -144,10 +158,67 @@ T* mynew(int n)
 static inline
 void mydelete(void* p) { if (p) free(p); }
 
+template<class T>
+class auto_mydelete {
+public:
+    T* val;
+    auto_mydelete() { val = 0; }
+    ~auto_mydelete() { mydelete(val); }
+    T* operator=(T* newval) { return val = newval; }
+    bool operator!() { return !val; }
+    T& operator[](int i) { return val[i]; }
+    operator T*() { return val; }
+    T* keep() { T* temp = val; val = 0; return temp; }
+};
+
+class auto_scratch {
+public:
+    dbpf_scratch* val;
+    auto_scratch() { val = 0; }
+    ~auto_scratch() { dbpf_scratch_free(val); }
+    dbpf_scratch* operator=(dbpf_scratch* newval) { return val = newval; }
+    operator dbpf_scratch*() { return val; }
+};
+
+
+/*
+ * Returns length bytes of the file starting at start: a pointer into the
+ * mapping if there is one, otherwise a copy. Returns NULL on failure.
+ * Every successful call_fetch needs a call_release.
+ */
+static
+const byte* call_fetch(DBPF* dbpf, int start, int length, const char** error)
+{
+    if (dbpf->map && length)
+        return (const byte*)dbpf->map(dbpf->ctx, start, length, error);
+    byte* buf = mynew<byte>(length);
+    if (!buf) {
+        *error = "allocation failure";
+        return 0;
+    }
+    if (call_read(dbpf, start, length, buf, error) < 0) {
+        mydelete(buf);
+        return 0;
+    }
+    return buf;
+}
+
+static
+void call_release(DBPF* dbpf, const byte* p, int start, int length)
+{
+    if (dbpf->map && length) {
+        if (dbpf->release)
+            dbpf->release(dbpf->ctx, p, start, length);
+    } else {
+        mydelete((void*)p);
+    }
+}
+
 
 bool decompress(const byte* src, int compressed_size, byte* dst, int uncompressed_size, bool truncate);
 byte* compress(const byte* src, const byte* srcend, byte* dst, byte* dstend, bool pad);
-static byte* try_compress(const byte* src, int srclen, int* dstlen);
+static byte* compress_scratch(const byte* src, const byte* srcend, byte* dst, byte* dstend, bool pad, dbpf_scratch* scratch);
+static byte* try_compress(const byte* src, int srclen, int* dstlen, dbpf_scratch* scratch);
 
 
 static const int MAX_FILE_SIZE = 0x40000000;
@@ -225,17 +296,34 @@ DBPF* dbpf_open(
     int (*write)(void* ctx, int start, int length, const void* buf, const char** error),
     int (*close)(void* ctx),
     const char** error)
+{
+    dbpf_callbacks callbacks = { read, write, close, 0, 0, 0 };
+    return dbpf_open_ex(ctx, &callbacks, error);
+}
+
+
+extern "C"
+DBPF* dbpf_open_ex(void* ctx, const dbpf_callbacks* callbacks, const char** error)
 {
 #define ERROR(msg)    do { *error = msg; dbpf_close(dbpf); return 0; } while (0)
 #define MAYFAIL(expr) do { if ((expr) < 0) { dbpf_close(dbpf); return 0; } } while (0)
+#define FAILZERO(expr) do { if ((expr) == 0) { dbpf_close(dbpf); return 0; } } while (0)
 #define ALLOC(expr)   do { if ((expr) == 0) ERROR("allocation failure"); } while (0)
 
     DBPF* dbpf;
-    ALLOC(dbpf = mynew<DBPF>(1));
+    if (!(dbpf = mynew<DBPF>(1))) {
+        // nothing to close it with but the callback
+        if (callbacks->close) callbacks->close(ctx);
+        *error = "allocation failure";
+        return 0;
+    }
     dbpf->ctx = ctx;
-    dbpf->read = read;
-    dbpf->write = write;
-    dbpf->close = close;
+    dbpf->read = callbacks->read;
+    dbpf->write = callbacks->write;
+    dbpf->close = callbacks->close;
+    dbpf->map = callbacks->map;
+    dbpf->release = callbacks->release;
+    dbpf->readv = callbacks->readv;
     dbpf->entry_count = 0;
     dbpf->entries = 0;
 
@@ -265,9 +353,8 @@ DBPF* dbpf_open(
         if (index_minor == 1) {
             if (dbpf->index_range.len != dbpf->entry_count * (int)sizeof(dbpf_index_1))
                 ERROR("bad DBPF file (index size mismatch)");
-            dbpf_index_1* idx;
-            ALLOC(idx = mynew<dbpf_index_1>(dbpf->entry_count));
-            MAYFAIL(call_read(dbpf, dbpf->index_range.ofs, dbpf->index_range.len, idx, error));
+            const dbpf_index_1* idx;
+            FAILZERO(idx = (const dbpf_index_1*)call_fetch(dbpf, dbpf->index_range.ofs, dbpf->index_range.len, error));
             int i;
             for (i = 0; i < dbpf->entry_count; ++i) {
                 dbpf->entries[i].type_id = get(idx[i].type_id);
@@ -277,13 +364,12 @@ DBPF* dbpf_open(
                 dbpf->entries[i].offset_in_file = get(idx[i].offset);
                 dbpf->entries[i].size_in_file = get(idx[i].size);
             }
-            mydelete(idx);
+            call_release(dbpf, (const byte*)idx, dbpf->index_range.ofs, dbpf->index_range.len);
         } else {
             if (dbpf->index_range.len != dbpf->entry_count * (int)sizeof(dbpf_index_2))
                 ERROR("bad DBPF file (index size mismatch)");
-            dbpf_index_2* idx;
-            ALLOC(idx = mynew<dbpf_index_2>(dbpf->entry_count));
-            MAYFAIL(call_read(dbpf, dbpf->index_range.ofs, dbpf->index_range.len, idx, error));
+            const dbpf_index_2* idx;
+            FAILZERO(idx = (const dbpf_index_2*)call_fetch(dbpf, dbpf->index_range.ofs, dbpf->index_range.len, error));
             int i;
             for (i = 0; i < dbpf->entry_count; ++i) {
                 dbpf->entries[i].type_id = get(idx[i].type_id);
@@ -293,7 +379,7 @@ DBPF* dbpf_open(
                 dbpf->entries[i].offset_in_file = get(idx[i].offset);
                 dbpf->entries[i].size_in_file = get(idx[i].size);
             }
-            mydelete(idx);
+            call_release(dbpf, (const byte*)idx, dbpf->index_range.ofs, dbpf->index_range.len);
         }
         int i;
         for (i = 0; i < dbpf->entry_count; ++i) {
@@ -319,9 +405,8 @@ DBPF* dbpf_open(
             if (dbpf->dir_range.len % sizeof(dbpf_compressed_dir_1) != 0)
                 ERROR("bad DBPF file (bad compressed directory size)");
             int dir_entry_count = dbpf->dir_range.len / sizeof(dbpf_compressed_dir_1);
-            dbpf_compressed_dir_1* dir;
-            ALLOC(dir = mynew<dbpf_compressed_dir_1>(dir_entry_count));
-            MAYFAIL(call_read(dbpf, dbpf->dir_range.ofs, dbpf->dir_range.len, dir, error));
+            const dbpf_compressed_dir_1* dir;
+            FAILZERO(dir = (const dbpf_compressed_dir_1*)call_fetch(dbpf, dbpf->dir_range.ofs, dbpf->dir_range.len, error));
             int pos = 0;
             int i;
             for (i = 0; i < dir_entry_count; ++i) {
@@ -332,14 +417,13 @@ DBPF* dbpf_open(
                                 get(dir[i].decompressed_size),
                                 error));
             }
-            mydelete(dir);
+            call_release(dbpf, (const byte*)dir, dbpf->dir_range.ofs, dbpf->dir_range.len);
         } else {
             if (dbpf->dir_range.len % sizeof(dbpf_compressed_dir_2) != 0)
                 ERROR("bad DBPF file (bad compressed directory size)");
             int dir_entry_count = dbpf->dir_range.len / sizeof(dbpf_compressed_dir_2);
-            dbpf_compressed_dir_2* dir;
-            ALLOC(dir = mynew<dbpf_compressed_dir_2>(dir_entry_count));
-            MAYFAIL(call_read(dbpf, dbpf->dir_range.ofs, dbpf->dir_range.len, dir, error));
+            const dbpf_compressed_dir_2* dir;
+            FAILZERO(dir = (const dbpf_compressed_dir_2*)call_fetch(dbpf, dbpf->dir_range.ofs, dbpf->dir_range.len, error));
             int pos = 0;
             int i;
             for (i = 0; i < dir_entry_count; ++i) {
@@ -350,7 +434,7 @@ DBPF* dbpf_open(
                                 get(dir[i].decompressed_size),
                                 error));
             }
-            mydelete(dir);
+            call_release(dbpf, (const byte*)dir, dbpf->dir_range.ofs, dbpf->dir_range.len);
         }
     }
 
@@ -358,6 +442,7 @@ DBPF* dbpf_open(
 
 #undef ERROR
 #undef MAYFAIL
+#undef FAILZERO
 #undef ALLOC
 }
 
@@ -374,19 +459,16 @@ int dbpf_read(DBPF* dbpf, int entry_index, byte* buf, const char** error)
 {
     const dbpf_entry* e = &dbpf->entries[entry_index];
     if (e->compressed_in_file) {
-        byte* rawbuf = mynew<byte>(e->size_in_file);
-        if (!rawbuf) {
-            *error = "allocation failure";
+        // with a mapping, this decompresses straight out of it
+        const byte* raw = call_fetch(dbpf, e->offset_in_file, e->size_in_file, error);
+        if (!raw)
             return -1;
-        }
         int rtn = 0;
-        if (call_read(dbpf, e->offset_in_file, e->size_in_file, rawbuf, error) < 0) {
-            rtn = -1;
-        } else if (!decompress(rawbuf, e->size_in_file, buf, e->size, false)) {
+        if (!decompress(raw, e->size_in_file, buf, e->size, false)) {
             *error = "bad DBPF file (invalid compressed data)";
             rtn = -1;
         }
-        mydelete(rawbuf);
+        call_release(dbpf, raw, e->offset_in_file, e->size_in_file);
         return rtn;
     } else {
         int result = call_read(dbpf, e->offset_in_file, e->size, buf, error);
@@ -395,6 +477,86 @@ int dbpf_read(DBPF* dbpf, int entry_index, byte* buf, const char** error)
 }
 
 
+extern "C"
+int dbpf_read_many(DBPF* dbpf, const int* entry_indexes, int count, byte* const* bufs, const char** error)
+{
+    // Everything that can be read directly into bufs (or into one
+    // buffer for the compressed data, without a mapping) goes in one
+    // readv call; then the compressed entries are decompressed.
+    int raw_total = 0;
+    int i;
+    for (i = 0; i < count; ++i) {
+        const dbpf_entry* e = &dbpf->entries[entry_indexes[i]];
+        if (e->compressed_in_file && !dbpf->map)
+            raw_total += e->size_in_file;
+    }
+
+    auto_mydelete<dbpf_iovec> vec;
+    auto_mydelete<byte> raw;
+    vec = mynew<dbpf_iovec>(count);
+    raw = mynew<byte>(raw_total);
+    if (!vec || !raw) {
+        *error = "allocation failure";
+        return -1;
+    }
+
+    int nvec = 0, raw_pos = 0;
+    for (i = 0; i < count; ++i) {
+        const dbpf_entry* e = &dbpf->entries[entry_indexes[i]];
+        if (!e->compressed_in_file) {
+            dbpf_iovec v = { e->offset_in_file, e->size, bufs[i] };
+            vec[nvec++] = v;
+        } else if (!dbpf->map) {
+            dbpf_iovec v = { e->offset_in_file, e->size_in_file, raw + raw_pos };
+            vec[nvec++] = v;
+            raw_pos += e->size_in_file;
+        }
+    }
+    if (call_readv(dbpf, vec, nvec, error) < 0)
+        return -1;
+
+    raw_pos = 0;
+    for (i = 0; i < count; ++i) {
+        const dbpf_entry* e = &dbpf->entries[entry_indexes[i]];
+        if (!e->compressed_in_file)
+            continue;
+        const byte* src;
+        if (dbpf->map) {
+            if (!(src = call_fetch(dbpf, e->offset_in_file, e->size_in_file, error)))
+                return -1;
+        } else {
+            src = raw + raw_pos;
+            raw_pos += e->size_in_file;
+        }
+        bool ok = decompress(src, e->size_in_file, bufs[i], e->size, false);
+        if (dbpf->map)
+            call_release(dbpf, src, e->offset_in_file, e->size_in_file);
+        if (!ok) {
+            *error = "bad DBPF file (invalid compressed data)";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+extern "C"
+const byte* dbpf_map_entry(DBPF* dbpf, int entry_index, const char** error)
+{
+    const dbpf_entry* e = &dbpf->entries[entry_index];
+    return call_fetch(dbpf, e->offset_in_file, e->compressed_in_file ? e->size_in_file : e->size, error);
+}
+
+
+extern "C"
+void dbpf_unmap_entry(DBPF* dbpf, int entry_index, const byte* p)
+{
+    const dbpf_entry* e = &dbpf->entries[entry_index];
+    if (p)
+        call_release(dbpf, p, e->offset_in_file, e->compressed_in_file ? e->size_in_file : e->size);
+}
+
+
 extern "C"
 int dbpf_read_64bytes(DBPF* dbpf, int entry_index, byte* buf, const char** error)
 {
@@ -574,28 +736,174 @@ range* find_holes(
 }
 
 
+/*
+ * Free space for dbpf_write. The holes are kept in two treaps over the
+ * same nodes, one ordered by (length, offset) for best-fit allocation
+ * and one ordered by offset for walking them in file order, so
+ * allocation is O(log n) in the number of holes.
+ * The old linear scan made dbpf_write O(entries * holes), which got slow
+ * on files that had been updated many times.
+ *
+ * Allocation picks the same hole the linear scan did (the smallest one
+ * that fits, lowest offset on ties), so files come out the same.
+ * Zero-length holes are kept, as before, since the hole list that
+ * dbpf_write writes includes them.
+ */
+
+struct hole_node
+{
+    range r;
+    unsigned prio;
+    hole_node* link[2][2];  // [tree][left/right]
+};
+
+enum { by_size = 0, by_offset = 1 };
+
+struct hole_table
+{
+    hole_node* pool;
+    hole_node* root[2];
+    int count;
+    unsigned seed;
+
+    hole_table() { pool = 0; }
+    ~hole_table() { mydelete(pool); }
+};
+
+static inline
+bool hole_less(int tree, const range& a, const range& b)
+{
+    if (tree == by_size && a.len != b.len)
+        return a.len < b.len;
+    return a.ofs < b.ofs;
+}
+
+static inline
+hole_node* treap_rotate(int tree, hole_node* root, int side)
+{
+    hole_node* child = root->link[tree][side];
+    root->link[tree][side] = child->link[tree][!side];
+    child->link[tree][!side] = root;
+    return child;
+}
+
 static
-int file_alloc(int size, range* holes, int num_holes)
-{
-    // Put the file in the smallest hole that's large enough to accommodate it
-    int best_len = MAX_FILE_SIZE;
-    int hole = -1;
-    for (int i=0; i<num_holes; ++i) {
-        if (holes[i].len >= size) {
-            if (holes[i].len < best_len) {
-                hole = i;
-                best_len = holes[i].len;
-            }
-        }
+hole_node* treap_insert(int tree, hole_node* root, hole_node* n)
+{
+    if (!root) {
+        n->link[tree][0] = n->link[tree][1] = 0;
+        return n;
     }
-    if (hole < 0) {
-        return -1;
-    } else {
-        int result = holes[hole].ofs;
-        holes[hole].ofs += size;
-        holes[hole].len -= size;
-        return result;
+    int side = hole_less(tree, root->r, n->r);
+    root->link[tree][side] = treap_insert(tree, root->link[tree][side], n);
+    if (root->link[tree][side]->prio > root->prio)
+        root = treap_rotate(tree, root, side);
+    return root;
+}
+
+static
+hole_node* treap_erase(int tree, hole_node* root, hole_node* n)
+{
+    if (!root) return 0;  // not found (bug)
+    if (root == n) {
+        hole_node* left = n->link[tree][0];
+        hole_node* right = n->link[tree][1];
+        if (!left) return right;
+        if (!right) return left;
+        int side = (right->prio > left->prio);
+        root = treap_rotate(tree, n, side);
+        root->link[tree][!side] = treap_erase(tree, n, n);
+        return root;
+    }
+    int side = hole_less(tree, root->r, n->r);
+    root->link[tree][side] = treap_erase(tree, root->link[tree][side], n);
+    return root;
+}
+
+static inline
+void hole_table_link(hole_table* ht, hole_node* n)
+{
+    ht->seed = ht->seed * 1103515245 + 12345;
+    n->prio = ht->seed >> 8;
+    ht->root[by_size] = treap_insert(by_size, ht->root[by_size], n);
+    ht->root[by_offset] = treap_insert(by_offset, ht->root[by_offset], n);
+    ++ht->count;
+}
+
+static inline
+void hole_table_unlink(hole_table* ht, hole_node* n)
+{
+    ht->root[by_size] = treap_erase(by_size, ht->root[by_size], n);
+    ht->root[by_offset] = treap_erase(by_offset, ht->root[by_offset], n);
+    --ht->count;
+}
+
+/*
+ * Fills the table with num_holes holes (as from find_holes).
+ * Returns false on allocation failure.
+ */
+static
+bool hole_table_init(hole_table* ht, const range* holes, int num_holes)
+{
+    mydelete(ht->pool);
+    ht->pool = mynew<hole_node>(num_holes);
+    if (!ht->pool) return false;
+    ht->root[by_size] = ht->root[by_offset] = 0;
+    ht->count = 0;
+    ht->seed = 1;
+    for (int i = 0; i < num_holes; ++i) {
+        ht->pool[i].r = holes[i];
+        hole_table_link(ht, &ht->pool[i]);
+    }
+    return true;
+}
+
+/*
+ * Put the file in the smallest hole that's large enough to accommodate it.
+ * Returns the offset, or -1 if no hole is large enough.
+ */
+static
+int file_alloc(int size, hole_table* ht)
+{
+    hole_node* best = 0;
+    hole_node* p = ht->root[by_size];
+    while (p) {
+        if (p->r.len >= size) {
+            best = p;
+            p = p->link[by_size][0];
+        } else {
+            p = p->link[by_size][1];
+        }
     }
+    if (!best) return -1;
+
+    int result = best->r.ofs;
+    hole_table_unlink(ht, best);
+    best->r.ofs += size;
+    best->r.len -= size;
+    hole_table_link(ht, best);
+    return result;
+}
+
+static
+void hole_table_export_node(const hole_node* n, range* out, int* k)
+{
+    if (!n) return;
+    hole_table_export_node(n->link[by_offset][0], out, k);
+    out[(*k)++] = n->r;
+    hole_table_export_node(n->link[by_offset][1], out, k);
+}
+
+/*
+ * Copies the holes, in order of offset, to out (which must have room for
+ * ht->count ranges). Returns the number of holes.
+ */
+static
+int hole_table_export(const hole_table* ht, range* out)
+{
+    int k = 0;
+    hole_table_export_node(ht->root[by_offset], out, &k);
+    return k;
 }
 
 
@@ -619,27 +927,91 @@ static bool duplicate_entries(const dbpf_entry* entries, int entry_count)
 }
 
 
-template<class T>
-class auto_mydelete {
-public:
-    T* val;
-    auto_mydelete() { val = 0; }
-    ~auto_mydelete() { mydelete(val); }
-    T* operator=(T* newval) { return val = newval; }
-    bool operator!() { return !val; }
-    T& operator[](int i) { return val[i]; }
-    operator T*() { return val; }
-    T* keep() { T* temp = val; val = 0; return temp; }
-};
+/*
+ * Writes the compressed file directory for the compressed entries to
+ * dir_range, and adds an entry for it at the end of entries (which must
+ * have room for it).
+ */
+static
+int write_dir(DBPF* dbpf, dbpf_entry* entries, int* entry_count, range dir_range, const char** error)
+{
+    int num_compressed = dir_range.len / sizeof(dbpf_compressed_dir_2);
+    dbpf_compressed_dir_2* dir = mynew<dbpf_compressed_dir_2>(num_compressed);
+    if (!dir) {
+        *error = "allocation failure";
+        return -1;
+    }
+    int j = 0;
+    for (int i = 0; i < *entry_count; ++i) {
+        dbpf_entry* e = &entries[i];
+        if (e->compressed_in_file) {
+            put(dir[j].type_id, e->type_id);
+            put(dir[j].group_id, e->group_id);
+            put(dir[j].instance_id, e->instance_id);
+            put(dir[j].instance_id_2, e->instance_id_2);
+            put(dir[j].decompressed_size, e->size);
+            ++j;
+        }
+    }
+    assert(j == num_compressed);
+
+    // add a compressed file directory
+    dbpf_entry* e = &entries[(*entry_count)++];
+    e->type_id = DBPF_TYPE_COMPRESSED_FILE_DIRECTORY;
+    e->group_id = DBPF_TYPE_COMPRESSED_FILE_DIRECTORY;
+    e->instance_id = DBPF_INSTANCE_COMPRESSED_FILE_DIRECTORY;
+    e->instance_id_2 = 0;
+    e->size = dir_range.len;
+    e->write_disposition = dbpf_write_keep_existing;
+    e->compressed_in_file = 0;
+    e->offset_in_file = dir_range.ofs;
+    e->size_in_file = dir_range.len;
+
+    int io = call_write(dbpf, dir_range.ofs, dir_range.len, dir, error);
+    mydelete(dir);
+    return io;
+}
 
 
-extern "C"
-int dbpf_write(
+static
+int write_index(DBPF* dbpf, const dbpf_entry* entries, int entry_count, range index_range, const char** error)
+{
+    dbpf_index_2* index = mynew<dbpf_index_2>(entry_count);
+    if (!index) {
+        *error = "allocation failure";
+        return -1;
+    }
+    for (int i = 0; i < entry_count; ++i) {
+        const dbpf_entry* e = &entries[i];
+        dbpf_index_2* x = &index[i];
+        put(x->type_id, e->type_id);
+        put(x->group_id, e->group_id);
+        put(x->instance_id, e->instance_id);
+        put(x->instance_id_2, e->instance_id_2);
+        put(x->offset, e->offset_in_file);
+        put(x->size, e->size_in_file);
+    }
+    int io = call_write(dbpf, index_range.ofs, index_range.len, index, error);
+    mydelete(index);
+    return io;
+}
+
+
+/*
+ * The guts of dbpf_write and dbpf_append. In append mode the only free
+ * space used is past the end of the data, so everything new goes at the
+ * end of the file, and whatever the new index no longer refers to goes
+ * in the hole list.
+ */
+static
+int write_package(
     DBPF* dbpf,
     const struct dbpf_entry* client_new_entries,
     int client_new_entry_count,
     void* ctx,
-    const byte* (*get_data)(void* ctx, int entry_index, const char** error),
+    const byte* (*get_data)(void* ctx, int entry_index, dbpf_entry* entry, const char** error),
+    bool append,
+    dbpf_scratch* scratch,
     const char** error)
 {
 #define ERROR(msg)      do { *error = msg; return -1; } while (0)
@@ -655,6 +1027,12 @@ int dbpf_write(
             dbpf->entries, dbpf->entry_count,
             dbpf->index_range, dbpf->hole_range, dbpf->dir_range,
             &num_holes));
+    hole_table free_space;
+    if (append) {
+        ALLOC(hole_table_init(&free_space, &holes[num_holes-1], 1));
+    } else {
+        ALLOC(hole_table_init(&free_space, holes, num_holes));
+    }
 
     // Find a location for each entry in the new index (including
     // the compressed file directory) plus the index and table of holes.
@@ -673,27 +1051,39 @@ int dbpf_write(
 
     int num_compressed = 0;
 
+    // Compressed entries go through one buffer, which only grows
+    auto_scratch own_scratch;
+
     {for (int i = 0; i < new_entry_count; ++i) {
 
         dbpf_entry* e = &new_entries[i];
         if (e->type_id == DBPF_TYPE_COMPRESSED_FILE_DIRECTORY)
             ERROR("invalid type ID (bug)");
 
-        byte* compressed = 0;
         const byte* data_to_write = 0;
 
+        if (e->write_disposition != dbpf_write_keep_existing) {
+            if (e->write_disposition < dbpf_write_uncompressed || e->write_disposition > dbpf_write_compressed_raw)
+                ERROR("invalid write_disposition (bug)");
+            // the callback may change its mind about the disposition
+            FAILZERO(data_to_write = get_data(ctx, i, e, error));
+        }
+
         switch (e->write_disposition)
         {
         case dbpf_write_keep_existing:
+            if (data_to_write)
+                ERROR("invalid write_disposition from get_data (bug)");
             break;
         case dbpf_write_uncompressed:
-            FAILZERO(data_to_write = get_data(ctx, i, error));
             e->compressed_in_file = 0;
             e->size_in_file = e->size;
             break;
         case dbpf_write_compressed:
-            FAILZERO(data_to_write = get_data(ctx, i, error));
-            compressed = try_compress(data_to_write, e->size, &e->size_in_file);
+            if (!scratch)
+                ALLOC(scratch = own_scratch = dbpf_scratch_new());
+            byte* compressed;
+            compressed = try_compress(data_to_write, e->size, &e->size_in_file, scratch);
             if (compressed) {
                 data_to_write = compressed;
                 e->compressed_in_file = 1;
@@ -703,17 +1093,14 @@ int dbpf_write(
             }
             break;
         case dbpf_write_compressed_raw:
-            FAILZERO(data_to_write = get_data(ctx, i, error));
             e->compressed_in_file = 1;
             break;
         default:
-            ERROR("invalid write_disposition (bug)");
+            ERROR("invalid write_disposition from get_data (bug)");
         }
         if (e->write_disposition != dbpf_write_keep_existing) {
-            FILEALLOC(e->offset_in_file = file_alloc(e->size_in_file, holes, num_holes));
-            int io = call_write(dbpf, e->offset_in_file, e->size_in_file, data_to_write, error);
-            mydelete(compressed);
-            FAILMINUS(io);
+            FILEALLOC(e->offset_in_file = file_alloc(e->size_in_file, &free_space));
+            FAILMINUS(call_write(dbpf, e->offset_in_file, e->size_in_file, data_to_write, error));
             e->write_disposition = dbpf_write_keep_existing;
         }
         num_compressed += !!e->compressed_in_file;
@@ -724,38 +1111,8 @@ int dbpf_write(
     new_dir_range.ofs = 0;
 
     if (new_dir_range.len > 0) {
-        // add a compressed file directory
-
-        FILEALLOC(new_dir_range.ofs = file_alloc(new_dir_range.len, holes, num_holes));
-
-        dbpf_entry* e = &new_entries[new_entry_count++];
-        e->type_id = DBPF_TYPE_COMPRESSED_FILE_DIRECTORY;
-        e->group_id = DBPF_TYPE_COMPRESSED_FILE_DIRECTORY;
-        e->instance_id = DBPF_INSTANCE_COMPRESSED_FILE_DIRECTORY;
-        e->instance_id_2 = 0;
-        e->size = new_dir_range.len;
-        e->write_disposition = dbpf_write_keep_existing;
-        e->compressed_in_file = 0;
-        e->offset_in_file = new_dir_range.ofs;
-        e->size_in_file = new_dir_range.len;
-
-        dbpf_compressed_dir_2* dir;
-        ALLOC(dir = mynew<dbpf_compressed_dir_2>(num_compressed));
-        int j = 0;
-        for (int i = 0; i < new_entry_count; ++i) {
-            dbpf_entry* e2 = &new_entries[i];
-            if (e2->compressed_in_file) {
-                put(dir[j].type_id, e2->type_id);
-                put(dir[j].group_id, e2->group_id);
-                put(dir[j].instance_id, e2->instance_id);
-                put(dir[j].instance_id_2, e2->instance_id_2);
-                put(dir[j].decompressed_size, e2->size);
-                ++j;
-            }
-        }
-        int io = call_write(dbpf, new_dir_range.ofs, new_dir_range.len, dir, error);
-        mydelete(dir);
-        FAILMINUS(io);
+        FILEALLOC(new_dir_range.ofs = file_alloc(new_dir_range.len, &free_space));
+        FAILMINUS(write_dir(dbpf, new_entries, &new_entry_count, new_dir_range, error));
     }
 
     // Write the new index to the file
@@ -763,22 +1120,8 @@ int dbpf_write(
     new_index_range.len = new_entry_count * sizeof(dbpf_index_2);
     new_index_range.ofs = 0;
     if (new_index_range.len) {
-        FILEALLOC(new_index_range.ofs = file_alloc(new_index_range.len, holes, num_holes));
-        dbpf_index_2* index;
-        ALLOC(index = mynew<dbpf_index_2>(new_entry_count));
-        for (int i = 0; i < new_entry_count; ++i) {
-            dbpf_entry* e = &new_entries[i];
-            dbpf_index_2* x = &index[i];
-            put(x->type_id, e->type_id);
-            put(x->group_id, e->group_id);
-            put(x->instance_id, e->instance_id);
-            put(x->instance_id_2, e->instance_id_2);
-            put(x->offset, e->offset_in_file);
-            put(x->size, e->size_in_file);
-        }
-        int io = call_write(dbpf, new_index_range.ofs, new_index_range.len, index, error);
-        mydelete(index);
-        FAILMINUS(io);
+        FILEALLOC(new_index_range.ofs = file_alloc(new_index_range.len, &free_space));
+        FAILMINUS(write_index(dbpf, new_entries, new_entry_count, new_index_range, error));
     }
 
     // Almost done! Make and write a new hole list
@@ -787,16 +1130,29 @@ int dbpf_write(
             new_entries, new_entry_count,
             new_index_range, new_index_range, new_index_range,
             &num_holes));
+    if (append) {
+        ALLOC(hole_table_init(&free_space, &holes[num_holes-1], 1));
+    } else {
+        ALLOC(hole_table_init(&free_space, holes, num_holes));
+    }
 
     range new_hole_range;
     new_hole_range.len = (num_holes-1) * sizeof(dbpf_hole);
     new_hole_range.ofs = 0;
+    int new_file_size = holes[num_holes-1].ofs;
 
     if (new_hole_range.len) {
         // There's a silly catch-22 here: if the hole list exactly fills a hole,
         // then there's one less hole, so the hole list gets shorter, which means
         // it doesn't fill the hole... I hope a hole length of zero is okay.
-        FILEALLOC(new_hole_range.ofs = file_alloc(new_hole_range.len, holes, num_holes));
+        // (In append mode it goes at the end and doesn't fill any hole.)
+        FILEALLOC(new_hole_range.ofs = file_alloc(new_hole_range.len, &free_space));
+        if (append) {
+            new_file_size = new_hole_range.ofs + new_hole_range.len;
+        } else {
+            hole_table_export(&free_space, holes);
+            new_file_size = holes[num_holes-1].ofs;
+        }
         dbpf_hole* hole_list;
         ALLOC(hole_list = mynew<dbpf_hole>(num_holes-1));  // omit the final hole
         for (int i = 0; i < num_holes-1; ++i) {
@@ -814,10 +1170,10 @@ int dbpf_write(
     FAILMINUS(call_write(dbpf, 0, sizeof(dbpf_header), &hdr, error));
 
     // Truncate the file
-    FAILMINUS(call_truncate(dbpf, holes[num_holes-1].ofs, error));
+    FAILMINUS(call_truncate(dbpf, new_file_size, error));
 
     // Done!
-    dbpf->entry_count = client_new_entry_count;
+    dbpf->entry_count = new_entry_count - (new_dir_range.len > 0);
     mydelete(dbpf->entries);
     dbpf->entries = new_entries.keep();
     dbpf->index_range = new_index_range;
@@ -834,6 +1190,297 @@ int dbpf_write(
 }
 
 
+// dbpf_write's callback doesn't get the entry; this adapts it for write_package
+struct get_data_adapter
+{
+    void* ctx;
+    const byte* (*get_data)(void* ctx, int entry_index, const char** error);
+};
+
+static
+const byte* adapt_get_data(void* ctx, int entry_index, dbpf_entry*, const char** error)
+{
+    get_data_adapter* a = (get_data_adapter*)ctx;
+    return a->get_data(a->ctx, entry_index, error);
+}
+
+
+extern "C"
+int dbpf_write(
+    DBPF* dbpf,
+    const struct dbpf_entry* new_entries,
+    int new_entry_count,
+    void* ctx,
+    const byte* (*get_data)(void* ctx, int entry_index, const char** error),
+    const char** error)
+{
+    get_data_adapter a = { ctx, get_data };
+    return write_package(dbpf, new_entries, new_entry_count, &a, adapt_get_data, false, 0, error);
+}
+
+
+extern "C"
+int dbpf_write_ex(
+    DBPF* dbpf,
+    const struct dbpf_entry* new_entries,
+    int new_entry_count,
+    void* ctx,
+    const byte* (*get_data)(void* ctx, int entry_index, struct dbpf_entry* entry, const char** error),
+    dbpf_scratch* scratch,
+    const char** error)
+{
+    return write_package(dbpf, new_entries, new_entry_count, ctx, get_data, false, scratch, error);
+}
+
+
+extern "C"
+int dbpf_append(
+    DBPF* dbpf,
+    const struct dbpf_entry* new_entries,
+    int new_entry_count,
+    void* ctx,
+    const byte* (*get_data)(void* ctx, int entry_index, const char** error),
+    const char** error)
+{
+    get_data_adapter a = { ctx, get_data };
+    return write_package(dbpf, new_entries, new_entry_count, &a, adapt_get_data, true, 0, error);
+}
+
+
+extern "C"
+int dbpf_compress(const byte* src, int size, byte* dst)
+{
+    return dbpf_compress_scratch(src, size, dst, 0);
+}
+
+
+extern "C"
+int dbpf_compress_scratch(const byte* src, int size, byte* dst, dbpf_scratch* scratch)
+{
+    // There are only 3 byte for the uncompressed size in the header,
+    // so I guess we can only compress files larger than 16MB...
+    if (size < 14 || size >= 16777216) return 0;
+    auto_scratch own_scratch;
+    if (!scratch) {
+        scratch = own_scratch = dbpf_scratch_new();
+        if (!scratch) return 0;
+    }
+    byte* dstend = compress_scratch(src, src+size, dst, dst+size-1, false, scratch);
+    return dstend ? dstend - dst : 0;
+}
+
+
+extern "C"
+int dbpf_decompress(const byte* src, int compressed_size, byte* dst, int size)
+{
+    return decompress(src, compressed_size, dst, size, false) ? 0 : -1;
+}
+
+
+/*
+ * Copies len bytes from src to dst through buf. The ranges may overlap
+ * only if dst <= src, which is all compaction ever needs.
+ */
+static
+int move_data(DBPF* dbpf, int src, int dst, int len, byte* buf, int bufsize, const char** error)
+{
+    if (src == dst) return 0;
+    for (int done = 0; done < len; ) {
+        int n = len - done < bufsize ? len - done : bufsize;
+        if (call_read(dbpf, src + done, n, buf, error) < 0) return -1;
+        if (call_write(dbpf, dst + done, n, buf, error) < 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+
+static int CompareOffsets(const void* p, const void* q)
+{
+    const dbpf_entry* a = *(const dbpf_entry*const*)p;
+    const dbpf_entry* b = *(const dbpf_entry*const*)q;
+    return CompareUnsigned(a->offset_in_file, b->offset_in_file);
+}
+
+static int CompareTypesThenOffsets(const void* p, const void* q)
+{
+    const dbpf_entry* a = *(const dbpf_entry*const*)p;
+    const dbpf_entry* b = *(const dbpf_entry*const*)q;
+    int cmp = CompareUnsigned(a->type_id, b->type_id);
+    return cmp ? cmp : CompareOffsets(p, q);
+}
+
+
+extern "C"
+double dbpf_get_fragmentation(DBPF* dbpf)
+{
+    int num_holes;
+    range* holes = find_holes(
+            dbpf->entries, dbpf->entry_count,
+            dbpf->index_range, dbpf->hole_range, dbpf->dir_range,
+            &num_holes);
+    if (!holes) return -1;
+
+    // the last hole is everything past the end of the data
+    int end = holes[num_holes-1].ofs;
+    int unused = 0;
+    for (int i = 0; i < num_holes-1; ++i)
+        unused += holes[i].len;
+    mydelete(holes);
+
+    return end ? (double)unused / end : 0;
+}
+
+
+extern "C"
+int dbpf_compact(DBPF* dbpf, int order, const char** error)
+{
+#define ERROR(msg)      do { *error = msg; return -1; } while (0)
+#define FAILMINUS(expr) do { if ((expr) < 0) return -1; } while (0)
+#define ALLOC(expr)     do { if ((expr) == 0) ERROR("allocation failure"); } while (0)
+
+    int entry_count = dbpf->entry_count;
+
+    // The new layout is the header, the entries back to back in the
+    // requested order, then the compressed file directory and the index.
+
+    auto_mydelete<dbpf_entry> new_entries;
+    ALLOC(new_entries = mynew<dbpf_entry>(entry_count + 1));
+    if (entry_count)
+        memcpy(new_entries, dbpf->entries, entry_count * sizeof(dbpf_entry));
+
+    auto_mydelete<dbpf_entry*> plan;
+    ALLOC(plan = mynew<dbpf_entry*>(entry_count));
+    {for (int i = 0; i < entry_count; ++i)
+        plan[i] = &new_entries[i];}
+
+    switch (order)
+    {
+    case dbpf_compact_keep_order:
+        qsort(plan, entry_count, sizeof(dbpf_entry*), CompareOffsets);
+        break;
+    case dbpf_compact_by_type:
+        qsort(plan, entry_count, sizeof(dbpf_entry*), CompareTypesThenOffsets);
+        break;
+    case dbpf_compact_by_tgi:
+        qsort(plan, entry_count, sizeof(dbpf_entry*), CompareEntryPtrs);
+        break;
+    default:
+        ERROR("invalid compaction order (bug)");
+    }
+
+    // If the planned order is file order and nothing moves up, we can
+    // slide everything down in place. Otherwise the entries are first
+    // copied past the end of the file in the planned order, which makes
+    // it true.
+
+    int total = 0;
+    bool in_place = true;
+    int prev_end = 0;
+    {for (int i = 0; i < entry_count; ++i) {
+        const dbpf_entry* e = plan[i];
+        int dst = sizeof(dbpf_header) + total;
+        if (e->offset_in_file < prev_end || e->offset_in_file < dst)
+            in_place = false;
+        prev_end = e->offset_in_file + e->size_in_file;
+        total += e->size_in_file;
+        if (total < 0 || total >= MAX_FILE_SIZE)
+            ERROR("DBPF file too large");
+    }}
+
+    int bufsize = total < (1<<20) ? total : (1<<20);
+    auto_mydelete<byte> buf;
+    ALLOC(buf = mynew<byte>(bufsize));
+
+    if (!in_place) {
+        int num_holes;
+        auto_mydelete<range> holes;
+        ALLOC(holes = find_holes(
+                dbpf->entries, dbpf->entry_count,
+                dbpf->index_range, dbpf->hole_range, dbpf->dir_range,
+                &num_holes));
+        int tail = holes[num_holes-1].ofs;
+        if (tail >= MAX_FILE_SIZE - total)
+            ERROR("DBPF file too large");
+        for (int i = 0; i < entry_count; ++i) {
+            dbpf_entry* e = plan[i];
+            FAILMINUS(move_data(dbpf, e->offset_in_file, tail, e->size_in_file, buf, bufsize, error));
+            e->offset_in_file = tail;
+            tail += e->size_in_file;
+        }
+    }
+
+    // Slide the entries down, a run of adjacent entries at a time.
+    // From here on a failure leaves the file corrupt.
+
+    int dst = sizeof(dbpf_header);
+    {for (int i = 0; i < entry_count; ) {
+        int src = plan[i]->offset_in_file;
+        int run_dst = dst;
+        int len = 0;
+        do {
+            plan[i]->offset_in_file = dst;
+            dst += plan[i]->size_in_file;
+            len += plan[i]->size_in_file;
+            ++i;
+        } while (i < entry_count && plan[i]->offset_in_file == src + len);
+        FAILMINUS(move_data(dbpf, src, run_dst, len, buf, bufsize, error));
+    }}
+
+    // The index is written in the planned order, unless that's just file order.
+    if (order != dbpf_compact_keep_order) {
+        auto_mydelete<dbpf_entry> sorted;
+        ALLOC(sorted = mynew<dbpf_entry>(entry_count + 1));
+        for (int i = 0; i < entry_count; ++i)
+            sorted[i] = *plan[i];
+        mydelete(new_entries.keep());
+        new_entries = sorted.keep();
+    }
+
+    int new_entry_count = entry_count;
+    int num_compressed = 0;
+    {for (int i = 0; i < entry_count; ++i)
+        num_compressed += !!new_entries[i].compressed_in_file;}
+
+    range new_dir_range;
+    new_dir_range.len = num_compressed * sizeof(dbpf_compressed_dir_2);
+    new_dir_range.ofs = 0;
+    if (new_dir_range.len > 0) {
+        new_dir_range.ofs = dst;
+        FAILMINUS(write_dir(dbpf, new_entries, &new_entry_count, new_dir_range, error));
+        dst += new_dir_range.len;
+    }
+
+    range new_index_range;
+    new_index_range.len = new_entry_count * sizeof(dbpf_index_2);
+    new_index_range.ofs = 0;
+    if (new_index_range.len) {
+        new_index_range.ofs = dst;
+        FAILMINUS(write_index(dbpf, new_entries, new_entry_count, new_index_range, error));
+        dst += new_index_range.len;
+    }
+
+    range no_holes = {0,0};
+    dbpf_header hdr;
+    make_header(&hdr, new_entry_count, new_index_range, 0, no_holes);
+    FAILMINUS(call_write(dbpf, 0, sizeof(dbpf_header), &hdr, error));
+
+    FAILMINUS(call_truncate(dbpf, dst, error));
+
+    mydelete(dbpf->entries);
+    dbpf->entries = new_entries.keep();
+    dbpf->index_range = new_index_range;
+    dbpf->hole_range = no_holes;
+    dbpf->dir_range = new_dir_range;
+
+    return 0;
+
+#undef ERROR
+#undef FAILMINUS
+#undef ALLOC
+}
+
+
 /********************** low-level compression routines **********************/
 
 
@@ -946,30 +1593,93 @@ bool decompress(const byte* src, int compressed_size, byte* dst, int uncompresse
 
 
 /*
- * Try to compress the data and return the result in a buffer (which the
- * caller must delete). If it's uncompressable, return NULL.
+ * Working memory for compression that can be reused from one call to the
+ * next. The hash tables are big (768K) and the head table would need
+ * clearing for every call; instead each call stores positions offset by
+ * a new base, so that whatever earlier calls left behind looks like an
+ * empty slot (see class Hash).
  */
+struct dbpf_scratch
+{
+    int* head;
+    int* prev;
+    int next_base;
+
+    byte* out;      // for try_compress
+    int out_size;
+
+    byte* buffer;   // for dbpf_scratch_buffer
+    int buffer_size;
+};
+
+#define HASH_SIZE 65536
+#define W_SIZE 131072
+
 static
-byte* try_compress(const byte* src, int srclen, int* dstlen)
+byte* grow_buffer(byte** p, int* size, int need)
 {
-    // There are only 3 byte for the uncompressed size in the header,
-    // so I guess we can only compress files larger than 16MB...
-    if (srclen < 14 || srclen >= 16777216) return 0;
+    if (*p && *size >= need) return *p;
+    byte* q = mynew<byte>(need);
+    if (!q) return 0;
+    mydelete(*p);
+    *size = need;
+    return *p = q;
+}
+
+extern "C"
+dbpf_scratch* dbpf_scratch_new(void)
+{
+    dbpf_scratch* scratch = mynew<dbpf_scratch>(1);
+    if (!scratch) return 0;
+    scratch->head = mynew<int>(HASH_SIZE);
+    scratch->prev = mynew<int>(W_SIZE);
+    if (!scratch->head || !scratch->prev) {
+        mydelete(scratch->head);
+        mydelete(scratch->prev);
+        mydelete(scratch);
+        return 0;
+    }
+    memset(scratch->head, 0xFF, HASH_SIZE * sizeof(int));  // -1
+    scratch->next_base = 0;
+    scratch->out = scratch->buffer = 0;
+    scratch->out_size = scratch->buffer_size = 0;
+    return scratch;
+}
+
+extern "C"
+void dbpf_scratch_free(dbpf_scratch* scratch)
+{
+    if (!scratch) return;
+    mydelete(scratch->head);
+    mydelete(scratch->prev);
+    mydelete(scratch->out);
+    mydelete(scratch->buffer);
+    mydelete(scratch);
+}
+
+extern "C"
+byte* dbpf_scratch_buffer(dbpf_scratch* scratch, int size)
+{
+    return grow_buffer(&scratch->buffer, &scratch->buffer_size, size);
+}
+
+
+/*
+ * Try to compress the data and return the result in scratch->out, which
+ * is only good until the next call. If it's uncompressable, return NULL.
+ */
+static
+byte* try_compress(const byte* src, int srclen, int* dstlen, dbpf_scratch* scratch)
+{
+    if (srclen < 14 || srclen >= 16777216) return 0;  // see dbpf_compress
 
     // We only want the compressed output if it's smaller than the
     // uncompressed.
-    byte* dst = mynew<byte>(srclen-1);
+    byte* dst = grow_buffer(&scratch->out, &scratch->out_size, srclen-1);
     if (!dst) return 0;
 
-    byte* dstend = compress(src, src+srclen, dst, dst+srclen-1, false);
-    if (dstend) {
-        *dstlen = dstend - dst;
-        return dst;
-    } else {
-        *dstlen = 0;
-        mydelete(dst);
-        return 0;
-    }
+    *dstlen = dbpf_compress_scratch(src, srclen, dst, scratch);
+    return *dstlen ? dst : 0;
 }
 
 
@@ -986,11 +1696,9 @@ byte* try_compress(const byte* src, int srclen, int* dstlen)
 #define MAX_CHAIN   4096
 
 #define HASH_BITS 16
-#define HASH_SIZE 65536
 #define HASH_MASK 65535
 #define HASH_SHIFT 6
 
-#define W_SIZE 131072
 #define MAX_DIST W_SIZE
 #define W_MASK (W_SIZE-1)
 
@@ -1000,20 +1708,21 @@ class Hash
 private:
     unsigned hash;
     int *head, *prev;
+    int base;  // added to positions in head and prev; older ones come out negative
 public:
-    Hash() {
+    Hash(dbpf_scratch* scratch, unsigned length) {
         hash = 0;
-        head = mynew<int>(HASH_SIZE);
-        for (int i=0; i<HASH_SIZE; ++i)
-            head[i] = -1;
-        prev = mynew<int>(W_SIZE);
-    }
-    ~Hash() {
-        mydelete(head);
-        mydelete(prev);
+        head = scratch->head;
+        prev = scratch->prev;
+        if (scratch->next_base > 0x40000000) {
+            memset(head, 0xFF, HASH_SIZE * sizeof(int));  // -1
+            scratch->next_base = 0;
+        }
+        base = scratch->next_base;
+        scratch->next_base += length;
     }
 
-    int getprev(unsigned pos) const { return prev[pos & W_MASK]; }
+    int getprev(unsigned pos) const { return prev[pos & W_MASK] - base; }
 
     void update(unsigned c) {
         hash = ((hash << HASH_SHIFT) ^ c) & HASH_MASK;
@@ -1021,8 +1730,8 @@ public:
 
     int insert(unsigned pos) {
         int match_head = prev[pos & W_MASK] = head[hash];
-        head[hash] = pos;
-        return match_head;
+        head[hash] = base + pos;
+        return match_head - base;
     }
 };
 
@@ -1202,6 +1911,16 @@ unsigned longest_match(
 /* Returns the end of the compressed data if successful, or NULL if we overran the output buffer */
 
 byte* compress(const byte* src, const byte* srcend, byte* dst, byte* dstend, bool pad)
+{
+    dbpf_scratch* scratch = dbpf_scratch_new();
+    if (!scratch) return 0;
+    byte* result = compress_scratch(src, srcend, dst, dstend, pad, scratch);
+    dbpf_scratch_free(scratch);
+    return result;
+}
+
+static
+byte* compress_scratch(const byte* src, const byte* srcend, byte* dst, byte* dstend, bool pad, dbpf_scratch* scratch)
 {
     unsigned match_start = 0;
     unsigned match_length = MIN_MATCH-1;           /* length of best match */
@@ -1213,7 +1932,7 @@ byte* compress(const byte* src, const byte* srcend, byte* dst, byte* dstend, boo
 
     CompressedOutput compressed_output(src, dst+sizeof(dbpf_compressed_file_header), dstend);
 
-    Hash hash;
+    Hash hash(scratch, remaining);
     hash.update(src[0]);
     hash.update(src[1]);
 
@@ -87,6 +87,63 @@ void* ctx,     // opaque file pointer
     const char** error);
 
 
+/*
+ * The extended callback table for dbpf_open_ex. read, write and close
+ * are as for dbpf_open (close may also be NULL). The rest are optional
+ * and may be NULL:
+ *
+ * map returns a pointer to length bytes of the file starting at start,
+ * which must stay valid until release is called with the same arguments
+ * (release may be NULL if there's nothing to do). It returns NULL and
+ * sets the error string on failure. The library reads the index, the
+ * compressed file directory and compressed data straight out of the
+ * mapping instead of copying them, and always releases a mapping before
+ * calling write.
+ *
+ * readv does several reads at once; vec[i].length bytes at vec[i].start
+ * go to vec[i].buf. It succeeds or fails as a whole, like read.
+ *
+ * dbpf-io.cpp has ready-made implementations for memory-mapped files
+ * and for archives in memory.
+ */
+struct dbpf_iovec
+{
+    int start, length;
+    void* buf;
+};
+
+struct dbpf_callbacks
+{
+    int (*read)(void* ctx, int start, int length, void* buf, const char** error);
+    int (*write)(void* ctx, int start, int length, const void* buf, const char** error);
+    int (*close)(void* ctx);
+    const void* (*map)(void* ctx, int start, int length, const char** error);
+    void (*release)(void* ctx, const void* p, int start, int length);
+    int (*readv)(void* ctx, const struct dbpf_iovec* vec, int count, const char** error);
+};
+
+DBPF* dbpf_open_ex(void* ctx, const struct dbpf_callbacks* callbacks, const char** error);
+
+
+/*
+ * Opens a file with read and write callbacks that use positioned I/O
+ * (pread and pwrite), so reads are thread-safe (dbpf-io.cpp). Pass 0 for
+ * writable to open the file read-only.
+ */
+DBPF* dbpf_open_file(const char* filename, int writable, const char** error);
+
+/*
+ * Opens a file read-only and maps it into memory (dbpf-io.cpp).
+ */
+DBPF* dbpf_open_mmap(const char* filename, const char** error);
+
+/*
+ * Opens an archive that's already in memory, read-only (dbpf-io.cpp).
+ * The data isn't copied, so it must stay put until dbpf_close.
+ */
+DBPF* dbpf_open_memory(const void* data, int size, const char** error);
+
+
 /*
  * Calls the close callback and then frees the DBPF structure. Returns
  * whatever value the close callback returns. dbpf_close(0) is legal and
@@ -109,10 +166,37 @@ const struct dbpf_entry* dbpf_get_entries(const DBPF* dbpf);
 /*
  * Reads a file (decompressing it if necessary). Returns -1 on error.
  * *error is set as for dbpf_open.
+ *
+ * Threads: dbpf_read, dbpf_read_many, dbpf_read_64bytes and
+ * dbpf_map_entry/dbpf_unmap_entry keep no state in the DBPF (each call
+ * allocates its own buffers), so several threads can call them on one
+ * DBPF at once, as long as the read callbacks (read, map, release,
+ * readv) are thread-safe and nothing writes to the archive meanwhile.
+ * The callbacks in dbpf-io.cpp are; ones that seek and then read on a
+ * shared stdio FILE aren't.
  */
 int dbpf_read(DBPF* dbpf, int entry_index, unsigned char* buf, const char** error);
 
 
+/*
+ * Reads several files at once, entry_indexes[i] into bufs[i], with one
+ * call to the readv callback if there is one. Returns -1 on error, in
+ * which case some of the buffers may have been filled.
+ */
+int dbpf_read_many(DBPF* dbpf, const int* entry_indexes, int count, unsigned char* const* bufs, const char** error);
+
+
+/*
+ * Returns a file as it's stored in the archive: compressed (with header)
+ * if compressed_in_file is set, else size bytes. With a map callback
+ * this points into the mapping; otherwise it's a copy. Either way, give
+ * it back with dbpf_unmap_entry. Returns NULL on error.
+ */
+const unsigned char* dbpf_map_entry(DBPF* dbpf, int entry_index, const char** error);
+
+void dbpf_unmap_entry(DBPF* dbpf, int entry_index, const unsigned char* p);
+
+
 /*
  * Quickly reads the first 64 bytes of a file, which often (not always)
  * contains the file name. Fails if the file is shorter than 64 bytes.
@@ -162,6 +246,123 @@ int dbpf_write(
     const char** error);
 
 
+/*
+ * Reusable working memory for compression. Compressing an entry needs
+ * about 768K of tables, and dbpf_write needs a buffer for the output;
+ * with a scratch these are allocated once instead of for every entry.
+ * A scratch may only be used by one thread at a time, so give each
+ * thread its own. dbpf_scratch_new returns NULL on allocation failure.
+ */
+struct dbpf_scratch;
+
+struct dbpf_scratch* dbpf_scratch_new(void);
+void dbpf_scratch_free(struct dbpf_scratch* scratch);
+
+/*
+ * Returns a buffer of at least size bytes that belongs to the scratch,
+ * for instance for a get_data callback to return. It's only good until
+ * the next call, and its contents aren't kept when it has to grow.
+ * Returns NULL on allocation failure.
+ */
+unsigned char* dbpf_scratch_buffer(struct dbpf_scratch* scratch, int size);
+
+
+/*
+ * Like dbpf_write, but get_data is also given the entry being written and
+ * may change its write_disposition (to dbpf_write_uncompressed,
+ * dbpf_write_compressed or dbpf_write_compressed_raw) and, for
+ * dbpf_write_compressed_raw, its size_in_file, before returning the data.
+ * Nothing else in the entry may be changed. This lets you compress the
+ * data yourself (for instance on other threads, see dbpf_compress) and
+ * decide how to store each entry only once you have it.
+ */
+int dbpf_write_ex(
+    DBPF* dbpf,
+    const struct dbpf_entry* new_entries,
+    int new_entry_count,
+    void* ctx,
+    const unsigned char* (*get_data)(void* ctx, int entry_index, struct dbpf_entry* entry, const char** error),
+    struct dbpf_scratch* scratch,  // for compressing; NULL to allocate one for this call
+    const char** error);
+
+
+/*
+ * Compresses size bytes from src into dst, which must have room for size
+ * bytes, the way dbpf_write does with dbpf_write_compressed. Returns the
+ * compressed size (header included), or 0 if the data doesn't compress
+ * to less than its own size, in which case it should be stored
+ * uncompressed. Safe to call from several threads at once.
+ */
+int dbpf_compress(const unsigned char* src, int size, unsigned char* dst);
+
+/*
+ * The same, but with the tables in a scratch (see dbpf_scratch_new),
+ * which saves allocating them for every call.
+ */
+int dbpf_compress_scratch(const unsigned char* src, int size, unsigned char* dst, struct dbpf_scratch* scratch);
+
+
+/*
+ * Decompresses data as stored by dbpf_write_compressed(_raw), header
+ * included, into dst, which must hold exactly size bytes (the entry's
+ * size). Returns 0 on success or -1 if the data is corrupt or doesn't
+ * decompress to size bytes. Safe to call from several threads at once.
+ */
+int dbpf_decompress(const unsigned char* src, int compressed_size, unsigned char* dst, int size);
+
+
+/*
+ * Like dbpf_write, but everything it writes goes at the end of the file
+ * instead of into holes, and whatever the new index no longer uses is
+ * left as holes. This is also a safe update. It's meant for quick
+ * repeated edits during development, where searching for holes isn't
+ * worth it; the file only grows, so call dbpf_compact (or dbpf_write)
+ * now and then.
+ */
+int dbpf_append(
+    DBPF* dbpf,
+    const struct dbpf_entry* new_entries,
+    int new_entry_count,
+    void* ctx,
+    const unsigned char* (*get_data)(void* ctx, int entry_index, const char** error),
+    const char** error);
+
+
+/*
+ * Returns the fraction (0 to 1) of the file, up to the end of the last
+ * thing in it, that is unused space left behind by dbpf_write. Returns -1
+ * on allocation failure. Use this to decide when to call dbpf_compact.
+ */
+double dbpf_get_fragmentation(DBPF* dbpf);
+
+
+enum {  // orders for dbpf_compact
+
+    dbpf_compact_keep_order = 0,   // keep entries in their current order in the file
+
+    dbpf_compact_by_type = 1,      // group entries by type id
+
+    dbpf_compact_by_tgi = 2,       // sort entries as dbpf_compare_entries does
+};
+
+/*
+ * Moves the entries together at the start of the file, in the given
+ * order, and truncates the file after them, so that there are no holes.
+ * Nothing is decompressed or recompressed. With an order other than
+ * dbpf_compact_keep_order, the index is rewritten in the new order too.
+ *
+ * Unlike dbpf_write this is NOT a safe update: it overwrites data in
+ * place, so if it fails (negative return) the file may be corrupt. If
+ * the entries are already in the requested order it needs no extra
+ * space; otherwise it first copies them past the end of the file, so
+ * the file temporarily grows by the size of its contents.
+ *
+ * If the function succeeds, call dbpf_get_entry_count and
+ * dbpf_get_entries again.
+ */
+int dbpf_compact(DBPF* dbpf, int order, const char** error);
+
+
 /*
  * A convenience function for comparing the type, group, and instance of
  * two dbpf_entries. Returns positive, negative or zero a la strcmp().